@@ -0,0 +1,45 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Geometry pass of the deferred path, writes the GBuffer instead of shading.
+
+layout(location = 0) in vec2 texCoord;
+layout(location = 1) in vec3 normal;
+
+layout(location = 0) out vec2 outNormal;
+layout(location = 1) out vec4 outAlbedo;
+layout(location = 2) out vec2 outMaterial;
+
+struct MaterialData {
+    vec4 base_color;
+    uint diffuse_texture;
+    float roughness;
+    float metalness;
+};
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+layout(std430, set = 1, binding = 1) readonly buffer Materials {
+    MaterialData materials[];
+};
+
+layout(push_constant) uniform MaterialPushConstants {
+    uint material_slot;
+} pc;
+
+vec2 encode_octahedral(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 encoded = n.xy;
+    if (n.z < 0.0) {
+        encoded = (1.0 - abs(n.yx)) *
+                  vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return encoded;
+}
+
+void main() {
+    MaterialData material = materials[pc.material_slot];
+    outAlbedo = texture(textures[nonuniformEXT(material.diffuse_texture)], texCoord) * material.base_color;
+    outNormal = encode_octahedral(normalize(normal));
+    outMaterial = vec2(material.roughness, material.metalness);
+}
@@ -0,0 +1,154 @@
+#version 450
+
+// Lighting pass of the deferred path, shades every pixel the geometry pass
+// covered from the GBuffer with the roughness and metalness it stores. Only
+// the lights binned into the pixel's cluster are evaluated.
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 0, binding = 0) uniform sampler2D gbuffer_normal;
+layout(set = 0, binding = 1) uniform sampler2D gbuffer_albedo;
+layout(set = 0, binding = 2) uniform sampler2D gbuffer_material;
+layout(set = 0, binding = 3) uniform sampler2D gbuffer_depth;
+
+// Matching LightGrid.
+const uint tiles_x = 16;
+const uint tiles_y = 9;
+const uint depth_slices = 24;
+const uint max_lights_per_cluster = 128;
+
+// View space.
+struct Light {
+    vec3 position;
+    float range;
+    vec3 color;
+    float cos_inner;
+    vec3 direction;
+    float cos_outer;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Lights {
+    Light lights[];
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer Counts {
+    uint counts[];
+};
+
+layout(std430, set = 1, binding = 2) readonly buffer Indices {
+    uint indices[];
+};
+
+layout(push_constant) uniform LightingPushConstants {
+    mat4 inverse_projection;
+    float clip_near;
+    float clip_far;
+    float headlight;
+} pc;
+
+vec3 decode_octahedral(vec2 encoded) {
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (normal.z < 0.0) {
+        normal.xy = (1.0 - abs(normal.yx)) *
+                    vec2(normal.x >= 0.0 ? 1.0 : -1.0,
+                         normal.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(normal);
+}
+
+// View space position of the pixel from its depth.
+vec3 view_position(ivec2 pixel, float depth) {
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(gbuffer_depth, 0)) * 2.0 - 1.0;
+    vec4 position = pc.inverse_projection * vec4(ndc, depth, 1.0);
+    return position.xyz / position.w;
+}
+
+uint cluster_index(float depth) {
+    uvec2 tile = uvec2(gl_FragCoord.xy * vec2(tiles_x, tiles_y) /
+                       vec2(textureSize(gbuffer_depth, 0)));
+    tile = min(tile, uvec2(tiles_x - 1, tiles_y - 1));
+    float slice = log(depth / pc.clip_near) /
+                  log(pc.clip_far / pc.clip_near) * float(depth_slices);
+    uint z = uint(clamp(slice, 0.0, float(depth_slices - 1)));
+    return (z * tiles_y + tile.y) * tiles_x + tile.x;
+}
+
+// Inverse square falloff, windowed to reach zero at range.
+float attenuation(float distance, float range) {
+    float ratio = distance / range;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return window * window / (distance * distance + 1.0);
+}
+
+const float pi = 3.14159265;
+
+// Share of a unit light from direction that is reflected towards view: a
+// Lambert diffuse and a GGX specular term. Metals have no diffuse and tint
+// their reflections.
+vec3 brdf(vec3 normal, vec3 view, vec3 direction, vec3 albedo,
+          float roughness, float metalness) {
+    float n_dot_l = max(dot(normal, direction), 0.0);
+    if (n_dot_l == 0.0) {
+        return vec3(0.0);
+    }
+    vec3 half_vector = normalize(view + direction);
+    float n_dot_v = max(dot(normal, view), 1e-4);
+    float n_dot_h = max(dot(normal, half_vector), 0.0);
+    float v_dot_h = max(dot(view, half_vector), 0.0);
+
+    float alpha = max(roughness * roughness, 1e-3);
+    float alpha2 = alpha * alpha;
+    float d = n_dot_h * n_dot_h * (alpha2 - 1.0) + 1.0;
+    float distribution = alpha2 / (pi * d * d);
+    // Smith visibility, Schlick approximation with k = alpha / 2.
+    float k = alpha * 0.5;
+    float visibility = 0.25 / ((n_dot_l * (1.0 - k) + k) *
+                               (n_dot_v * (1.0 - k) + k));
+    vec3 f0 = mix(vec3(0.04), albedo, metalness);
+    vec3 fresnel = f0 + (1.0 - f0) * pow(1.0 - v_dot_h, 5.0);
+
+    // Diffuse keeps the scale of the forward path, which has no 1 / pi, so
+    // the specular term is scaled by pi instead.
+    vec3 diffuse = albedo * (1.0 - metalness) * (1.0 - fresnel);
+    return (diffuse + fresnel * (distribution * visibility * pi)) * n_dot_l;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbuffer_depth, pixel, 0).r;
+    // Nothing was drawn here, keep the clear color.
+    if (depth == 1.0) {
+        discard;
+    }
+
+    vec3 normal = decode_octahedral(texelFetch(gbuffer_normal, pixel, 0).rg);
+    vec4 albedo = texelFetch(gbuffer_albedo, pixel, 0);
+    vec2 material = texelFetch(gbuffer_material, pixel, 0).rg;
+    vec3 position = view_position(pixel, depth);
+    vec3 view = -normalize(position);
+
+    // Headlight: lit along the view ray.
+    vec3 lit = pc.headlight *
+               brdf(normal, view, view, albedo.rgb, material.r, material.g);
+
+    uint cluster = cluster_index(-position.z);
+    uint first = cluster * max_lights_per_cluster;
+    uint count = counts[cluster];
+    for (uint i = 0; i < count; i++) {
+        Light light = lights[indices[first + i]];
+        vec3 to_light = light.position - position;
+        float distance = length(to_light);
+        if (distance >= light.range) {
+            continue;
+        }
+        vec3 direction = to_light / distance;
+        float spot = light.cos_outer > -1.0
+                         ? smoothstep(light.cos_outer, light.cos_inner,
+                                      dot(-direction, light.direction))
+                         : 1.0;
+        lit += light.color * (attenuation(distance, light.range) * spot) *
+               brdf(normal, view, direction, albedo.rgb, material.r,
+                    material.g);
+    }
+    outColor = vec4(lit, albedo.a);
+}
@@ -1,13 +1,30 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec2 texCoord;
 layout(location = 1) in vec3 normal;
 
 layout(location = 0) out vec4 outColor;
 
+struct MaterialData {
+    vec4 base_color;
+    uint diffuse_texture;
+    float roughness;
+    float metalness;
+};
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+layout(std430, set = 1, binding = 1) readonly buffer Materials {
+    MaterialData materials[];
+};
+
+layout(push_constant) uniform MaterialPushConstants {
+    uint material_slot;
+} pc;
+
 void main() {
-    const int M = 10;
-    float checker = float((mod(texCoord[0] * M, 1.0) > 0.5) ^^ (mod(texCoord[1] * M, 1.0) < 0.5));
-    float c = 0.3 * (1 - checker) + 0.7 * checker;
-    outColor = vec4(c, c, c, 1.0) * dot(normalize(normal), vec3(0, 0, 1));
-}
\ No newline at end of file
+    MaterialData material = materials[pc.material_slot];
+    vec4 diffuse = texture(textures[nonuniformEXT(material.diffuse_texture)], texCoord) * material.base_color;
+    outColor = vec4(diffuse.rgb * dot(normalize(normal), vec3(0, 0, 1)), diffuse.a);
+}
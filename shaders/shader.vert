@@ -1,20 +1,53 @@
 #version 450
 
+// Either floats or, for packed meshes, snorm positions within the mesh
+// bounds, octahedral snorm normals in xy and half float texture coordinates.
 layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inTexCoord;
 
-layout(set = 0, binding = 0) uniform MeshProjectionData {
-    mat4 to_view;
-    mat4 normal_to_view;
-    mat4 to_screen;
-} proj_data;
+// After the material slot of the fragment stage.
+layout(push_constant) uniform MeshPushConstants {
+    layout(offset = 16) vec3 position_offset;
+    uint octahedral_normals;
+    vec3 position_scale;
+} mesh;
+
+layout(set = 0, binding = 0) uniform SceneData {
+    mat4 view;
+    mat4 projection;
+    mat4 view_projection;
+} scene;
+
+struct ObjectData {
+    mat4 to_world;
+    mat4 normal_to_world;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Objects {
+    ObjectData objects[];
+};
 
 layout(location = 0) out vec2 outTexCoord;
 layout(location = 1) out vec3 outNormal;
 
+vec3 decode_octahedral(vec2 encoded) {
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (normal.z < 0.0) {
+        normal.xy = (1.0 - abs(normal.yx)) *
+                    vec2(normal.x >= 0.0 ? 1.0 : -1.0,
+                         normal.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(normal);
+}
+
 void main() {
-    gl_Position = proj_data.to_screen * vec4(inPos, 1.0);
+    ObjectData object = objects[gl_InstanceIndex];
+    vec3 position = mesh.position_offset + mesh.position_scale * inPos;
+    vec3 normal = mesh.octahedral_normals != 0
+                      ? decode_octahedral(inNormal.xy)
+                      : inNormal;
+    gl_Position = scene.view_projection * object.to_world * vec4(position, 1.0);
     outTexCoord = inTexCoord;
-    outNormal = mat3(proj_data.normal_to_view) * inNormal;
-}
\ No newline at end of file
+    outNormal = mat3(scene.view) * mat3(object.normal_to_world) * normal;
+}
@@ -0,0 +1,136 @@
+// Compares Bvh frustum and ray queries with testing every box, before and
+// after refits, and times both. Usage: bvh_bench [objects] [queries]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <glm/gtx/transform.hpp>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+
+static std::vector<uint32_t> cull_brute_force(const std::vector<AABB>& boxes,
+                                              const Frustum& frustum) {
+  std::vector<uint32_t> visible;
+  for (uint32_t i = 0; i < boxes.size(); i++) {
+    if (frustum.classify(boxes[i]) != Containment::eOutside) {
+      visible.push_back(i);
+    }
+  }
+  return visible;
+}
+
+// Objects of partially visible leaves are tested individually, like
+// Scene::cull() does.
+static std::vector<uint32_t> cull_bvh(const Bvh& bvh, const Frustum& frustum) {
+  std::vector<uint32_t> visible;
+  bvh.traverse([&](const AABB& box) { return frustum.classify(box); },
+               [&](uint32_t object, bool inside) {
+                 if (inside || frustum.classify(bvh.bounds(object)) !=
+                                   Containment::eOutside) {
+                   visible.push_back(object);
+                 }
+               });
+  std::sort(visible.begin(), visible.end());
+  return visible;
+}
+
+// Same slab test as Bvh::raycast(), closest entry distance or infinity.
+static float raycast_brute_force(const std::vector<AABB>& boxes,
+                                 const glm::vec3& origin,
+                                 const glm::vec3& direction,
+                                 float max_distance) {
+  glm::vec3 inverse_direction = 1.0f / direction;
+  float closest = std::numeric_limits<float>::infinity();
+  for (const auto& box : boxes) {
+    glm::vec3 t0 = (box.min - origin) * inverse_direction;
+    glm::vec3 t1 = (box.max - origin) * inverse_direction;
+    glm::vec3 near = glm::min(t0, t1);
+    glm::vec3 far = glm::max(t0, t1);
+    float t_near = std::max({near.x, near.y, near.z, 0.0f});
+    float t_far = std::min({far.x, far.y, far.z, max_distance});
+    if (t_near <= t_far) {
+      closest = std::min(closest, t_near);
+    }
+  }
+  return closest;
+}
+
+template <typename F>
+static double time_ms(F&& fn) {
+  auto start = std::chrono::high_resolution_clock::now();
+  fn();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 20000;
+  int queries = argc > 2 ? std::stoi(argv[2]) : 200;
+
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> size(0.1f, 1.0f);
+  auto random_box = [&] {
+    glm::vec3 center(unit(rng) * 100.0f, unit(rng) * 10.0f,
+                     unit(rng) * 100.0f);
+    glm::vec3 extent(size(rng), size(rng), size(rng));
+    return AABB{center - extent, center + extent};
+  };
+  std::vector<AABB> boxes(count);
+  for (auto& box : boxes) {
+    box = random_box();
+  }
+
+  Bvh bvh;
+  double build_ms = time_ms([&] { bvh.build(boxes); });
+  std::cout << count << " objects, build: " << build_ms << " ms, "
+            << bvh.node_count() << " nodes\n";
+
+  auto compare = [&](const std::string& name) {
+    size_t cull_mismatches = 0;
+    size_t ray_mismatches = 0;
+    double brute_ms = 0;
+    double bvh_ms = 0;
+    for (int q = 0; q < queries; q++) {
+      glm::vec3 eye(unit(rng) * 100.0f, unit(rng) * 20.0f,
+                    unit(rng) * 100.0f);
+      glm::vec3 direction = glm::normalize(
+          glm::vec3(unit(rng), unit(rng) * 0.3f, unit(rng)) +
+          glm::vec3(0.0f, 0.0f, 1e-3f));
+      Frustum frustum = Frustum::from_matrix(
+          glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 80.0f) *
+          glm::lookAt(eye, eye + direction, glm::vec3(0, 1, 0)));
+
+      std::vector<uint32_t> expected, actual;
+      brute_ms += time_ms([&] { expected = cull_brute_force(boxes, frustum); });
+      bvh_ms += time_ms([&] { actual = cull_bvh(bvh, frustum); });
+      cull_mismatches += expected != actual;
+
+      float expected_hit = raycast_brute_force(boxes, eye, direction, 200.0f);
+      auto hit = bvh.raycast(eye, direction, 200.0f);
+      float actual_hit =
+          hit ? hit->distance : std::numeric_limits<float>::infinity();
+      ray_mismatches += expected_hit != actual_hit;
+    }
+    std::cout << name << ": cull brute force " << brute_ms / queries
+              << " ms, bvh " << bvh_ms / queries << " ms, " << cull_mismatches
+              << " of " << queries << " culls and " << ray_mismatches
+              << " rays differ\n";
+    return cull_mismatches + ray_mismatches;
+  };
+
+  size_t mismatches = compare("built");
+
+  // Moves a tenth of the objects and refits, as Scene::update() does.
+  for (size_t i = 0; i < count / 10; i++) {
+    uint32_t object = rng() % count;
+    boxes[object] = random_box();
+    bvh.refit(object, boxes[object]);
+  }
+  mismatches += compare("refit");
+  return mismatches == 0 ? 0 : 1;
+}
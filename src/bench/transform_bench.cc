@@ -0,0 +1,104 @@
+// Compares TransformBatch with computing ObjectData one object at a time
+// through glm. Usage: transform_bench [objects] [iterations]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <glm/gtx/transform.hpp>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "transform_batch.h"
+
+static void compute_glm(const std::vector<glm::mat4>& transforms,
+                        ObjectData* out) {
+  for (size_t i = 0; i < transforms.size(); i++) {
+    out[i].to_world = transforms[i];
+    out[i].normal_to_world = glm::transpose(glm::inverse(transforms[i]));
+  }
+}
+
+static float max_error(const std::vector<ObjectData>& expected,
+                       const std::vector<ObjectData>& actual) {
+  float error = 0.0f;
+  for (size_t i = 0; i < expected.size(); i++) {
+    for (int c = 0; c < 3; c++) {
+      for (int r = 0; r < 3; r++) {
+        error = std::max(error, std::abs(expected[i].normal_to_world[c][r] -
+                                         actual[i].normal_to_world[c][r]));
+      }
+    }
+    for (int c = 0; c < 4; c++) {
+      for (int r = 0; r < 4; r++) {
+        error = std::max(error, std::abs(expected[i].to_world[c][r] -
+                                         actual[i].to_world[c][r]));
+      }
+    }
+  }
+  return error;
+}
+
+template <typename F>
+static double time_ms(int iterations, F&& fn) {
+  fn();
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    fn();
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() /
+         iterations;
+}
+
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 65536;
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 50;
+
+  // Half of the objects are scaled uniformly, like most scene content.
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+  std::vector<glm::mat4> transforms(count);
+  TransformBatch batch;
+  for (size_t i = 0; i < count; i++) {
+    glm::vec3 axis = glm::normalize(
+        glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0, 0, 2));
+    glm::vec3 s(scale(rng));
+    if (i % 2) {
+      s = glm::vec3(scale(rng), scale(rng), scale(rng));
+    }
+    transforms[i] = glm::translate(glm::vec3(unit(rng), unit(rng), unit(rng)) *
+                                   10.0f) *
+                    glm::rotate(unit(rng) * 3.14f, axis) * glm::scale(s);
+    batch.add(transforms[i]);
+  }
+
+  std::vector<ObjectData> expected(count);
+  std::vector<ObjectData> actual(count);
+
+  double glm_ms =
+      time_ms(iterations, [&] { compute_glm(transforms, expected.data()); });
+  std::cout << count << " objects, glm: " << glm_ms << " ms\n";
+
+  auto report = [&](const std::string& name, TransformBatch::Kernel kernel,
+                    bool parallel) {
+    double ms = time_ms(iterations, [&] {
+      batch.compute(actual.data(), kernel, parallel);
+    });
+    std::cout << name << ": " << ms << " ms, " << glm_ms / ms
+              << "x, max error " << max_error(expected, actual) << "\n";
+  };
+
+  report("batch scalar", TransformBatch::Kernel::eScalar, false);
+  auto best = TransformBatch::best_kernel();
+  if (best != TransformBatch::Kernel::eScalar) {
+    report("batch sse", TransformBatch::Kernel::eSSE, false);
+  }
+  if (best == TransformBatch::Kernel::eAVX2) {
+    report("batch avx2", TransformBatch::Kernel::eAVX2, false);
+  }
+  report("batch best, threaded", best, true);
+  return 0;
+}
@@ -4,7 +4,9 @@
 
 class FreeFlyCamera : public Camera {
  public:
-  FreeFlyCamera(Display* display_ptr) : Camera(display_ptr) {}
+  FreeFlyCamera(Display* display_ptr)
+      : Camera(display_ptr->swapchain.get_surface_extend()),
+        display{display_ptr} {}
 
   void sdl_handle_tick() override {
     static auto startTime = std::chrono::high_resolution_clock::now();
@@ -80,6 +82,8 @@ class FreeFlyCamera : public Camera {
   }
 
  private:
+  Display* display;
+
   float xvel = 0;
   float yvel = 0;
 };
\ No newline at end of file
@@ -1,57 +1,36 @@
 #pragma once
 
-#include "../vulkan_layer/vulkan_layer.h"
-#include "Texture.h"
+#include "bindless_materials.h"
 
+// Handle to an entry of BindlessMaterials. Copies refer to the same entry.
 class Material {
  public:
-  Texture diffuse;
-
-  Material(Texture diffuse) : diffuse{diffuse} { create_descriptor_set(); }
+  TextureHandle diffuse;
+  uint32_t index;
+
+  Material(TextureHandle diffuse, const glm::vec4& base_color = glm::vec4(1),
+           float roughness = 1.0f, float metalness = 0.0f)
+      : diffuse{diffuse} {
+    index = BindlessMaterials::get_instance().add_material(
+        diffuse, base_color, roughness, metalness);
+  }
 
+  // BindlessMaterials has to be bound already, only the slot is pushed.
   void record_draw(vk::CommandBuffer& cmd_buffer,
-                   const vk::PipelineLayout& pipe_layout) {
-    cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipe_layout,
-                                  1, 1, &desc_set.set, 0, nullptr);
+                   const vk::PipelineLayout& pipe_layout,
+                   uint32_t frame_index) {
+    MaterialPushConstants constants{
+        BindlessMaterials::get_instance().material_slot(index, frame_index)};
+    cmd_buffer.pushConstants(pipe_layout, vk::ShaderStageFlagBits::eFragment,
+                             0, sizeof(MaterialPushConstants), &constants);
   }
 
   static vk::DescriptorSetLayout get_descriptor_set_layout() {
-    return VulkanLayer::get_instance().create_descriptor_set_layout(
-        get_descriptor_set_info());
-  }
-
- private:
-  DescriptorSet desc_set;
-
-  static DescriptorSetInfo get_descriptor_set_info() {
-    std::vector<vk::DescriptorSetLayoutBinding> bindings(1);
-    bindings[0].binding = 0;
-    bindings[0].setStageFlags(vk::ShaderStageFlagBits::eFragment);
-    bindings[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
-    bindings[0].descriptorCount = 1;
-
-    return DescriptorSetInfo(vk::DescriptorSetLayoutCreateInfo(), bindings);
+    return BindlessMaterials::get_instance().layout;
   }
 
-  void create_descriptor_set() {
-    auto set_layout_info = get_descriptor_set_info();
-
-    desc_set =
-        VulkanLayer::get_instance().allocate_descriptor_set(set_layout_info);
-
-    vk::DescriptorImageInfo diff_info;
-    diff_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    diff_info.imageView = diffuse.view.view;
-    diff_info.sampler = diffuse.sampler;
-
-    std::vector<vk::WriteDescriptorSet> writes(1);
-    writes[0].dstSet = desc_set.set;
-    writes[0].dstBinding = 0;
-    writes[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
-    writes[0].dstArrayElement = 0;
-    writes[0].descriptorCount = 1;
-    writes[0].pImageInfo = &diff_info;
-
-    VulkanLayer::get_instance().device.updateDescriptorSets(writes, {});
+  static vk::PushConstantRange get_push_constant_range() {
+    return vk::PushConstantRange(vk::ShaderStageFlagBits::eFragment, 0,
+                                 sizeof(MaterialPushConstants));
   }
-};
\ No newline at end of file
+};
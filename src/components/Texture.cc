@@ -1,38 +1,26 @@
 #include "Texture.h"
 
+#include "../vulkan_layer/upload_manager.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-Texture Texture::load(const std::string& path) {
-  int texWidth, texHeight, texChannels;
-  stbi_uc* pixels = stbi_load(path.c_str(), &texWidth, &texHeight, &texChannels,
-                              STBI_rgb_alpha);
-  vk::DeviceSize imageSize = texWidth * texHeight * 4;
-
-  if (!pixels) {
+Texture Texture::load(const std::string& path, TextureUsage usage) {
+  CookedTexture cooked;
+  if (!TextureCooker::load(path, usage, preferred_format(usage), cooked)) {
     throw std::runtime_error("failed to load texture image!");
   }
+  return create(cooked);
+}
 
-  auto staging_buffer = VulkanLayer::get_instance().create_buffer(
-      imageSize, vk::BufferUsageFlagBits::eTransferSrc);
-
-  void* staging_ptr;
-  staging_buffer.map(staging_ptr);
-  std::memcpy(staging_ptr, pixels, imageSize);
-  staging_buffer.unmap();
-  stbi_image_free(pixels);
+Texture Texture::create(const void* pixels, uint32_t width, uint32_t height) {
+  vk::DeviceSize imageSize = vk::DeviceSize(width) * height * 4;
 
   auto view = VulkanLayer::get_instance().create_2d_image_view(
-      {texWidth, texHeight}, vk::Format::eR8G8B8A8Srgb,
+      {width, height}, vk::Format::eR8G8B8A8Srgb,
       vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
       vk::ImageAspectFlagBits::eColor, VMA_MEMORY_USAGE_GPU_ONLY);
 
-  auto cpy_cmd_buffer = VulkanLayer::get_instance().create_command_buffer(
-      VulkanLayer::get_instance().graphics_command_pool);
-
-  vk::CommandBufferBeginInfo bi;
-  cpy_cmd_buffer.begin(bi);
-
   vk::BufferImageCopy region;
   region.bufferOffset = 0;
   region.bufferRowLength = 0;
@@ -42,35 +30,71 @@ Texture Texture::load(const std::string& path) {
   region.imageSubresource.baseArrayLayer = 0;
   region.imageSubresource.layerCount = 1;
   region.imageOffset = vk::Offset3D();
-  region.imageExtent = vk::Extent3D(texWidth, texHeight, 1);
-
-  VulkanLayer::get_instance().record_layout_transition(
-      cpy_cmd_buffer, view.image.image, vk::ImageLayout::eUndefined,
-      vk::ImageLayout::eTransferDstOptimal,
-      vk::PipelineStageFlagBits::eTopOfPipe,
-      vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eNone,
-      vk::AccessFlagBits::eTransferWrite, vk::ImageAspectFlagBits::eColor);
-
-  cpy_cmd_buffer.copyBufferToImage(staging_buffer.buffer, view.image.image,
-                                   vk::ImageLayout::eTransferDstOptimal, 1,
-                                   &region);
-
-  VulkanLayer::get_instance().record_layout_transition(
-      cpy_cmd_buffer, view.image.image, vk::ImageLayout::eTransferDstOptimal,
-      vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::PipelineStageFlagBits::eTransfer,
-      vk::PipelineStageFlagBits::eBottomOfPipe, vk::AccessFlagBits::eTransferWrite,
-      vk::AccessFlagBits::eNone, vk::ImageAspectFlagBits::eColor);
-      
-  cpy_cmd_buffer.end();
-
-  vk::SubmitInfo submit;
-  submit.commandBufferCount = 1;
-  submit.pCommandBuffers = &cpy_cmd_buffer;
-
-  VulkanLayer::get_instance().graphics_queue.submit({submit});
+  region.imageExtent = vk::Extent3D(width, height, 1);
+
+  UploadManager::get_instance().upload_image(view.image, pixels, imageSize,
+                                             {region});
 
   auto sampler = VulkanLayer::get_instance().create_sampler();
 
   return Texture(view, sampler);
-}
\ No newline at end of file
+}
+
+Texture Texture::create(const CookedTexture& cooked) {
+  auto mip_levels = uint32_t(cooked.levels.size());
+  const auto& base = cooked.levels[0];
+
+  auto view = VulkanLayer::get_instance().create_2d_image_view(
+      {base.width, base.height}, vk_format(cooked.format, cooked.usage),
+      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+      vk::ImageAspectFlagBits::eColor, VMA_MEMORY_USAGE_GPU_ONLY, mip_levels);
+
+  // Levels are tightly packed, block rows included, so the row length can
+  // be derived from the extent.
+  std::vector<vk::BufferImageCopy> regions;
+  for (uint32_t i = 0; i < mip_levels; i++) {
+    const auto& level = cooked.levels[i];
+    vk::BufferImageCopy region;
+    region.bufferOffset = level.offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.mipLevel = i;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = vk::Offset3D();
+    region.imageExtent = vk::Extent3D(level.width, level.height, 1);
+    regions.push_back(region);
+  }
+
+  UploadManager::get_instance().upload_image(view.image, cooked.data(),
+                                             cooked.size(), regions,
+                                             mip_levels);
+
+  auto sampler = VulkanLayer::get_instance().create_sampler(mip_levels);
+
+  return Texture(view, sampler);
+}
+
+TextureFormat Texture::preferred_format(TextureUsage usage) {
+  if (!VulkanLayer::get_instance().device_features.textureCompressionBC) {
+    return TextureFormat::eRGBA8;
+  }
+  return usage == TextureUsage::eColor ? TextureFormat::eBC7
+                                       : TextureFormat::eBC5;
+}
+
+vk::Format Texture::vk_format(TextureFormat format, TextureUsage usage) {
+  bool srgb = usage == TextureUsage::eColor;
+  switch (format) {
+    case TextureFormat::eBC1:
+      return srgb ? vk::Format::eBc1RgbSrgbBlock
+                  : vk::Format::eBc1RgbUnormBlock;
+    case TextureFormat::eBC5:
+      return vk::Format::eBc5UnormBlock;
+    case TextureFormat::eBC7:
+      return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+    default:
+      return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+  }
+}
@@ -1,13 +1,31 @@
 #pragma once
 
 #include "../vulkan_layer/vulkan_layer.h"
+#include "texture_cooker.h"
 
 class Texture {
  public:
   ImageView view;
   vk::Sampler sampler;
 
+  Texture() {}
   Texture(ImageView view, vk::Sampler sampler) : view{view}, sampler{sampler} {}
 
-  static Texture load(const std::string& path);
-};
\ No newline at end of file
+  // Loads or cooks the mip chain and uploads it on the calling thread.
+  // Prefer TextureStreamer::load.
+  static Texture load(const std::string& path,
+                      TextureUsage usage = TextureUsage::eColor);
+
+  // Creates the image and queues the upload of tightly packed RGBA8 pixels
+  // with the UploadManager. The pixels may be freed once this returns.
+  static Texture create(const void* pixels, uint32_t width, uint32_t height);
+
+  // Same for every level of a cooked mip chain.
+  static Texture create(const CookedTexture& cooked);
+
+  // BC7 for color and BC5 for normal maps where the device samples block
+  // compressed formats, RGBA8 otherwise.
+  static TextureFormat preferred_format(TextureUsage usage);
+
+  static vk::Format vk_format(TextureFormat format, TextureUsage usage);
+};
@@ -0,0 +1,128 @@
+#include "bindless_materials.h"
+
+#include <algorithm>
+
+BindlessMaterials::BindlessMaterials() {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+
+  // Combined image samplers count against the sampler and the sampled image
+  // limits.
+  auto properties = vulkan_layer.physical_device.getProperties2<
+      vk::PhysicalDeviceProperties2, vk::PhysicalDeviceVulkan12Properties>();
+  const auto& limits12 = properties.get<vk::PhysicalDeviceVulkan12Properties>();
+  texture_capacity = std::min(
+      {max_textures, limits12.maxPerStageDescriptorUpdateAfterBindSamplers,
+       limits12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+       limits12.maxDescriptorSetUpdateAfterBindSamplers,
+       limits12.maxDescriptorSetUpdateAfterBindSampledImages});
+
+  std::vector<vk::DescriptorSetLayoutBinding> bindings(2);
+  bindings[0].binding = 0;
+  bindings[0].setStageFlags(vk::ShaderStageFlagBits::eFragment);
+  bindings[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  bindings[0].descriptorCount = texture_capacity;
+  bindings[1].binding = 1;
+  bindings[1].setStageFlags(vk::ShaderStageFlagBits::eFragment);
+  bindings[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+  bindings[1].descriptorCount = 1;
+
+  std::vector<vk::DescriptorBindingFlags> binding_flags{
+      vk::DescriptorBindingFlagBits::ePartiallyBound |
+          vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+          vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending,
+      {}};
+
+  vk::DescriptorSetLayoutCreateInfo layout_ci;
+  layout_ci.flags =
+      vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+  layout = vulkan_layer.create_descriptor_set_layout(
+      DescriptorSetInfo(layout_ci, bindings, binding_flags));
+
+  // Update after bind sets need a pool of their own.
+  std::vector<vk::DescriptorPoolSize> pool_sizes{
+      {vk::DescriptorType::eCombinedImageSampler, texture_capacity},
+      {vk::DescriptorType::eStorageBuffer, 1}};
+  vk::DescriptorPoolCreateInfo pool_info;
+  pool_info.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+  pool_info.maxSets = 1;
+  pool_info.setPoolSizes(pool_sizes);
+  pool = vulkan_layer.device.createDescriptorPool(pool_info);
+
+  vk::DescriptorSetAllocateInfo alloc_info;
+  alloc_info.descriptorPool = pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &layout;
+  set = vulkan_layer.device.allocateDescriptorSets(alloc_info)[0];
+
+  vk::DeviceSize slice_size = sizeof(MaterialData) * max_materials;
+  material_buffer = vulkan_layer.create_buffer(
+      slice_size * VulkanLayer::frames_in_flight,
+      vk::BufferUsageFlagBits::eStorageBuffer);
+  material_buffer.map(material_buffer_ptr);
+
+  vk::DescriptorBufferInfo buffer_info;
+  buffer_info.buffer = material_buffer.buffer;
+  buffer_info.range = VK_WHOLE_SIZE;
+
+  vk::WriteDescriptorSet write;
+  write.dstSet = set;
+  write.dstBinding = 1;
+  write.descriptorType = vk::DescriptorType::eStorageBuffer;
+  write.descriptorCount = 1;
+  write.pBufferInfo = &buffer_info;
+  vulkan_layer.device.updateDescriptorSets({write}, {});
+}
+
+uint32_t BindlessMaterials::add_texture(const Texture& texture) {
+  if (next_texture == texture_capacity) {
+    throw std::runtime_error("bindless texture array is full!");
+  }
+
+  vk::DescriptorImageInfo image_info;
+  image_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  image_info.imageView = texture.view.view;
+  image_info.sampler = texture.sampler;
+
+  vk::WriteDescriptorSet write;
+  write.dstSet = set;
+  write.dstBinding = 0;
+  write.dstArrayElement = next_texture;
+  write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  write.descriptorCount = 1;
+  write.pImageInfo = &image_info;
+  VulkanLayer::get_instance().device.updateDescriptorSets({write}, {});
+
+  return next_texture++;
+}
+
+uint32_t BindlessMaterials::add_material(const TextureHandle& diffuse,
+                                         const glm::vec4& base_color,
+                                         float roughness, float metalness) {
+  if (materials.size() == max_materials) {
+    throw std::runtime_error("material buffer is full!");
+  }
+  materials.push_back({diffuse, base_color, roughness, metalness});
+  return materials.size() - 1;
+}
+
+void BindlessMaterials::update(uint32_t frame_index) {
+  auto slice = reinterpret_cast<MaterialData*>(
+      static_cast<char*>(material_buffer_ptr) +
+      sizeof(MaterialData) * max_materials * frame_index);
+  for (size_t i = 0; i < materials.size(); i++) {
+    MaterialData data{};
+    data.base_color = materials[i].base_color;
+    data.diffuse_texture = materials[i].diffuse->texture_index;
+    data.roughness = materials[i].roughness;
+    data.metalness = materials[i].metalness;
+    slice[i] = data;
+  }
+  material_buffer.flush();
+}
+
+void BindlessMaterials::bind(vk::CommandBuffer& cmd_buffer,
+                             const vk::PipelineLayout& pipe_layout,
+                             uint32_t set_index) {
+  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipe_layout,
+                                set_index, 1, &set, 0, nullptr);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "../vulkan_layer/vulkan_layer.h"
+#include "texture_streamer.h"
+
+// std430 layout of one entry of the material buffer.
+struct MaterialData {
+  glm::vec4 base_color;
+  uint32_t diffuse_texture;
+  float roughness;
+  float metalness;
+  uint32_t padding;
+};
+
+// Pushed per draw, selects the entry of the material buffer.
+struct MaterialPushConstants {
+  uint32_t material_slot;
+};
+
+// One descriptor set shared by every material: a partially bound,
+// update-after-bind array of all textures (binding 0) and a storage buffer
+// of MaterialData (binding 1). It is bound once per frame, draws only push
+// their material slot.
+//
+// The material buffer holds one slice of max_materials entries per frame in
+// flight. update() rewrites the slice of the frame being recorded, so
+// textures becoming resident never change data an earlier frame still reads.
+class BindlessMaterials {
+ public:
+  static BindlessMaterials& get_instance() {
+    static BindlessMaterials instance;
+    return instance;
+  }
+
+  static constexpr uint32_t max_textures = 4096;
+  static constexpr uint32_t max_materials = 4096;
+
+  vk::DescriptorSetLayout layout;
+
+  // Writes the texture into a new element of the array. Elements are never
+  // reused, which makes writing them while frames are in flight legal.
+  uint32_t add_texture(const Texture& texture);
+
+  // Returns the material index.
+  uint32_t add_material(const TextureHandle& diffuse,
+                        const glm::vec4& base_color, float roughness,
+                        float metalness);
+
+  // Main thread only, once per frame before recording.
+  void update(uint32_t frame_index);
+
+  void bind(vk::CommandBuffer& cmd_buffer,
+            const vk::PipelineLayout& pipe_layout, uint32_t set_index);
+
+  uint32_t material_slot(uint32_t material, uint32_t frame_index) const {
+    return frame_index * max_materials + material;
+  }
+
+  // Statistics for the current process.
+  uint32_t texture_count() const { return next_texture; }
+  uint32_t material_count() const { return materials.size(); }
+
+ private:
+  struct MaterialEntry {
+    TextureHandle diffuse;
+    glm::vec4 base_color;
+    float roughness;
+    float metalness;
+  };
+  std::vector<MaterialEntry> materials;
+
+  uint32_t texture_capacity;
+  uint32_t next_texture = 0;
+
+  vk::DescriptorPool pool;
+  vk::DescriptorSet set;
+
+  Buffer material_buffer;
+  void* material_buffer_ptr;
+
+  BindlessMaterials();
+};
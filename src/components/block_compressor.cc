@@ -0,0 +1,338 @@
+#include "block_compressor.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+// Endpoints of the block's principal axis, clamped to [0, 255]. Reduces the
+// covariance matrix of the first channels by power iteration.
+static void fit_endpoints(const uint8_t* rgba, int channels, float* lo,
+                          float* hi) {
+  float mean[4] = {};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < channels; c++) {
+      mean[c] += rgba[i * 4 + c];
+    }
+  }
+  for (int c = 0; c < channels; c++) {
+    mean[c] /= 16.0f;
+  }
+
+  float covariance[4][4] = {};
+  for (int i = 0; i < 16; i++) {
+    float d[4];
+    for (int c = 0; c < channels; c++) {
+      d[c] = rgba[i * 4 + c] - mean[c];
+    }
+    for (int a = 0; a < channels; a++) {
+      for (int b = 0; b < channels; b++) {
+        covariance[a][b] += d[a] * d[b];
+      }
+    }
+  }
+
+  // Starting with the row of the widest channel avoids an initial guess
+  // orthogonal to the axis.
+  int widest = 0;
+  for (int c = 1; c < channels; c++) {
+    if (covariance[c][c] > covariance[widest][widest]) {
+      widest = c;
+    }
+  }
+  float axis[4] = {};
+  for (int c = 0; c < channels; c++) {
+    axis[c] = covariance[widest][c];
+  }
+
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[4] = {};
+    float largest = 0.0f;
+    for (int a = 0; a < channels; a++) {
+      for (int b = 0; b < channels; b++) {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      largest = std::max(largest, std::abs(next[a]));
+    }
+    if (largest == 0.0f) {
+      break;
+    }
+    for (int c = 0; c < channels; c++) {
+      axis[c] = next[c] / largest;
+    }
+  }
+
+  float length = 0.0f;
+  for (int c = 0; c < channels; c++) {
+    length += axis[c] * axis[c];
+  }
+  length = std::sqrt(length);
+  for (int c = 0; c < channels; c++) {
+    axis[c] = length > 0.0f ? axis[c] / length : 0.0f;
+  }
+
+  float t_min = 0.0f;
+  float t_max = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (int c = 0; c < channels; c++) {
+      t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+    }
+    t_min = std::min(t_min, t);
+    t_max = std::max(t_max, t);
+  }
+
+  for (int c = 0; c < channels; c++) {
+    lo[c] = std::clamp(mean[c] + axis[c] * t_min, 0.0f, 255.0f);
+    hi[c] = std::clamp(mean[c] + axis[c] * t_max, 0.0f, 255.0f);
+  }
+}
+
+static int squared_distance(const uint8_t* texel, const int* color,
+                            int channels) {
+  int distance = 0;
+  for (int c = 0; c < channels; c++) {
+    int d = texel[c] - color[c];
+    distance += d * d;
+  }
+  return distance;
+}
+
+static uint16_t to_565(const float* color) {
+  int r = std::clamp(int(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+  int g = std::clamp(int(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+  int b = std::clamp(int(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+  return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void from_565(uint16_t value, int* color) {
+  int r = (value >> 11) & 31;
+  int g = (value >> 5) & 63;
+  int b = value & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+void BlockCompressor::encode_bc1(const uint8_t* rgba, uint8_t* out) {
+  float lo[4];
+  float hi[4];
+  fit_endpoints(rgba, 3, lo, hi);
+
+  // color0 > color1 selects the four color mode without transparency.
+  uint16_t color0 = to_565(hi);
+  uint16_t color1 = to_565(lo);
+  if (color0 < color1) {
+    std::swap(color0, color1);
+  }
+
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    int palette[4][3];
+    from_565(color0, palette[0]);
+    from_565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      int best_distance = std::numeric_limits<int>::max();
+      for (int candidate = 0; candidate < 4; candidate++) {
+        int distance = squared_distance(rgba + i * 4, palette[candidate], 3);
+        if (distance < best_distance) {
+          best = candidate;
+          best_distance = distance;
+        }
+      }
+      indices |= uint32_t(best) << (2 * i);
+    }
+  }
+
+  out[0] = color0 & 0xff;
+  out[1] = color0 >> 8;
+  out[2] = color1 & 0xff;
+  out[3] = color1 >> 8;
+  for (int i = 0; i < 4; i++) {
+    out[4 + i] = (indices >> (8 * i)) & 0xff;
+  }
+}
+
+void BlockCompressor::encode_bc4(const uint8_t* values, size_t stride,
+                                 uint8_t* out) {
+  int lo = 255;
+  int hi = 0;
+  for (int i = 0; i < 16; i++) {
+    lo = std::min(lo, int(values[i * stride]));
+    hi = std::max(hi, int(values[i * stride]));
+  }
+
+  // red0 > red1 selects eight interpolated values, index 0 is red0, index 1
+  // red1 and indices 2-7 step from red0 towards red1.
+  out[0] = uint8_t(hi);
+  out[1] = uint8_t(lo);
+
+  uint64_t indices = 0;
+  if (hi > lo) {
+    int range = hi - lo;
+    for (int i = 0; i < 16; i++) {
+      int step = ((values[i * stride] - lo) * 14 + range) / (2 * range);
+      int index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+      indices |= uint64_t(index) << (3 * i);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = (indices >> (8 * i)) & 0xff;
+  }
+}
+
+void BlockCompressor::encode_bc5(const uint8_t* rgba, uint8_t* out) {
+  encode_bc4(rgba, 4, out);
+  encode_bc4(rgba + 1, 4, out + 8);
+}
+
+static constexpr int bc7_weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                        34, 38, 43, 47, 51, 55, 60, 64};
+
+// Writes fields least significant bit first, the order BC7 is specified in.
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t* out) : out{out} {}
+
+  void write(uint32_t value, int bits) {
+    for (int i = 0; i < bits; i++, position++) {
+      if ((value >> i) & 1) {
+        out[position >> 3] |= uint8_t(1 << (position & 7));
+      }
+    }
+  }
+
+ private:
+  uint8_t* out;
+  int position = 0;
+};
+
+void BlockCompressor::encode_bc7(const uint8_t* rgba, uint8_t* out) {
+  float lo[4];
+  float hi[4];
+  fit_endpoints(rgba, 4, lo, hi);
+
+  // Nearest index for every position along the endpoint axis in 1/64 steps.
+  static const auto nearest_weight = [] {
+    std::array<uint8_t, 65> table{};
+    for (int t = 0; t <= 64; t++) {
+      int best = 0;
+      for (int i = 1; i < 16; i++) {
+        if (std::abs(bc7_weights[i] - t) < std::abs(bc7_weights[best] - t)) {
+          best = i;
+        }
+      }
+      table[t] = uint8_t(best);
+    }
+    return table;
+  }();
+
+  int best_error = std::numeric_limits<int>::max();
+  int best_quantized[2][4] = {};
+  int best_pbits[2] = {};
+  uint8_t best_indices[16] = {};
+
+  // Each endpoint shares one low bit across its channels, try all four
+  // combinations.
+  for (int pbits = 0; pbits < 4; pbits++) {
+    int p[2] = {pbits & 1, pbits >> 1};
+    int quantized[2][4];
+    int endpoints[2][4];
+    for (int c = 0; c < 4; c++) {
+      quantized[0][c] = std::clamp(int((lo[c] - p[0]) / 2.0f + 0.5f), 0, 127);
+      quantized[1][c] = std::clamp(int((hi[c] - p[1]) / 2.0f + 0.5f), 0, 127);
+      endpoints[0][c] = (quantized[0][c] << 1) | p[0];
+      endpoints[1][c] = (quantized[1][c] << 1) | p[1];
+    }
+
+    int palette[16][4];
+    for (int i = 0; i < 16; i++) {
+      for (int c = 0; c < 4; c++) {
+        palette[i][c] = ((64 - bc7_weights[i]) * endpoints[0][c] +
+                         bc7_weights[i] * endpoints[1][c] + 32) >>
+                        6;
+      }
+    }
+
+    int axis[4];
+    int axis_length = 0;
+    for (int c = 0; c < 4; c++) {
+      axis[c] = endpoints[1][c] - endpoints[0][c];
+      axis_length += axis[c] * axis[c];
+    }
+
+    int error = 0;
+    uint8_t indices[16];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t* texel = rgba + i * 4;
+      int guess = 0;
+      if (axis_length > 0) {
+        int projection = 0;
+        for (int c = 0; c < 4; c++) {
+          projection += (texel[c] - endpoints[0][c]) * axis[c];
+        }
+        int t = std::clamp(
+            (projection * 64 + axis_length / 2) / axis_length, 0, 64);
+        guess = nearest_weight[t];
+      }
+
+      // Rounding of the palette can make a neighbour the better pick.
+      int best = guess;
+      int best_distance = squared_distance(texel, palette[guess], 4);
+      for (int candidate : {guess - 1, guess + 1}) {
+        if (candidate < 0 || candidate > 15) {
+          continue;
+        }
+        int distance = squared_distance(texel, palette[candidate], 4);
+        if (distance < best_distance) {
+          best = candidate;
+          best_distance = distance;
+        }
+      }
+      indices[i] = uint8_t(best);
+      error += best_distance;
+    }
+
+    if (error < best_error) {
+      best_error = error;
+      std::memcpy(best_quantized, quantized, sizeof(quantized));
+      best_pbits[0] = p[0];
+      best_pbits[1] = p[1];
+      std::memcpy(best_indices, indices, sizeof(indices));
+    }
+  }
+
+  // The first index is stored without its top bit, which therefore has to
+  // be zero. Swapping the endpoints mirrors all indices.
+  if (best_indices[0] & 8) {
+    for (int c = 0; c < 4; c++) {
+      std::swap(best_quantized[0][c], best_quantized[1][c]);
+    }
+    std::swap(best_pbits[0], best_pbits[1]);
+    for (auto& index : best_indices) {
+      index = 15 - index;
+    }
+  }
+
+  std::memset(out, 0, 16);
+  BitWriter writer(out);
+  writer.write(1 << 6, 7);
+  for (int c = 0; c < 4; c++) {
+    writer.write(best_quantized[0][c], 7);
+    writer.write(best_quantized[1][c], 7);
+  }
+  writer.write(best_pbits[0], 1);
+  writer.write(best_pbits[1], 1);
+  writer.write(best_indices[0], 3);
+  for (int i = 1; i < 16; i++) {
+    writer.write(best_indices[i], 4);
+  }
+}
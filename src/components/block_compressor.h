@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CPU encoders for the BCn block formats. Blocks are 4x4 RGBA8 texels in row
+// major order, 64 bytes in total.
+class BlockCompressor {
+ public:
+  // 8 bytes, opaque RGB with 565 endpoints and 2 bit indices.
+  static void encode_bc1(const uint8_t* rgba, uint8_t* out);
+
+  // 8 bytes, a single channel read every stride bytes.
+  static void encode_bc4(const uint8_t* values, size_t stride, uint8_t* out);
+
+  // 16 bytes, red and green as two BC4 blocks. Meant for normal maps.
+  static void encode_bc5(const uint8_t* rgba, uint8_t* out);
+
+  // 16 bytes, RGBA. Only uses mode 6 (one subset, 7 bit endpoints plus a
+  // shared p-bit each, 4 bit indices), which covers smooth content well and
+  // keeps the search cheap.
+  static void encode_bc7(const uint8_t* rgba, uint8_t* out);
+};
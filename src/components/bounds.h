@@ -0,0 +1,43 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <limits>
+
+struct AABB {
+  glm::vec3 min{std::numeric_limits<float>::max()};
+  glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+  void extend(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void extend(const AABB& box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+  glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+  // 0 for empty boxes.
+  float surface_area() const {
+    glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+  }
+
+  // Smallest box around this box after an affine transform.
+  AABB transformed(const glm::mat4& to_world) const {
+    glm::vec3 world_center = glm::vec3(to_world * glm::vec4(center(), 1.0f));
+    glm::mat3 abs_rotation(glm::abs(glm::vec3(to_world[0])),
+                           glm::abs(glm::vec3(to_world[1])),
+                           glm::abs(glm::vec3(to_world[2])));
+    glm::vec3 world_extent = abs_rotation * extent();
+    return {world_center - world_extent, world_center + world_extent};
+  }
+};
+
+// Centered on the AABB it was computed for, so both share one center.
+struct Sphere {
+  glm::vec3 center{0.0f};
+  float radius = 0.0f;
+};
@@ -0,0 +1,250 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <numeric>
+
+void Bvh::build(const std::vector<AABB>& new_boxes) {
+  boxes = new_boxes;
+  uint32_t count = boxes.size();
+  nodes.clear();
+  order.resize(count);
+  std::iota(order.begin(), order.end(), 0);
+  object_leaf.assign(count, 0);
+  if (count == 0) {
+    return;
+  }
+
+  std::vector<glm::vec3> centers(count);
+  for (uint32_t i = 0; i < count; i++) {
+    centers[i] = boxes[i].center();
+  }
+
+  // A binary tree with at most one object per leaf has 2n - 1 nodes.
+  nodes.reserve(2 * count - 1);
+  nodes.push_back({AABB(), 0, count, no_parent});
+  update_leaf_bounds(nodes[0]);
+
+  std::vector<uint32_t> work{0};
+  while (!work.empty()) {
+    uint32_t index = work.back();
+    work.pop_back();
+    subdivide(index, centers);
+    if (nodes[index].count == 0) {
+      work.push_back(nodes[index].first);
+      work.push_back(nodes[index].first + 1);
+    }
+  }
+
+  for (uint32_t index = 0; index < nodes.size(); index++) {
+    const Node& node = nodes[index];
+    for (uint32_t i = node.first; i < node.first + node.count; i++) {
+      object_leaf[order[i]] = index;
+    }
+  }
+}
+
+void Bvh::subdivide(uint32_t index, const std::vector<glm::vec3>& centers) {
+  uint32_t first = nodes[index].first;
+  uint32_t count = nodes[index].count;
+  if (count <= max_leaf_size) {
+    return;
+  }
+
+  AABB center_bounds;
+  for (uint32_t i = first; i < first + count; i++) {
+    center_bounds.extend(centers[order[i]]);
+  }
+
+  // Cost of a split after bin s along an axis: the area of each side times
+  // the number of objects in it. Nodes above max_leaf_size are always split,
+  // the heuristic only picks where.
+  int best_axis = -1;
+  uint32_t best_split = 0;
+  float best_cost = std::numeric_limits<float>::max();
+  for (int axis = 0; axis < 3; axis++) {
+    float low = center_bounds.min[axis];
+    float extent = center_bounds.max[axis] - low;
+    if (extent <= 0.0f) {
+      continue;
+    }
+    float scale = bin_count / extent;
+
+    uint32_t bin_counts[bin_count] = {};
+    AABB bin_bounds[bin_count];
+    for (uint32_t i = first; i < first + count; i++) {
+      uint32_t object = order[i];
+      uint32_t bin = std::min<uint32_t>(
+          bin_count - 1, (centers[object][axis] - low) * scale);
+      bin_counts[bin]++;
+      bin_bounds[bin].extend(boxes[object]);
+    }
+
+    float right_costs[bin_count];
+    AABB right_bounds;
+    uint32_t right_count = 0;
+    for (uint32_t bin = bin_count - 1; bin > 0; bin--) {
+      right_bounds.extend(bin_bounds[bin]);
+      right_count += bin_counts[bin];
+      right_costs[bin] = right_bounds.surface_area() * right_count;
+    }
+
+    AABB left_bounds;
+    uint32_t left_count = 0;
+    for (uint32_t split = 0; split < bin_count - 1; split++) {
+      left_bounds.extend(bin_bounds[split]);
+      left_count += bin_counts[split];
+      float cost =
+          left_bounds.surface_area() * left_count + right_costs[split + 1];
+      if (left_count > 0 && left_count < count && cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = split;
+      }
+    }
+  }
+
+  auto begin = order.begin() + first;
+  auto end = begin + count;
+  auto middle = begin;
+  if (best_axis >= 0) {
+    float low = center_bounds.min[best_axis];
+    float scale = bin_count / (center_bounds.max[best_axis] - low);
+    middle = std::partition(begin, end, [&](uint32_t object) {
+      uint32_t bin = std::min<uint32_t>(
+          bin_count - 1, (centers[object][best_axis] - low) * scale);
+      return bin <= best_split;
+    });
+  } else {
+    // Every center is the same, any split is as good as another.
+    middle = begin + count / 2;
+  }
+
+  uint32_t left_count = middle - begin;
+  uint32_t left = nodes.size();
+  nodes.push_back({AABB(), first, left_count, index});
+  nodes.push_back({AABB(), first + left_count, count - left_count, index});
+  update_leaf_bounds(nodes[left]);
+  update_leaf_bounds(nodes[left + 1]);
+  nodes[index].first = left;
+  nodes[index].count = 0;
+}
+
+void Bvh::update_leaf_bounds(Node& node) {
+  node.bounds = AABB();
+  for (uint32_t i = node.first; i < node.first + node.count; i++) {
+    node.bounds.extend(boxes[order[i]]);
+  }
+}
+
+void Bvh::refit(uint32_t object, const AABB& box) {
+  boxes[object] = box;
+  uint32_t index = object_leaf[object];
+  update_leaf_bounds(nodes[index]);
+
+  for (index = nodes[index].parent; index != no_parent;
+       index = nodes[index].parent) {
+    Node& node = nodes[index];
+    AABB bounds = nodes[node.first].bounds;
+    bounds.extend(nodes[node.first + 1].bounds);
+    if (bounds.min == node.bounds.min && bounds.max == node.bounds.max) {
+      break;
+    }
+    node.bounds = bounds;
+  }
+}
+
+float Bvh::cost() const {
+  if (nodes.empty()) {
+    return 0.0f;
+  }
+  float cost = 0.0f;
+  for (const auto& node : nodes) {
+    cost += node.bounds.surface_area() * std::max(node.count, 1u);
+  }
+  return cost / std::max(nodes[0].bounds.surface_area(),
+                         std::numeric_limits<float>::min());
+}
+
+void Bvh::split(uint32_t count, std::vector<uint32_t>& roots) const {
+  roots.clear();
+  if (nodes.empty()) {
+    return;
+  }
+  // Breadth first, the SAH build keeps siblings at similar sizes. Leaves
+  // are rotated to the back so the front is always the next inner node.
+  std::deque<uint32_t> queue{0};
+  size_t leaves = 0;
+  while (queue.size() < count && leaves < queue.size()) {
+    uint32_t index = queue.front();
+    queue.pop_front();
+    if (nodes[index].count > 0) {
+      queue.push_back(index);
+      leaves++;
+      continue;
+    }
+    leaves = 0;
+    queue.push_back(nodes[index].first);
+    queue.push_back(nodes[index].first + 1);
+  }
+  roots.assign(queue.begin(), queue.end());
+}
+
+std::optional<RayHit> Bvh::raycast(const glm::vec3& origin,
+                                   const glm::vec3& direction,
+                                   float max_distance) const {
+  if (nodes.empty()) {
+    return std::nullopt;
+  }
+
+  glm::vec3 inverse_direction = 1.0f / direction;
+  constexpr float miss = std::numeric_limits<float>::infinity();
+  // Distance at which the ray enters the box, miss if it does not within
+  // the current closest hit.
+  std::optional<RayHit> closest;
+  auto entry = [&](const AABB& box) {
+    glm::vec3 t0 = (box.min - origin) * inverse_direction;
+    glm::vec3 t1 = (box.max - origin) * inverse_direction;
+    glm::vec3 near = glm::min(t0, t1);
+    glm::vec3 far = glm::max(t0, t1);
+    float t_near = std::max({near.x, near.y, near.z, 0.0f});
+    float t_far = std::min({far.x, far.y, far.z, max_distance});
+    if (closest) {
+      t_far = std::min(t_far, closest->distance);
+    }
+    return t_near <= t_far ? t_near : miss;
+  };
+
+  std::vector<std::pair<uint32_t, float>> stack{{0, entry(nodes[0].bounds)}};
+  while (!stack.empty()) {
+    auto [index, distance] = stack.back();
+    stack.pop_back();
+    if (distance == miss || (closest && distance > closest->distance)) {
+      continue;
+    }
+
+    const Node& node = nodes[index];
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; i++) {
+        float hit = entry(boxes[order[i]]);
+        if (hit != miss) {
+          closest = RayHit{order[i], hit};
+        }
+      }
+      continue;
+    }
+
+    // The nearer child is pushed last and visited first.
+    float left = entry(nodes[node.first].bounds);
+    float right = entry(nodes[node.first + 1].bounds);
+    if (left <= right) {
+      stack.push_back({node.first + 1, right});
+      stack.push_back({node.first, left});
+    } else {
+      stack.push_back({node.first, left});
+      stack.push_back({node.first + 1, right});
+    }
+  }
+  return closest;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+#include "bounds.h"
+#include "frustum_culler.h"
+
+struct RayHit {
+  uint32_t object;
+  // Along the normalized ray direction, to the entry of the object's box.
+  float distance;
+};
+
+// Bounding volume hierarchy over the world space boxes of objects 0..n-1,
+// built top down with a binned surface area heuristic. Boxes of single
+// objects can be changed with refit(), which only touches the path to the
+// root; the tree gets worse as objects move, cost() tells by how much.
+class Bvh {
+ public:
+  static constexpr uint32_t max_leaf_size = 4;
+  static constexpr uint32_t bin_count = 16;
+
+  // Leaves hold objects [first, first + count) of the object order, inner
+  // nodes have count 0 and their children at first and first + 1.
+  struct Node {
+    AABB bounds;
+    uint32_t first;
+    uint32_t count;
+    uint32_t parent;
+  };
+
+  static constexpr uint32_t no_parent = UINT32_MAX;
+
+  void build(const std::vector<AABB>& boxes);
+
+  void refit(uint32_t object, const AABB& box);
+
+  // Expected cost of a query relative to testing the root box once,
+  // following the surface area heuristic.
+  float cost() const;
+
+  size_t node_count() const { return nodes.size(); }
+  size_t object_count() const { return boxes.size(); }
+  const AABB& bounds(uint32_t object) const { return boxes[object]; }
+
+  // Visits the objects of every node that test(bounds) does not classify as
+  // eOutside. visit(object, inside) gets inside set if an ancestor was
+  // classified eInside, such objects are not tested individually. Only the
+  // subtree below root is traversed.
+  template <typename Test, typename Visit>
+  void traverse(Test&& test, Visit&& visit, uint32_t root = 0) const {
+    if (nodes.empty()) {
+      return;
+    }
+    // Pairs of node index and whether the node is known to be inside.
+    std::vector<std::pair<uint32_t, bool>> stack{{root, false}};
+    while (!stack.empty()) {
+      auto [index, inside] = stack.back();
+      stack.pop_back();
+      const Node& node = nodes[index];
+      if (!inside) {
+        auto containment = test(node.bounds);
+        if (containment == Containment::eOutside) {
+          continue;
+        }
+        inside = containment == Containment::eInside;
+      }
+      if (node.count > 0) {
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+          visit(order[i], inside);
+        }
+      } else {
+        stack.push_back({node.first, inside});
+        stack.push_back({node.first + 1, inside});
+      }
+    }
+  }
+
+  // Roots of at least count disjoint subtrees that together hold every
+  // object, unless the tree has fewer leaves. Traversing them independently
+  // splits a query into similarly sized pieces of work.
+  void split(uint32_t count, std::vector<uint32_t>& roots) const;
+
+  // Closest object box hit by the ray within max_distance. direction has to
+  // be normalized.
+  std::optional<RayHit> raycast(const glm::vec3& origin,
+                                const glm::vec3& direction,
+                                float max_distance) const;
+
+ private:
+  std::vector<Node> nodes;
+  std::vector<AABB> boxes;
+  // Objects sorted so that every leaf references a contiguous range.
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> object_leaf;
+
+  // Splits nodes[index] if that is cheaper than keeping it a leaf.
+  void subdivide(uint32_t index, const std::vector<glm::vec3>& centers);
+
+  void update_leaf_bounds(Node& node);
+};
@@ -22,8 +22,8 @@ class Camera : public Entity {
 
   float clip_far = 10.0f;
 
-  Camera(Display* display_ptr) : display{display_ptr} {
-    update_projection_mat();
+  Camera(const vk::Extent2D& surface_extend) {
+    update_projection_mat(surface_extend);
   }
 
   CameraProjectionData get_projection_data() {
@@ -34,12 +34,8 @@ class Camera : public Entity {
 
   virtual void sdl_event_handler(SDL_Event& event) {}
 
- protected:
-  Display* display;
-
  private:
-  void update_projection_mat() {
-    auto surface_extend = display->swapchain.get_surface_extend();
+  void update_projection_mat(const vk::Extent2D& surface_extend) {
     auto proj = glm::perspective(
         glm::radians(fov), surface_extend.width / (float)surface_extend.height,
         clip_near, clip_far);
@@ -0,0 +1,46 @@
+#include "entity_store.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+uint32_t EntityStore::create(const glm::mat4& local, uint32_t parent) {
+  if (parent != no_parent && parent >= size()) {
+    throw std::runtime_error("parent entity does not exist!");
+  }
+  uint32_t entity = size();
+  locals.push_back(local);
+  worlds.push_back(local);
+  parents.push_back(parent);
+  dirty.push_back(1);
+  first_dirty = std::min<size_t>(first_dirty, entity);
+  return entity;
+}
+
+void EntityStore::set_local(uint32_t entity, const glm::mat4& local) {
+  locals[entity] = local;
+  dirty[entity] = 1;
+  first_dirty = std::min<size_t>(first_dirty, entity);
+}
+
+void EntityStore::update() {
+  changed_entities.clear();
+
+  // Children come after their parents, so a parent's flag is final by the
+  // time its children look at it.
+  for (size_t i = first_dirty; i < size(); i++) {
+    uint32_t parent = parents[i];
+    if (parent != no_parent && dirty[parent]) {
+      dirty[i] = 1;
+    }
+    if (!dirty[i]) {
+      continue;
+    }
+    worlds[i] = parent == no_parent ? locals[i] : worlds[parent] * locals[i];
+    changed_entities.push_back(i);
+  }
+
+  for (uint32_t entity : changed_entities) {
+    dirty[entity] = 0;
+  }
+  first_dirty = size();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Transform components of all entities as structure of arrays. An entity is
+// an index into the arrays. Parents have to exist when their children are
+// created, so the arrays are in hierarchy order and update() computes world
+// matrices in one linear pass, parents before children.
+class EntityStore {
+ public:
+  static constexpr uint32_t no_parent = UINT32_MAX;
+
+  uint32_t create(const glm::mat4& local, uint32_t parent = no_parent);
+
+  // Marks the entity and, through update(), its subtree dirty.
+  void set_local(uint32_t entity, const glm::mat4& local);
+
+  const glm::mat4& local(uint32_t entity) const { return locals[entity]; }
+  const glm::mat4& world(uint32_t entity) const { return worlds[entity]; }
+  uint32_t parent(uint32_t entity) const { return parents[entity]; }
+  size_t size() const { return parents.size(); }
+
+  // Recomputes the world matrices of dirty entities and their descendants,
+  // everything else is left alone.
+  void update();
+
+  // Entities whose world matrix changed in the last update().
+  const std::vector<uint32_t>& changed() const { return changed_entities; }
+
+ private:
+  std::vector<glm::mat4> locals;
+  std::vector<glm::mat4> worlds;
+  std::vector<uint32_t> parents;
+  std::vector<uint8_t> dirty;
+  // Index of the first dirty entity, size() if there is none. Everything
+  // before it is up to date.
+  size_t first_dirty = 0;
+
+  std::vector<uint32_t> changed_entities;
+};
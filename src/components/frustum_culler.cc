@@ -0,0 +1,150 @@
+#include "frustum_culler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_CULLER_X86 1
+#endif
+
+// Gribb/Hartmann: every plane is the last row of the matrix plus or minus one
+// of the others. glm produces clip z in [-w, w], the near plane derived from
+// that is slightly looser than Vulkan's [0, w], which keeps the test
+// conservative.
+Frustum Frustum::from_matrix(const glm::mat4& view_projection) {
+  auto row = [&](int r) {
+    return glm::vec4(view_projection[0][r], view_projection[1][r],
+                     view_projection[2][r], view_projection[3][r]);
+  };
+
+  Frustum frustum;
+  frustum.planes = {row(3) + row(0), row(3) - row(0), row(3) + row(1),
+                    row(3) - row(1), row(3) + row(2), row(3) - row(2)};
+  for (auto& plane : frustum.planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return frustum;
+}
+
+Containment Frustum::classify(const AABB& box) const {
+  glm::vec3 center = box.center();
+  glm::vec3 extent = box.extent();
+  auto result = Containment::eInside;
+  for (const auto& plane : planes) {
+    float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+    float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+    if (distance < -radius) {
+      return Containment::eOutside;
+    }
+    if (distance < radius) {
+      result = Containment::eIntersecting;
+    }
+  }
+  return result;
+}
+
+uint32_t FrustumCuller::add(const AABB& box, const Sphere& sphere,
+                            const glm::mat4& to_world) {
+  glm::vec3 center = box.center();
+  glm::vec3 world_center = glm::vec3(to_world * glm::vec4(center, 1.0f));
+
+  // Grown by the offset between the centers, in case the sphere was not
+  // computed around this box.
+  float scale = std::sqrt(std::max(
+      {glm::dot(glm::vec3(to_world[0]), glm::vec3(to_world[0])),
+       glm::dot(glm::vec3(to_world[1]), glm::vec3(to_world[1])),
+       glm::dot(glm::vec3(to_world[2]), glm::vec3(to_world[2]))}));
+  float world_radius =
+      (sphere.radius + glm::length(sphere.center - center)) * scale;
+
+  glm::vec3 world_extent = box.transformed(to_world).extent();
+
+  center_x.push_back(world_center.x);
+  center_y.push_back(world_center.y);
+  center_z.push_back(world_center.z);
+  radius.push_back(world_radius);
+  extent_x.push_back(world_extent.x);
+  extent_y.push_back(world_extent.y);
+  extent_z.push_back(world_extent.z);
+  return radius.size() - 1;
+}
+
+void FrustumCuller::clear() {
+  for (auto* array : {&center_x, &center_y, &center_z, &radius, &extent_x,
+                      &extent_y, &extent_z}) {
+    array->clear();
+  }
+  visibility.clear();
+}
+
+void FrustumCuller::cull(const Frustum& frustum) {
+  size_t count = size();
+  visibility.resize(count);
+
+  // Outside a plane if the signed distance of the center is below minus the
+  // smaller of the sphere radius and the box extent along the normal.
+  auto visible_scalar = [&](size_t i) {
+    for (const auto& plane : frustum.planes) {
+      float distance = plane.x * center_x[i] + plane.y * center_y[i] +
+                       plane.z * center_z[i] + plane.w;
+      float box_radius = std::abs(plane.x) * extent_x[i] +
+                         std::abs(plane.y) * extent_y[i] +
+                         std::abs(plane.z) * extent_z[i];
+      if (distance < -std::min(radius[i], box_radius)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  size_t i = 0;
+#if FRUSTUM_CULLER_X86
+  __m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  __m128 abs_x[6], abs_y[6], abs_z[6];
+  for (int p = 0; p < 6; p++) {
+    const auto& plane = frustum.planes[p];
+    plane_x[p] = _mm_set1_ps(plane.x);
+    plane_y[p] = _mm_set1_ps(plane.y);
+    plane_z[p] = _mm_set1_ps(plane.z);
+    plane_w[p] = _mm_set1_ps(plane.w);
+    abs_x[p] = _mm_set1_ps(std::abs(plane.x));
+    abs_y[p] = _mm_set1_ps(std::abs(plane.y));
+    abs_z[p] = _mm_set1_ps(std::abs(plane.z));
+  }
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 cx = _mm_loadu_ps(&center_x[i]);
+    __m128 cy = _mm_loadu_ps(&center_y[i]);
+    __m128 cz = _mm_loadu_ps(&center_z[i]);
+    __m128 r = _mm_loadu_ps(&radius[i]);
+    __m128 ex = _mm_loadu_ps(&extent_x[i]);
+    __m128 ey = _mm_loadu_ps(&extent_y[i]);
+    __m128 ez = _mm_loadu_ps(&extent_z[i]);
+
+    __m128 outside = _mm_setzero_ps();
+    for (int p = 0; p < 6; p++) {
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(plane_x[p], cx), _mm_mul_ps(plane_y[p], cy)),
+          _mm_add_ps(_mm_mul_ps(plane_z[p], cz), plane_w[p]));
+      __m128 box_radius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(abs_x[p], ex), _mm_mul_ps(abs_y[p], ey)),
+          _mm_mul_ps(abs_z[p], ez));
+      __m128 bound = _mm_min_ps(r, box_radius);
+      outside = _mm_or_ps(
+          outside, _mm_cmplt_ps(_mm_add_ps(distance, bound), _mm_setzero_ps()));
+    }
+
+    int mask = _mm_movemask_ps(outside);
+    for (int lane = 0; lane < 4; lane++) {
+      visibility[i + lane] = !(mask & (1 << lane));
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    visibility[i] = visible_scalar(i);
+  }
+
+  tested_count = count;
+  culled_count = std::count(visibility.begin(), visibility.end(), 0);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "bounds.h"
+
+enum class Containment { eOutside, eIntersecting, eInside };
+
+// World space planes (xyz normal pointing inside, w distance) of the view
+// frustum, extracted from projection * view.
+struct Frustum {
+  std::array<glm::vec4, 6> planes;
+
+  static Frustum from_matrix(const glm::mat4& view_projection);
+
+  Containment classify(const AABB& box) const;
+};
+
+// Tests the bounds of many objects against a Frustum, four at a time. Added
+// bounds are moved to world space and stored as structure of arrays; an
+// object is culled if its sphere or its box lies fully outside one plane.
+class FrustumCuller {
+ public:
+  // Returns the index to query visible() with after cull().
+  uint32_t add(const AABB& box, const Sphere& sphere,
+               const glm::mat4& to_world);
+
+  void cull(const Frustum& frustum);
+
+  bool visible(uint32_t index) const { return visibility[index]; }
+
+  size_t size() const { return radius.size(); }
+
+  // Keeps the capacity.
+  void clear();
+
+  // Statistics of the last cull().
+  uint32_t tested_count = 0;
+  uint32_t culled_count = 0;
+
+ private:
+  // World space center shared by sphere and box.
+  std::vector<float> center_x, center_y, center_z;
+  std::vector<float> radius;
+  // Half extents of the world space box around the transformed box.
+  std::vector<float> extent_x, extent_y, extent_z;
+
+  std::vector<uint8_t> visibility;
+};
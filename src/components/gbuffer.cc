@@ -0,0 +1,185 @@
+#include "gbuffer.h"
+
+#include "../vulkan_layer/pipeline_cache.h"
+
+GBuffer::GBuffer(const vk::Extent2D& extent) : extent{extent} {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  auto color_usage = vk::ImageUsageFlagBits::eColorAttachment |
+                     vk::ImageUsageFlagBits::eSampled;
+  normal = vulkan_layer.create_2d_image_view(
+      extent, normal_format, color_usage, vk::ImageAspectFlagBits::eColor,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  albedo = vulkan_layer.create_2d_image_view(
+      extent, albedo_format, color_usage, vk::ImageAspectFlagBits::eColor,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  material = vulkan_layer.create_2d_image_view(
+      extent, material_format, color_usage, vk::ImageAspectFlagBits::eColor,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  depth = vulkan_layer.create_2d_image_view(
+      extent, depth_format,
+      vk::ImageUsageFlagBits::eDepthStencilAttachment |
+          vk::ImageUsageFlagBits::eSampled,
+      vk::ImageAspectFlagBits::eDepth, VMA_MEMORY_USAGE_GPU_ONLY);
+
+  // Only read through texelFetch, nearest keeps depth formats without
+  // linear filtering support valid.
+  vk::SamplerCreateInfo sampler_ci;
+  sampler_ci.magFilter = vk::Filter::eNearest;
+  sampler_ci.minFilter = vk::Filter::eNearest;
+  sampler_ci.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  sampler_ci.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  sampler_ci.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  sampler_ci.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  sampler = vulkan_layer.device.createSampler(sampler_ci);
+
+  set = vulkan_layer.allocate_descriptor_set(get_descriptor_set_info());
+  std::vector<vk::DescriptorImageInfo> image_infos;
+  for (const auto* target : {&normal, &albedo, &material, &depth}) {
+    image_infos.push_back(vk::DescriptorImageInfo(
+        sampler, target->view, vk::ImageLayout::eShaderReadOnlyOptimal));
+  }
+  std::vector<vk::WriteDescriptorSet> writes(image_infos.size());
+  for (uint32_t i = 0; i < writes.size(); i++) {
+    writes[i].dstSet = set.set;
+    writes[i].dstBinding = i;
+    writes[i].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    writes[i].descriptorCount = 1;
+    writes[i].pImageInfo = &image_infos[i];
+  }
+  vulkan_layer.device.updateDescriptorSets(writes, {});
+}
+
+uint32_t GBuffer::bytes_per_pixel() {
+  // RG16 + RGBA8 + RG8 + D32.
+  return 4 + 4 + 2 + 4;
+}
+
+DescriptorSetInfo GBuffer::get_descriptor_set_info() {
+  std::vector<vk::DescriptorSetLayoutBinding> bindings(4);
+  for (uint32_t i = 0; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].setStageFlags(vk::ShaderStageFlagBits::eFragment);
+    bindings[i].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    bindings[i].descriptorCount = 1;
+  }
+  return DescriptorSetInfo(vk::DescriptorSetLayoutCreateInfo(), bindings);
+}
+
+void GBuffer::record_begin_geometry(vk::CommandBuffer& cmd_buffer) {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  for (vk::Image image : color_images()) {
+    vulkan_layer.record_layout_transition(
+        cmd_buffer, image, vk::ImageLayout::eUndefined,
+        vk::ImageLayout::eColorAttachmentOptimal,
+        vk::PipelineStageFlagBits::eFragmentShader,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::AccessFlagBits::eNone, vk::AccessFlagBits::eColorAttachmentWrite,
+        vk::ImageAspectFlagBits::eColor);
+  }
+  vulkan_layer.record_layout_transition(
+      cmd_buffer, depth.image.image, vk::ImageLayout::eUndefined,
+      vk::ImageLayout::eDepthAttachmentOptimal,
+      vk::PipelineStageFlagBits::eFragmentShader,
+      vk::PipelineStageFlagBits::eEarlyFragmentTests |
+          vk::PipelineStageFlagBits::eLateFragmentTests,
+      vk::AccessFlagBits::eNone,
+      vk::AccessFlagBits::eDepthStencilAttachmentRead |
+          vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+      vk::ImageAspectFlagBits::eDepth);
+}
+
+std::vector<vk::RenderingAttachmentInfo> GBuffer::color_attachments() const {
+  std::vector<vk::RenderingAttachmentInfo> attachments(3);
+  const ImageView* targets[] = {&normal, &albedo, &material};
+  for (uint32_t i = 0; i < attachments.size(); i++) {
+    attachments[i].imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    attachments[i].imageView = targets[i]->view;
+    attachments[i].loadOp = vk::AttachmentLoadOp::eClear;
+    attachments[i].storeOp = vk::AttachmentStoreOp::eStore;
+    attachments[i].setClearValue(vk::ClearValue({0.f, 0.f, 0.f, 0.f}));
+  }
+  return attachments;
+}
+
+vk::RenderingAttachmentInfo GBuffer::depth_attachment() const {
+  vk::RenderingAttachmentInfo attachment;
+  attachment.clearValue = vk::ClearValue({1, 0});
+  attachment.imageLayout = vk::ImageLayout::eDepthAttachmentOptimal;
+  attachment.imageView = depth.view;
+  attachment.loadOp = vk::AttachmentLoadOp::eClear;
+  attachment.storeOp = vk::AttachmentStoreOp::eStore;
+  return attachment;
+}
+
+void GBuffer::record_end_geometry(vk::CommandBuffer& cmd_buffer) {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  for (vk::Image image : color_images()) {
+    vulkan_layer.record_layout_transition(
+        cmd_buffer, image, vk::ImageLayout::eColorAttachmentOptimal,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::PipelineStageFlagBits::eFragmentShader,
+        vk::AccessFlagBits::eColorAttachmentWrite,
+        vk::AccessFlagBits::eShaderRead, vk::ImageAspectFlagBits::eColor);
+  }
+  vulkan_layer.record_layout_transition(
+      cmd_buffer, depth.image.image, vk::ImageLayout::eDepthAttachmentOptimal,
+      vk::ImageLayout::eShaderReadOnlyOptimal,
+      vk::PipelineStageFlagBits::eLateFragmentTests,
+      vk::PipelineStageFlagBits::eFragmentShader,
+      vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+      vk::AccessFlagBits::eShaderRead, vk::ImageAspectFlagBits::eDepth);
+}
+
+void GBuffer::bind(vk::CommandBuffer& cmd_buffer,
+                   const vk::PipelineLayout& pipe_layout,
+                   uint32_t set_index) {
+  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipe_layout,
+                                set_index, 1, &set.set, 0, nullptr);
+}
+
+DeferredLighting::DeferredLighting(const std::string& vertex_shader,
+                                   const std::string& fragment_shader,
+                                   vk::Format color_format) {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  vk::PushConstantRange push_constant_range(
+      vk::ShaderStageFlagBits::eFragment, 0, sizeof(LightingPushConstants));
+  std::vector<vk::DescriptorSetLayout> set_layouts{
+      GBuffer::get_descriptor_set_layout(),
+      LightClusters::get_descriptor_set_layout()};
+  vk::PipelineLayoutCreateInfo layout_ci;
+  layout_ci.setSetLayouts(set_layouts);
+  layout_ci.setPushConstantRanges(push_constant_range);
+  pipeline_layout = vulkan_layer.device.createPipelineLayout(layout_ci);
+
+  // A single triangle covering the screen, generated from gl_VertexIndex.
+  GraphicsPipelineDesc desc;
+  desc.vertex_shader = vertex_shader;
+  desc.fragment_shader = fragment_shader;
+  desc.layout = pipeline_layout;
+  desc.depth_test = false;
+  desc.depth_write = false;
+  desc.color_formats = {color_format};
+  desc.depth_format = vk::Format::eUndefined;
+  pipeline = PipelineCache::get_instance().get(desc);
+}
+
+void DeferredLighting::record(vk::CommandBuffer& cmd_buffer,
+                              GBuffer& gbuffer, LightClusters& clusters) {
+  auto extent = gbuffer.get_extent();
+  vk::Viewport viewport(0.0f, 0.0f, extent.width, extent.height, 0.0f, 1.0f);
+  cmd_buffer.setViewport(0, 1, &viewport);
+  vk::Rect2D scissor({0, 0}, extent);
+  cmd_buffer.setScissor(0, 1, &scissor);
+
+  cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+  gbuffer.bind(cmd_buffer, pipeline_layout, 0);
+  clusters.bind(cmd_buffer, pipeline_layout, 1);
+  LightingPushConstants constants{glm::inverse(clusters.get_projection()),
+                                  clusters.get_clip_near(),
+                                  clusters.get_clip_far(), headlight, 0.0f};
+  cmd_buffer.pushConstants(pipeline_layout,
+                           vk::ShaderStageFlagBits::eFragment, 0,
+                           sizeof(LightingPushConstants), &constants);
+  cmd_buffer.draw(3, 1, 0, 0);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "../vulkan_layer/vulkan_layer.h"
+#include "light_clusters.h"
+
+// Render targets of the deferred geometry pass, 14 bytes per pixel:
+// - normal: view space normal, octahedral encoded in RG16 snorm
+// - albedo: base color in RGBA8 sRGB
+// - material: roughness and metalness packed into RG8
+// - depth: D32, positions are reconstructed from it instead of being stored
+//
+// The targets are shared by all frames in flight. Their transitions wait
+// for the lighting pass of the frame before, which may still read them.
+class GBuffer {
+ public:
+  static constexpr vk::Format normal_format = vk::Format::eR16G16Snorm;
+  static constexpr vk::Format albedo_format = vk::Format::eR8G8B8A8Srgb;
+  static constexpr vk::Format material_format = vk::Format::eR8G8Unorm;
+  static constexpr vk::Format depth_format = vk::Format::eD32Sfloat;
+
+  ImageView normal;
+  ImageView albedo;
+  ImageView material;
+  ImageView depth;
+
+  GBuffer(){};
+  explicit GBuffer(const vk::Extent2D& extent);
+
+  vk::Extent2D get_extent() const { return extent; }
+
+  // In the order of the fragment shader outputs.
+  static std::vector<vk::Format> color_formats() {
+    return {normal_format, albedo_format, material_format};
+  }
+
+  static uint32_t bytes_per_pixel();
+
+  // Moves every target into its attachment layout, its contents are
+  // discarded.
+  void record_begin_geometry(vk::CommandBuffer& cmd_buffer);
+
+  // Cleared on load. The depth target is stored for the lighting pass.
+  std::vector<vk::RenderingAttachmentInfo> color_attachments() const;
+  vk::RenderingAttachmentInfo depth_attachment() const;
+
+  // Makes the geometry pass's writes visible to the lighting pass.
+  void record_end_geometry(vk::CommandBuffer& cmd_buffer);
+
+  // Set of the lighting pass: the targets as combined image samplers,
+  // normal, albedo, material and depth at bindings 0 to 3.
+  void bind(vk::CommandBuffer& cmd_buffer,
+            const vk::PipelineLayout& pipe_layout, uint32_t set_index);
+
+  static DescriptorSetInfo get_descriptor_set_info();
+
+  static vk::DescriptorSetLayout get_descriptor_set_layout() {
+    return VulkanLayer::get_instance().create_descriptor_set_layout(
+        get_descriptor_set_info());
+  }
+
+ private:
+  vk::Extent2D extent;
+  vk::Sampler sampler;
+  DescriptorSet set;
+
+  std::vector<vk::Image> color_images() const {
+    return {normal.image.image, albedo.image.image, material.image.image};
+  }
+};
+
+// Pushed to the lighting pass.
+struct LightingPushConstants {
+  glm::mat4 inverse_projection;
+  float clip_near;
+  float clip_far;
+  float headlight;
+  float padding;
+};
+
+// Fullscreen pass shading every covered pixel of a GBuffer once, so its cost
+// scales with the resolution instead of with the number of objects. Every
+// pixel evaluates the lights of its LightClusters cluster with a diffuse and
+// a specular term driven by the material target. Pixels the geometry pass
+// did not touch keep the color target's clear value.
+class DeferredLighting {
+ public:
+  DeferredLighting(){};
+  DeferredLighting(const std::string& vertex_shader,
+                   const std::string& fragment_shader,
+                   vk::Format color_format);
+
+  // Strength of a light at the camera, on top of the clustered lights.
+  float headlight = 1.0f;
+
+  // Inside rendering into a single color attachment without depth. The
+  // GBuffer has to be done with record_end_geometry() and the lights binned
+  // with LightClusters::record_cull().
+  void record(vk::CommandBuffer& cmd_buffer, GBuffer& gbuffer,
+              LightClusters& clusters);
+
+ private:
+  vk::PipelineLayout pipeline_layout;
+  vk::Pipeline pipeline;
+};
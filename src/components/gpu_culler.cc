@@ -0,0 +1,254 @@
+#include "gpu_culler.h"
+
+#include <cstring>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "../vulkan_layer/pipeline_cache.h"
+#include "../vulkan_layer/upload_manager.h"
+#include "lod_selector.h"
+#include "transform_batch.h"
+
+static constexpr uint32_t command_stride =
+    sizeof(vk::DrawIndexedIndirectCommand);
+
+GpuCuller::GpuCuller(const std::string& shader_path,
+                     ObjectBuffer& object_buffer)
+    : object_buffer{object_buffer} {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  if (!vulkan_layer.gpu_driven_rendering) {
+    throw std::runtime_error("device does not support indirect count draws!");
+  }
+
+  vk::PushConstantRange push_constant_range(
+      vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+  auto set_layout =
+      vulkan_layer.create_descriptor_set_layout(get_cull_set_info());
+  vk::PipelineLayoutCreateInfo layout_ci;
+  layout_ci.setSetLayouts(set_layout);
+  layout_ci.setPushConstantRanges(push_constant_range);
+  pipeline_layout = vulkan_layer.device.createPipelineLayout(layout_ci);
+
+  pipeline = PipelineCache::get_instance().get(
+      ComputePipelineDesc{shader_path, pipeline_layout});
+}
+
+DescriptorSetInfo GpuCuller::get_cull_set_info() {
+  std::vector<vk::DescriptorSetLayoutBinding> bindings(5);
+  for (uint32_t i = 0; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+    bindings[i].descriptorCount = 1;
+  }
+  return DescriptorSetInfo(vk::DescriptorSetLayoutCreateInfo(), bindings);
+}
+
+uint32_t GpuCuller::add(vk::Pipeline pipeline, const Mesh& mesh,
+                        const Material& material,
+                        const glm::mat4& to_world) {
+  // Copies of a Mesh keep its id, like in InstanceBatcher.
+  uint32_t batch = 0;
+  for (; batch < batches.size(); batch++) {
+    const auto& existing = batches[batch];
+    if (existing.material.index == material.index &&
+        existing.mesh.id == mesh.id) {
+      break;
+    }
+  }
+  if (batch == batches.size()) {
+    batches.push_back({pipeline, mesh, material, 0, 0});
+  }
+  batches[batch].object_count++;
+
+  cull_objects.push_back(
+      {glm::vec4(mesh.sphere.center, mesh.sphere.radius), batch, {}});
+  transforms.push_back(to_world);
+  return cull_objects.size() - 1;
+}
+
+void GpuCuller::build() {
+  if (cull_objects.empty()) {
+    throw std::runtime_error("no objects to cull!");
+  }
+
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  auto& upload_manager = UploadManager::get_instance();
+
+  std::vector<DrawBatch> batch_data;
+  uint32_t first_command = 0;
+  for (auto& batch : batches) {
+    batch.first_command = first_command;
+    first_command += batch.object_count;
+    DrawBatch data{batch.first_command,
+                   static_cast<uint32_t>(batch.mesh.lods.size()), {}, {}};
+    for (size_t i = 0; i < batch.mesh.lods.size(); i++) {
+      data.lods[i] = {batch.mesh.lods[i].first_index,
+                      batch.mesh.lods[i].index_count};
+    }
+    batch_data.push_back(data);
+  }
+
+  // The normal matrices come from the same kernel ObjectBuffer uses.
+  TransformBatch transform_batch;
+  for (const auto& to_world : transforms) {
+    transform_batch.add(to_world);
+  }
+  std::vector<ObjectData> objects(transforms.size());
+  transform_batch.compute(objects.data());
+
+  objects_buffer = upload_manager.create_static_buffer(
+      objects.data(), objects.size() * sizeof(ObjectData),
+      vk::BufferUsageFlagBits::eStorageBuffer);
+  cull_objects_buffer = upload_manager.create_static_buffer(
+      cull_objects.data(), cull_objects.size() * sizeof(CullObject),
+      vk::BufferUsageFlagBits::eStorageBuffer);
+  batches_buffer = upload_manager.create_static_buffer(
+      batch_data.data(), batch_data.size() * sizeof(DrawBatch),
+      vk::BufferUsageFlagBits::eStorageBuffer);
+
+  vk::DeviceSize commands_size = object_count() * command_stride;
+  vk::DeviceSize counts_size = batch_count() * sizeof(uint32_t);
+  auto cull_set_info = get_cull_set_info();
+  auto draw_set_info = ObjectBuffer::get_descriptor_set_info();
+
+  for (uint32_t i = 0; i < VulkanLayer::frames_in_flight; i++) {
+    FrameResources frame;
+    frame.commands = vulkan_layer.create_buffer(
+        commands_size,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eIndirectBuffer,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    // Host visible so that record_cull() can read back the visible count.
+    frame.counts = vulkan_layer.create_buffer(
+        counts_size,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eIndirectBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        VMA_MEMORY_USAGE_GPU_TO_CPU);
+    frame.counts.map(frame.counts_ptr);
+    std::memset(frame.counts_ptr, 0, counts_size);
+
+    frame.cull_set = vulkan_layer.allocate_descriptor_set(cull_set_info);
+    frame.draw_set = vulkan_layer.allocate_descriptor_set(draw_set_info);
+
+    std::vector<vk::DescriptorBufferInfo> cull_infos = {
+        {objects_buffer.buffer, 0, VK_WHOLE_SIZE},
+        {cull_objects_buffer.buffer, 0, VK_WHOLE_SIZE},
+        {batches_buffer.buffer, 0, VK_WHOLE_SIZE},
+        {frame.commands.buffer, 0, VK_WHOLE_SIZE},
+        {frame.counts.buffer, 0, VK_WHOLE_SIZE}};
+    vk::DescriptorBufferInfo scene_info = object_buffer.scene_buffer_info(i);
+
+    std::vector<vk::WriteDescriptorSet> writes;
+    for (uint32_t binding = 0; binding < cull_infos.size(); binding++) {
+      writes.emplace_back(frame.cull_set.set, binding, 0, 1,
+                          vk::DescriptorType::eStorageBuffer, nullptr,
+                          &cull_infos[binding]);
+    }
+    writes.emplace_back(frame.draw_set.set, 0, 0, 1,
+                        vk::DescriptorType::eUniformBuffer, nullptr,
+                        &scene_info);
+    writes.emplace_back(frame.draw_set.set, 1, 0, 1,
+                        vk::DescriptorType::eStorageBuffer, nullptr,
+                        &cull_infos[0]);
+    vulkan_layer.device.updateDescriptorSets(writes, {});
+
+    frames.push_back(frame);
+  }
+}
+
+void GpuCuller::set_transform(uint32_t object, const glm::mat4& to_world) {
+  transforms[object] = to_world;
+  dirty.push_back(object);
+}
+
+void GpuCuller::record_cull(vk::CommandBuffer& cmd_buffer,
+                            uint32_t frame_index, const glm::mat4& view,
+                            const glm::mat4& projection,
+                            float viewport_height) {
+  auto& frame = frames[frame_index];
+
+  // The frame's fence was waited on, the counts are final.
+  frame.counts.invalidate();
+  auto counts = static_cast<const uint32_t*>(frame.counts_ptr);
+  visible_count = 0;
+  for (uint32_t i = 0; i < batch_count(); i++) {
+    visible_count += counts[i];
+  }
+
+  // There is a single object buffer, earlier frames may still read it.
+  if (!dirty.empty()) {
+    cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eVertexShader |
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                               vk::PipelineStageFlagBits::eTransfer, {}, {},
+                               {}, {});
+    for (uint32_t object : dirty) {
+      const auto& to_world = transforms[object];
+      ObjectData data{to_world, glm::inverseTranspose(to_world)};
+      cmd_buffer.updateBuffer(objects_buffer.buffer,
+                              object * sizeof(ObjectData), sizeof(ObjectData),
+                              &data);
+    }
+    dirty.clear();
+  }
+
+  cmd_buffer.fillBuffer(frame.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+
+  vk::MemoryBarrier transfer_barrier(
+      vk::AccessFlagBits::eTransferWrite,
+      vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+  cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                             vk::PipelineStageFlagBits::eComputeShader |
+                                 vk::PipelineStageFlagBits::eVertexShader,
+                             {}, transfer_barrier, {}, {});
+
+  PushConstants constants;
+  auto frustum = Frustum::from_matrix(projection * view);
+  for (int i = 0; i < 6; i++) {
+    constants.planes[i] = frustum.planes[i];
+  }
+  constants.view_z = glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+  constants.object_count = object_count();
+  constants.pixel_scale = LodSelector::pixel_scale(projection, viewport_height);
+
+  cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                pipeline_layout, 0, 1, &frame.cull_set.set, 0,
+                                nullptr);
+  cmd_buffer.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute,
+                           0, sizeof(PushConstants), &constants);
+  cmd_buffer.dispatch((object_count() + workgroup_size - 1) / workgroup_size,
+                      1, 1);
+
+  vk::MemoryBarrier cull_barrier(
+      vk::AccessFlagBits::eShaderWrite,
+      vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eHostRead);
+  cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                             vk::PipelineStageFlagBits::eDrawIndirect |
+                                 vk::PipelineStageFlagBits::eHost,
+                             {}, cull_barrier, {}, {});
+}
+
+void GpuCuller::record_draw(vk::CommandBuffer& cmd_buffer,
+                            const vk::PipelineLayout& pipe_layout,
+                            uint32_t frame_index) {
+  auto& frame = frames[frame_index];
+  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipe_layout,
+                                0, 1, &frame.draw_set.set, 0, nullptr);
+
+  vk::Pipeline bound_pipeline;
+  for (uint32_t i = 0; i < batch_count(); i++) {
+    auto& batch = batches[i];
+    if (batch.pipeline != bound_pipeline) {
+      cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                              batch.pipeline);
+      bound_pipeline = batch.pipeline;
+    }
+    batch.material.record_draw(cmd_buffer, pipe_layout, frame_index);
+    batch.mesh.bind(cmd_buffer, pipe_layout);
+    cmd_buffer.drawIndexedIndirectCount(
+        frame.commands.buffer, batch.first_command * command_stride,
+        frame.counts.buffer, i * sizeof(uint32_t), batch.object_count,
+        command_stride);
+  }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "../vulkan_layer/vulkan_layer.h"
+#include "Material.h"
+#include "frustum_culler.h"
+#include "mesh.h"
+#include "object_buffer.h"
+
+// GPU driven alternative to FrustumCuller + InstanceBatcher. Objects are
+// registered once and live in device local buffers. Every frame a compute
+// shader tests their spheres against the frustum and appends a
+// VkDrawIndexedIndirectCommand per visible object to the range of its
+// mesh/material batch, which is then drawn with one drawIndexedIndirectCount.
+// The command draws the level of detail LodSelector would pick, without its
+// hysteresis since no level is remembered. Meshlets are not used, visible
+// objects are drawn whole.
+// CPU work per frame scales with the number of batches and of transforms
+// changed through set_transform(), not with the number of objects.
+//
+// Needs VulkanLayer::gpu_driven_rendering.
+class GpuCuller {
+ public:
+  static constexpr uint32_t workgroup_size = 64;
+
+  // std430 layouts shared with cull.comp.
+  struct CullObject {
+    glm::vec4 sphere;
+    uint32_t batch;
+    uint32_t padding[3];
+  };
+
+  struct DrawBatch {
+    uint32_t first_command;
+    uint32_t lod_count;
+    uint32_t padding[2];
+    // First index and index count of every level.
+    glm::uvec2 lods[MeshSimplifier::max_lods];
+  };
+
+  struct PushConstants {
+    glm::vec4 planes[6];
+    // Third row of the view matrix, gives the view space z of a point.
+    glm::vec4 view_z;
+    uint32_t object_count;
+    // LodSelector::pixel_scale().
+    float pixel_scale;
+  };
+
+  GpuCuller(const std::string& shader_path, ObjectBuffer& object_buffer);
+
+  // Only valid before build(). Returns the object id. pipeline draws the
+  // object and has to match the mesh's vertex format.
+  uint32_t add(vk::Pipeline pipeline, const Mesh& mesh,
+               const Material& material, const glm::mat4& to_world);
+
+  // Uploads all objects through the UploadManager.
+  void build();
+
+  // The new transform is uploaded by the next record_cull().
+  void set_transform(uint32_t object, const glm::mat4& to_world);
+
+  // Outside of rendering. Resets the counts of frame_index, culls every
+  // object and makes the commands visible to indirect draws.
+  // viewport_height is in pixels.
+  void record_cull(vk::CommandBuffer& cmd_buffer, uint32_t frame_index,
+                   const glm::mat4& view, const glm::mat4& projection,
+                   float viewport_height);
+
+  // Inside rendering, binds set 0 and the pipelines and draws every batch.
+  // BindlessMaterials has to be bound already.
+  void record_draw(vk::CommandBuffer& cmd_buffer,
+                   const vk::PipelineLayout& pipe_layout,
+                   uint32_t frame_index);
+
+  uint32_t object_count() const { return cull_objects.size(); }
+  uint32_t batch_count() const { return batches.size(); }
+
+  // Objects that survived culling in the last completed use of a frame
+  // slot, read back when the slot is reused.
+  uint32_t visible_count = 0;
+
+ private:
+  struct Batch {
+    vk::Pipeline pipeline;
+    Mesh mesh;
+    Material material;
+    uint32_t object_count;
+    // Start of the batch's range in the command buffers.
+    uint32_t first_command;
+  };
+
+  struct FrameResources {
+    Buffer commands;
+    Buffer counts;
+    void* counts_ptr;
+    DescriptorSet cull_set;
+    DescriptorSet draw_set;
+  };
+
+  ObjectBuffer& object_buffer;
+
+  std::vector<Batch> batches;
+  std::vector<CullObject> cull_objects;
+  std::vector<glm::mat4> transforms;
+  std::vector<uint32_t> dirty;
+
+  Buffer objects_buffer;
+  Buffer cull_objects_buffer;
+  Buffer batches_buffer;
+  std::vector<FrameResources> frames;
+
+  vk::PipelineLayout pipeline_layout;
+  vk::Pipeline pipeline;
+
+  static DescriptorSetInfo get_cull_set_info();
+};
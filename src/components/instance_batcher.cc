@@ -0,0 +1,203 @@
+#include "instance_batcher.h"
+
+#include <algorithm>
+#include <cmath>
+
+void InstanceBatcher::add(vk::Pipeline pipeline, Mesh& mesh,
+                          Material& material, const glm::mat4& to_world,
+                          uint32_t lod) {
+  // There are only a handful of pipelines, the newest is the likeliest.
+  auto found = std::find(pipelines.rbegin(), pipelines.rend(), pipeline);
+  if (found == pipelines.rend()) {
+    pipelines.push_back(pipeline);
+    draw_pipelines.push_back(pipelines.size() - 1);
+  } else {
+    draw_pipelines.push_back(pipelines.rend() - found - 1);
+  }
+  draws.push_back({&mesh, &material, to_world, lod});
+}
+
+// The sphere is scaled by the largest axis of to_world.
+static bool sphere_inside(const Frustum& frustum, const Sphere& sphere,
+                          const glm::mat4& to_world) {
+  glm::vec3 center = glm::vec3(to_world * glm::vec4(sphere.center, 1.0f));
+  float scale = std::sqrt(std::max({glm::dot(to_world[0], to_world[0]),
+                                    glm::dot(to_world[1], to_world[1]),
+                                    glm::dot(to_world[2], to_world[2])}));
+  float radius = sphere.radius * scale;
+  for (const auto& plane : frustum.planes) {
+    if (glm::dot(glm::vec3(plane), center) + plane.w < radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void InstanceBatcher::cull_meshlets(ObjectBuffer& object_buffer,
+                                    const Frustum& frustum,
+                                    const glm::vec3& camera, Group& group,
+                                    size_t begin, size_t end) {
+  const Meshlets& meshlets = *group.mesh->meshlets;
+  const auto& entries = queue.entries();
+  meshlet_count += group.instance_count * meshlets.size();
+
+  // Without cones only the frustum rejects meshlets, which it cannot for
+  // instances fully inside it. Those draw their whole level in one command.
+  whole_levels.assign(end - begin, 0);
+  bool all_whole = !meshlets.has_cones();
+  if (all_whole) {
+    for (size_t i = begin; i < end; i++) {
+      whole_levels[i - begin] = sphere_inside(
+          frustum, group.mesh->sphere, draws[entries[i].payload].to_world);
+      all_whole = all_whole && whole_levels[i - begin];
+    }
+  }
+  // Whole levels are also drawn once the frame's commands run out.
+  if (all_whole ||
+      object_buffer.free_commands() < group.instance_count * meshlets.size()) {
+    visible_meshlet_count += group.instance_count * meshlets.size();
+    return;
+  }
+
+  group.command_buffer = object_buffer.indirect_buffer();
+  for (size_t i = begin; i < end; i++) {
+    uint32_t object = group.first_object + (i - begin);
+    visible_meshlets.clear();
+    if (whole_levels[i - begin]) {
+      vk::DeviceSize offset = object_buffer.push_command(
+          {group.lod->index_count, 1, group.lod->first_index, 0, object});
+      if (group.command_count++ == 0) {
+        group.first_command = offset;
+      }
+      visible_meshlet_count += meshlets.size();
+      continue;
+    }
+    meshlets.cull(draws[entries[i].payload].to_world, frustum, camera,
+                  visible_meshlets);
+    visible_meshlet_count += visible_meshlets.size();
+    for (uint32_t meshlet : visible_meshlets) {
+      vk::DeviceSize offset = object_buffer.push_command(
+          {meshlets.index_count(meshlet), 1, meshlets.first_index(meshlet), 0,
+           object});
+      if (group.command_count++ == 0) {
+        group.first_command = offset;
+      }
+    }
+  }
+}
+
+void InstanceBatcher::build(ObjectBuffer& object_buffer, const glm::mat4& view,
+                            const Frustum* meshlet_frustum) {
+  // Row of view producing the view space z, the camera looks down -z.
+  glm::vec4 view_z(view[0][2], view[1][2], view[2][2], view[3][2]);
+  glm::vec3 camera = glm::vec3(glm::inverse(view)[3]);
+  meshlet_count = 0;
+  visible_meshlet_count = 0;
+
+  queue.clear();
+  for (uint32_t i = 0; i < draws.size(); i++) {
+    const Draw& draw = draws[i];
+    glm::vec4 center = draw.to_world * glm::vec4(draw.mesh->sphere.center, 1);
+    queue.push(RenderQueue::make_key(draw_pipelines[i], draw.material->index,
+                                     draw.mesh->id, draw.lod,
+                                     -glm::dot(view_z, center)),
+               i);
+  }
+  queue.sort();
+
+  groups.clear();
+  const auto& entries = queue.entries();
+  for (size_t begin = 0; begin < entries.size();) {
+    uint64_t state = RenderQueue::state(entries[begin].key);
+    size_t end = begin + 1;
+    while (end < entries.size() &&
+           RenderQueue::state(entries[end].key) == state) {
+      end++;
+    }
+
+    uint32_t first_object =
+        object_buffer.push(draws[entries[begin].payload].to_world);
+    for (size_t i = begin + 1; i < end; i++) {
+      object_buffer.push(draws[entries[i].payload].to_world);
+    }
+
+    uint32_t first_draw = entries[begin].payload;
+    const Draw& draw = draws[first_draw];
+    Group group{pipelines[draw_pipelines[first_draw]],
+                draw.mesh,
+                &draw.mesh->lods[draw.lod],
+                draw.material,
+                first_object,
+                static_cast<uint32_t>(end - begin),
+                {},
+                0,
+                0};
+    if (meshlet_frustum && draw.lod == 0 && draw.mesh->meshlets) {
+      cull_meshlets(object_buffer, *meshlet_frustum, camera, group, begin,
+                    end);
+    }
+    // Every meshlet of every instance may have been culled.
+    if (!group.command_buffer || group.command_count > 0) {
+      groups.push_back(group);
+    }
+    begin = end;
+  }
+
+  draw_count = groups.size();
+  instance_count = draws.size();
+  pipeline_binds = 0;
+  material_binds = 0;
+  mesh_binds = 0;
+  skipped_binds = 0;
+  draws.clear();
+  draw_pipelines.clear();
+  pipelines.clear();
+}
+
+void InstanceBatcher::record(vk::CommandBuffer& cmd_buffer,
+                             const vk::PipelineLayout& pipe_layout,
+                             uint32_t frame_index, size_t first_group,
+                             size_t end_group) {
+  // Nothing is bound at the start of a command buffer.
+  vk::Pipeline bound_pipeline;
+  const Material* bound_material = nullptr;
+  const Mesh* bound_mesh = nullptr;
+  uint32_t pipelines_bound = 0;
+  uint32_t materials_bound = 0;
+  uint32_t meshes_bound = 0;
+
+  for (size_t i = first_group; i < end_group; i++) {
+    const Group& group = groups[i];
+    if (group.pipeline != bound_pipeline) {
+      cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                              group.pipeline);
+      bound_pipeline = group.pipeline;
+      pipelines_bound++;
+    }
+    if (!bound_material || bound_material->index != group.material->index) {
+      group.material->record_draw(cmd_buffer, pipe_layout, frame_index);
+      bound_material = group.material;
+      materials_bound++;
+    }
+    if (!bound_mesh || bound_mesh->id != group.mesh->id) {
+      group.mesh->bind(cmd_buffer, pipe_layout);
+      bound_mesh = group.mesh;
+      meshes_bound++;
+    }
+    if (group.command_buffer) {
+      cmd_buffer.drawIndexedIndirect(group.command_buffer, group.first_command,
+                                     group.command_count,
+                                     sizeof(vk::DrawIndexedIndirectCommand));
+    } else {
+      cmd_buffer.drawIndexed(group.lod->index_count, group.instance_count,
+                             group.lod->first_index, 0, group.first_object);
+    }
+  }
+
+  uint32_t draws_recorded = end_group - first_group;
+  pipeline_binds += pipelines_bound;
+  material_binds += materials_bound;
+  mesh_binds += meshes_bound;
+  skipped_binds +=
+      3 * draws_recorded - pipelines_bound - materials_bound - meshes_bound;
+}
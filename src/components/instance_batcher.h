@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Material.h"
+#include "frustum_culler.h"
+#include "mesh.h"
+#include "object_buffer.h"
+#include "render_queue.h"
+
+// Collects the draws of a frame, sorts them through a RenderQueue and merges
+// the ones sharing a pipeline, a material, a mesh and its level of detail
+// into a single instanced draw. Instances of a group are ordered front to
+// back for early depth rejection. The transforms of a group are pushed to the
+// ObjectBuffer back to back, firstInstance selects the group and
+// gl_InstanceIndex the object within it.
+//
+// If build() gets a frustum, full detail groups of meshes with meshlets are
+// culled cluster by cluster instead. Every surviving meshlet of every
+// instance becomes an indirect command in the ObjectBuffer and the group is
+// recorded as one multi draw, which needs
+// VulkanLayer::gpu_driven_rendering.
+//
+// build() does the sorting and the pushes, afterwards ranges of groups can
+// be recorded into different command buffers from several threads.
+class InstanceBatcher {
+ public:
+  // mesh and material have to stay alive until the groups are recorded.
+  void add(vk::Pipeline pipeline, Mesh& mesh, Material& material,
+           const glm::mat4& to_world, uint32_t lod = 0);
+
+  // Groups all added draws and pushes their transforms, then clears them.
+  // Replaces the groups of the previous build(). Depth is along the view
+  // direction of view. meshlet_frustum enables meshlet culling.
+  void build(ObjectBuffer& object_buffer, const glm::mat4& view,
+             const Frustum* meshlet_frustum = nullptr);
+
+  size_t group_count() const { return groups.size(); }
+
+  // Records one draw per group in [first_group, end_group), binding only the
+  // state that differs from the previous group. BindlessMaterials and the
+  // ObjectBuffer have to be bound already.
+  void record(vk::CommandBuffer& cmd_buffer,
+              const vk::PipelineLayout& pipe_layout, uint32_t frame_index,
+              size_t first_group, size_t end_group);
+
+  // Statistics of the last build() and the records since. Every draw needs
+  // a pipeline, a material and a mesh, skipped_binds counts those that were
+  // still bound from the draw before.
+  uint32_t draw_count = 0;
+  uint32_t instance_count = 0;
+  std::atomic<uint32_t> pipeline_binds{0};
+  std::atomic<uint32_t> material_binds{0};
+  std::atomic<uint32_t> mesh_binds{0};
+  std::atomic<uint32_t> skipped_binds{0};
+  // Of every instance of the culled groups.
+  uint32_t meshlet_count = 0;
+  uint32_t visible_meshlet_count = 0;
+
+ private:
+  struct Draw {
+    Mesh* mesh;
+    Material* material;
+    glm::mat4 to_world;
+    uint32_t lod;
+  };
+
+  struct Group {
+    vk::Pipeline pipeline;
+    Mesh* mesh;
+    const MeshLod* lod;
+    Material* material;
+    uint32_t first_object;
+    uint32_t instance_count;
+    // Set if the group draws meshlets through indirect commands.
+    vk::Buffer command_buffer;
+    vk::DeviceSize first_command;
+    uint32_t command_count;
+  };
+
+  std::vector<Draw> draws;
+  // Index of the pipeline of every draw, in add() order.
+  std::vector<uint32_t> draw_pipelines;
+  // Distinct pipelines, indexed by their sort key id.
+  std::vector<vk::Pipeline> pipelines;
+  RenderQueue queue;
+  std::vector<Group> groups;
+  std::vector<uint32_t> visible_meshlets;
+  // Per instance of the group in cull_meshlets(), 1 if it draws its whole
+  // level in one command.
+  std::vector<char> whole_levels;
+
+  // Pushes a command per visible meshlet of every instance of group.
+  void cull_meshlets(ObjectBuffer& object_buffer, const Frustum& frustum,
+                     const glm::vec3& camera, Group& group, size_t begin,
+                     size_t end);
+};
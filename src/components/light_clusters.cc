@@ -0,0 +1,162 @@
+#include "light_clusters.h"
+
+#include <cstring>
+
+#include "../vulkan_layer/pipeline_cache.h"
+
+static constexpr vk::DeviceSize light_slice_size =
+    sizeof(Light) * LightClusters::max_lights;
+static constexpr vk::DeviceSize count_slice_size =
+    sizeof(uint32_t) * LightGrid::cluster_count;
+static constexpr vk::DeviceSize index_slice_size =
+    count_slice_size * LightGrid::max_lights_per_cluster;
+
+LightClusters::LightClusters(const std::string& shader_path,
+                             bool use_compute)
+    : use_compute{use_compute} {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  auto frames = VulkanLayer::frames_in_flight;
+
+  light_buffer = vulkan_layer.create_buffer(
+      light_slice_size * frames, vk::BufferUsageFlagBits::eStorageBuffer);
+  light_buffer.map(light_buffer_ptr);
+
+  // Only the CPU path writes the clusters from the host.
+  auto cluster_memory =
+      use_compute ? VMA_MEMORY_USAGE_GPU_ONLY : VMA_MEMORY_USAGE_CPU_TO_GPU;
+  count_buffer = vulkan_layer.create_buffer(
+      count_slice_size * frames, vk::BufferUsageFlagBits::eStorageBuffer,
+      cluster_memory);
+  index_buffer = vulkan_layer.create_buffer(
+      index_slice_size * frames, vk::BufferUsageFlagBits::eStorageBuffer,
+      cluster_memory);
+  if (!use_compute) {
+    count_buffer.map(count_buffer_ptr);
+    index_buffer.map(index_buffer_ptr);
+  }
+  // Host visible so that record_cull() can read back the counters.
+  overflow_buffer = vulkan_layer.create_buffer(
+      sizeof(uint32_t) * frames, vk::BufferUsageFlagBits::eStorageBuffer,
+      VMA_MEMORY_USAGE_GPU_TO_CPU);
+  overflow_buffer.map(overflow_buffer_ptr);
+  std::memset(overflow_buffer_ptr, 0, sizeof(uint32_t) * frames);
+  overflow_buffer.flush();
+
+  auto set_info = get_descriptor_set_info();
+  for (uint32_t i = 0; i < frames; i++) {
+    sets.push_back(vulkan_layer.allocate_descriptor_set(set_info));
+
+    std::vector<vk::DescriptorBufferInfo> infos = {
+        {light_buffer.buffer, light_slice_size * i, light_slice_size},
+        {count_buffer.buffer, count_slice_size * i, count_slice_size},
+        {index_buffer.buffer, index_slice_size * i, index_slice_size},
+        {overflow_buffer.buffer, 0, VK_WHOLE_SIZE}};
+    std::vector<vk::WriteDescriptorSet> writes;
+    for (uint32_t binding = 0; binding < infos.size(); binding++) {
+      writes.emplace_back(sets[i].set, binding, 0, 1,
+                          vk::DescriptorType::eStorageBuffer, nullptr,
+                          &infos[binding]);
+    }
+    vulkan_layer.device.updateDescriptorSets(writes, {});
+  }
+
+  if (!use_compute) {
+    return;
+  }
+  vk::PushConstantRange push_constant_range(
+      vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+  auto set_layout = get_descriptor_set_layout();
+  vk::PipelineLayoutCreateInfo layout_ci;
+  layout_ci.setSetLayouts(set_layout);
+  layout_ci.setPushConstantRanges(push_constant_range);
+  pipeline_layout = vulkan_layer.device.createPipelineLayout(layout_ci);
+
+  pipeline = PipelineCache::get_instance().get(
+      ComputePipelineDesc{shader_path, pipeline_layout});
+}
+
+DescriptorSetInfo LightClusters::get_descriptor_set_info() {
+  std::vector<vk::DescriptorSetLayoutBinding> bindings(4);
+  for (uint32_t i = 0; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].setStageFlags(vk::ShaderStageFlagBits::eCompute |
+                              vk::ShaderStageFlagBits::eFragment);
+    bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+    bindings[i].descriptorCount = 1;
+  }
+  return DescriptorSetInfo(vk::DescriptorSetLayoutCreateInfo(), bindings);
+}
+
+void LightClusters::begin_frame(uint32_t frame_index, const glm::mat4& view,
+                                const glm::mat4& projection, float clip_near,
+                                float clip_far) {
+  frame = frame_index;
+  this->view = view;
+  this->projection = projection;
+  this->clip_near = clip_near;
+  this->clip_far = clip_far;
+  lights.clear();
+}
+
+void LightClusters::push(const Light& light) {
+  if (lights.size() == max_lights) {
+    throw std::runtime_error("light buffer is full!");
+  }
+  // The view matrix is rigid, directions stay normalized.
+  Light view_light = light;
+  view_light.position = glm::vec3(view * glm::vec4(light.position, 1.0f));
+  view_light.direction = glm::mat3(view) * light.direction;
+  lights.push_back(view_light);
+}
+
+void LightClusters::record_cull(vk::CommandBuffer& cmd_buffer) {
+  std::memcpy(static_cast<char*>(light_buffer_ptr) + light_slice_size * frame,
+              lights.data(), lights.size() * sizeof(Light));
+  light_buffer.flush();
+
+  // Host writes before the submission need no barrier.
+  if (!use_compute) {
+    grid.set_projection(projection, clip_near, clip_far);
+    overflowed = grid.bin(
+        lights,
+        reinterpret_cast<uint32_t*>(static_cast<char*>(count_buffer_ptr) +
+                                    count_slice_size * frame),
+        reinterpret_cast<uint32_t*>(static_cast<char*>(index_buffer_ptr) +
+                                    index_slice_size * frame));
+    count_buffer.flush();
+    index_buffer.flush();
+    return;
+  }
+
+  // The frame's fence was waited on, its counter is final. Resetting it
+  // from the host needs no barrier either.
+  overflow_buffer.invalidate();
+  auto counters = static_cast<uint32_t*>(overflow_buffer_ptr);
+  overflowed = counters[frame];
+  counters[frame] = 0;
+  overflow_buffer.flush();
+
+  PushConstants constants{glm::inverse(projection), clip_near, clip_far,
+                          light_count(), frame};
+  cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                pipeline_layout, 0, 1, &sets[frame].set, 0,
+                                nullptr);
+  cmd_buffer.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute,
+                           0, sizeof(PushConstants), &constants);
+  cmd_buffer.dispatch(
+      (LightGrid::cluster_count + workgroup_size - 1) / workgroup_size, 1, 1);
+
+  vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite,
+                            vk::AccessFlagBits::eShaderRead);
+  cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                             vk::PipelineStageFlagBits::eFragmentShader, {},
+                             barrier, {}, {});
+}
+
+void LightClusters::bind(vk::CommandBuffer& cmd_buffer,
+                         const vk::PipelineLayout& pipe_layout,
+                         uint32_t set_index) {
+  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipe_layout,
+                                set_index, 1, &sets[frame].set, 0, nullptr);
+}
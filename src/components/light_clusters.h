@@ -0,0 +1,100 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "../vulkan_layer/vulkan_layer.h"
+#include "light_grid.h"
+
+// Lights of a frame binned into a LightGrid for the deferred lighting pass.
+// Lights are pushed in world space every frame and uploaded in view space.
+// Binning runs in cluster_lights.comp, one invocation per cluster, or on the
+// CPU through LightGrid::bin().
+//
+// All buffers hold one slice per frame in flight and every frame has its own
+// descriptor set pointing at its slice: binding 0 the lights, binding 1 the
+// light count of every cluster and binding 2 their light indices,
+// LightGrid::max_lights_per_cluster per cluster. Binding 3 is shared by all
+// frames, it counts the clusters that dropped lights, one counter per frame.
+class LightClusters {
+ public:
+  static constexpr uint32_t max_lights = 1 << 14;
+  static constexpr uint32_t workgroup_size = 64;
+
+  struct PushConstants {
+    glm::mat4 inverse_projection;
+    float clip_near;
+    float clip_far;
+    uint32_t light_count;
+    uint32_t frame;
+  };
+
+  // Bins in the compute shader at shader_path if use_compute, on the CPU
+  // otherwise.
+  LightClusters(const std::string& shader_path, bool use_compute);
+
+  // Starts collecting the lights of frame_index. The frame's fence must have
+  // been waited on.
+  void begin_frame(uint32_t frame_index, const glm::mat4& view,
+                   const glm::mat4& projection, float clip_near,
+                   float clip_far);
+
+  // In world space.
+  void push(const Light& light);
+
+  // Outside of rendering. Bins the pushed lights and makes the clusters
+  // visible to fragment shaders.
+  void record_cull(vk::CommandBuffer& cmd_buffer);
+
+  void bind(vk::CommandBuffer& cmd_buffer,
+            const vk::PipelineLayout& pipe_layout, uint32_t set_index);
+
+  // Lights pushed since begin_frame.
+  uint32_t light_count() const { return lights.size(); }
+
+  bool bins_on_gpu() const { return use_compute; }
+
+  // Clusters touched by more than LightGrid::max_lights_per_cluster lights,
+  // which dropped the rest. On the GPU path this is the last completed
+  // binning of the frame slot, read back when the slot is reused.
+  uint32_t overflowed_clusters() const { return overflowed; }
+
+  const glm::mat4& get_projection() const { return projection; }
+  float get_clip_near() const { return clip_near; }
+  float get_clip_far() const { return clip_far; }
+
+  static DescriptorSetInfo get_descriptor_set_info();
+
+  static vk::DescriptorSetLayout get_descriptor_set_layout() {
+    return VulkanLayer::get_instance().create_descriptor_set_layout(
+        get_descriptor_set_info());
+  }
+
+ private:
+  bool use_compute;
+  LightGrid grid;
+
+  uint32_t frame = 0;
+  glm::mat4 view;
+  glm::mat4 projection;
+  float clip_near;
+  float clip_far;
+  std::vector<Light> lights;
+
+  Buffer light_buffer;
+  void* light_buffer_ptr;
+  // Device local if use_compute, mapped otherwise.
+  Buffer count_buffer;
+  void* count_buffer_ptr = nullptr;
+  Buffer index_buffer;
+  void* index_buffer_ptr = nullptr;
+  Buffer overflow_buffer;
+  void* overflow_buffer_ptr;
+  uint32_t overflowed = 0;
+
+  std::vector<DescriptorSet> sets;
+
+  vk::PipelineLayout pipeline_layout;
+  vk::Pipeline pipeline;
+};
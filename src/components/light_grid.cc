@@ -0,0 +1,217 @@
+#include "light_grid.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#include "../core/thread_pool.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LIGHT_GRID_X86 1
+#endif
+
+// Bounding spheres of lights as structure of arrays, tested against boxes
+// four at a time.
+struct SphereList {
+  std::vector<float> x, y, z, radius2;
+  std::vector<uint32_t> ids;
+
+  void push(const glm::vec4& sphere, uint32_t id) {
+    x.push_back(sphere.x);
+    y.push_back(sphere.y);
+    z.push_back(sphere.z);
+    radius2.push_back(sphere.w * sphere.w);
+    ids.push_back(id);
+  }
+
+  void push(const SphereList& other, size_t i) {
+    x.push_back(other.x[i]);
+    y.push_back(other.y[i]);
+    z.push_back(other.z[i]);
+    radius2.push_back(other.radius2[i]);
+    ids.push_back(other.ids[i]);
+  }
+
+  // Calls fn(i) for the spheres touching the box, in order, until fn
+  // returns false.
+  template <typename Fn>
+  void for_each_touching(const glm::vec3& lo, const glm::vec3& hi,
+                         Fn fn) const {
+    size_t count = ids.size();
+    size_t i = 0;
+#if LIGHT_GRID_X86
+    __m128 lo_x = _mm_set1_ps(lo.x), hi_x = _mm_set1_ps(hi.x);
+    __m128 lo_y = _mm_set1_ps(lo.y), hi_y = _mm_set1_ps(hi.y);
+    __m128 lo_z = _mm_set1_ps(lo.z), hi_z = _mm_set1_ps(hi.z);
+    __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+      __m128 px = _mm_loadu_ps(&x[i]);
+      __m128 py = _mm_loadu_ps(&y[i]);
+      __m128 pz = _mm_loadu_ps(&z[i]);
+      __m128 dx = _mm_max_ps(
+          _mm_max_ps(_mm_sub_ps(lo_x, px), _mm_sub_ps(px, hi_x)), zero);
+      __m128 dy = _mm_max_ps(
+          _mm_max_ps(_mm_sub_ps(lo_y, py), _mm_sub_ps(py, hi_y)), zero);
+      __m128 dz = _mm_max_ps(
+          _mm_max_ps(_mm_sub_ps(lo_z, pz), _mm_sub_ps(pz, hi_z)), zero);
+      __m128 distance2 =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                     _mm_mul_ps(dz, dz));
+      int mask =
+          _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(&radius2[i])));
+      for (int lane = 0; lane < 4; lane++) {
+        if ((mask & (1 << lane)) && !fn(i + lane)) {
+          return;
+        }
+      }
+    }
+#endif
+    for (; i < count; i++) {
+      float dx = std::max({lo.x - x[i], x[i] - hi.x, 0.0f});
+      float dy = std::max({lo.y - y[i], y[i] - hi.y, 0.0f});
+      float dz = std::max({lo.z - z[i], z[i] - hi.z, 0.0f});
+      if (dx * dx + dy * dy + dz * dz <= radius2[i] && !fn(i)) {
+        return;
+      }
+    }
+  }
+
+  SphereList select(const glm::vec3& lo, const glm::vec3& hi) const {
+    SphereList result;
+    for_each_touching(lo, hi, [&](size_t i) {
+      result.push(*this, i);
+      return true;
+    });
+    return result;
+  }
+
+  // Writes the ids of at most max_count touching spheres to out. Sets
+  // overflowed if more than max_count touch.
+  uint32_t select(const glm::vec3& lo, const glm::vec3& hi,
+                  uint32_t max_count, uint32_t* out, bool& overflowed) const {
+    uint32_t count = 0;
+    overflowed = false;
+    for_each_touching(lo, hi, [&](size_t i) {
+      if (count == max_count) {
+        overflowed = true;
+        return false;
+      }
+      out[count++] = ids[i];
+      return true;
+    });
+    return count;
+  }
+};
+
+glm::vec4 Light::bounding_sphere() const {
+  // Point lights and cones wider than a hemisphere reach all around.
+  if (cos_outer <= 0.0f) {
+    return glm::vec4(position, range);
+  }
+  // Beyond 45 degrees the sphere around the rim of the cone's cap is the
+  // smallest, below the one through the apex and the rim.
+  if (cos_outer < std::sqrt(0.5f)) {
+    float sin_outer = std::sqrt(1.0f - cos_outer * cos_outer);
+    return glm::vec4(position + direction * (range * cos_outer),
+                     range * sin_outer);
+  }
+  float radius = range / (2.0f * cos_outer);
+  return glm::vec4(position + direction * radius, radius);
+}
+
+void LightGrid::set_projection(const glm::mat4& projection, float clip_near,
+                               float clip_far) {
+  if (projection == this->projection && clip_near == this->clip_near &&
+      clip_far == this->clip_far) {
+    return;
+  }
+  this->projection = projection;
+  this->clip_near = clip_near;
+  this->clip_far = clip_far;
+
+  // View space direction through a point on the screen, scaled to a depth
+  // of 1. Any depth within the clip range lies on the same ray.
+  glm::mat4 inverse = glm::inverse(projection);
+  auto ray = [&](float ndc_x, float ndc_y) {
+    glm::vec4 point = inverse * glm::vec4(ndc_x, ndc_y, 0.5f, 1.0f);
+    glm::vec3 position = glm::vec3(point) / point.w;
+    return position / -position.z;
+  };
+
+  min_bounds.resize(cluster_count);
+  max_bounds.resize(cluster_count);
+  for (uint32_t z = 0; z < depth_slices; z++) {
+    float depths[2] = {slice_depth(z), slice_depth(z + 1)};
+    for (uint32_t y = 0; y < tiles_y; y++) {
+      for (uint32_t x = 0; x < tiles_x; x++) {
+        uint32_t cluster = (z * tiles_y + y) * tiles_x + x;
+        glm::vec3 lo(FLT_MAX);
+        glm::vec3 hi(-FLT_MAX);
+        for (uint32_t corner = 0; corner < 4; corner++) {
+          glm::vec3 direction =
+              ray(float(x + (corner & 1)) / tiles_x * 2.0f - 1.0f,
+                  float(y + (corner >> 1)) / tiles_y * 2.0f - 1.0f);
+          for (float depth : depths) {
+            lo = glm::min(lo, direction * depth);
+            hi = glm::max(hi, direction * depth);
+          }
+        }
+        min_bounds[cluster] = lo;
+        max_bounds[cluster] = hi;
+      }
+    }
+  }
+}
+
+float LightGrid::slice_depth(uint32_t slice) const {
+  return clip_near *
+         std::pow(clip_far / clip_near, float(slice) / depth_slices);
+}
+
+uint32_t LightGrid::bin(const std::vector<Light>& lights, uint32_t* counts,
+                        uint32_t* indices) const {
+  SphereList spheres;
+  for (uint32_t i = 0; i < lights.size(); i++) {
+    spheres.push(lights[i].bounding_sphere(), i);
+  }
+  std::vector<uint32_t> overflowed(depth_slices);
+  ThreadPool::get_instance().parallel_for(depth_slices, [&](size_t slice) {
+    overflowed[slice] = bin_slice(spheres, slice, counts, indices);
+  });
+  uint32_t overflowed_clusters = 0;
+  for (uint32_t count : overflowed) {
+    overflowed_clusters += count;
+  }
+  return overflowed_clusters;
+}
+
+uint32_t LightGrid::bin_slice(const SphereList& spheres, uint32_t slice,
+                              uint32_t* counts, uint32_t* indices) const {
+  // View space z is negative in front of the camera.
+  glm::vec3 slice_lo(-FLT_MAX, -FLT_MAX, -slice_depth(slice + 1));
+  glm::vec3 slice_hi(FLT_MAX, FLT_MAX, -slice_depth(slice));
+  SphereList slice_spheres = spheres.select(slice_lo, slice_hi);
+
+  // Rows first, so every tile only tests the lights reaching its row.
+  uint32_t overflowed_clusters = 0;
+  for (uint32_t y = 0; y < tiles_y; y++) {
+    uint32_t row = (slice * tiles_y + y) * tiles_x;
+    glm::vec3 row_lo = min_bounds[row];
+    glm::vec3 row_hi = max_bounds[row];
+    for (uint32_t x = 1; x < tiles_x; x++) {
+      row_lo = glm::min(row_lo, min_bounds[row + x]);
+      row_hi = glm::max(row_hi, max_bounds[row + x]);
+    }
+    SphereList row_spheres = slice_spheres.select(row_lo, row_hi);
+
+    for (uint32_t x = 0; x < tiles_x; x++) {
+      uint32_t cluster = row + x;
+      bool overflowed;
+      counts[cluster] = row_spheres.select(
+          min_bounds[cluster], max_bounds[cluster], max_lights_per_cluster,
+          indices + cluster * max_lights_per_cluster, overflowed);
+      overflowed_clusters += overflowed;
+    }
+  }
+  return overflowed_clusters;
+}
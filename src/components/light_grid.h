@@ -0,0 +1,87 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// std430 layout shared with cluster_lights.comp and lighting.frag. The
+// color is premultiplied by the intensity and the contribution fades to zero
+// at range.
+struct Light {
+  glm::vec3 position;
+  float range;
+  glm::vec3 color;
+  // Cosines of the half angles where a spot light's cone starts to fade and
+  // where it reaches zero. Both are -1 for point lights.
+  float cos_inner;
+  glm::vec3 direction;
+  float cos_outer;
+
+  static Light point(const glm::vec3& position, float range,
+                     const glm::vec3& color) {
+    return {position, range, color, -1.0f, glm::vec3(0, 0, -1), -1.0f};
+  }
+
+  // Angles in radians, inner_angle has to be smaller than outer_angle.
+  static Light spot(const glm::vec3& position, const glm::vec3& direction,
+                    float range, const glm::vec3& color, float inner_angle,
+                    float outer_angle) {
+    return {position, range, color, std::cos(inner_angle),
+            glm::normalize(direction), std::cos(outer_angle)};
+  }
+
+  // Sphere around everything the light reaches, xyz center and w radius.
+  // Spot lights narrower than a hemisphere get a smaller one around their
+  // cone.
+  glm::vec4 bounding_sphere() const;
+};
+
+struct SphereList;
+
+// Froxel grid over the view frustum: tiles_x * tiles_y screen tiles, each
+// split into depth_slices clusters whose depth grows exponentially from the
+// near to the far plane, so clusters stay roughly as deep as they are wide.
+// Cluster (x, y, z) has the index (z * tiles_y + y) * tiles_x + x. Pixels
+// find theirs from gl_FragCoord and their view space depth.
+//
+// Binning lists every light whose bounding sphere touches the view space
+// box around a cluster, so shading a pixel only loops over those.
+class LightGrid {
+ public:
+  // Also hard-coded in cluster_lights.comp and lighting.frag.
+  static constexpr uint32_t tiles_x = 16;
+  static constexpr uint32_t tiles_y = 9;
+  static constexpr uint32_t depth_slices = 24;
+  static constexpr uint32_t cluster_count = tiles_x * tiles_y * depth_slices;
+  // Lights beyond this are dropped from a cluster, bin() counts the clusters
+  // that lose some.
+  static constexpr uint32_t max_lights_per_cluster = 128;
+
+  // Recomputes the cluster boxes if the projection changed. far has to be
+  // larger than near.
+  void set_projection(const glm::mat4& projection, float clip_near,
+                      float clip_far);
+
+  // View space depth where slice starts, clip_far for depth_slices.
+  float slice_depth(uint32_t slice) const;
+
+  // Bins view space lights, one ThreadPool task per slice. Writes the number
+  // of lights touching cluster c to counts[c] and their indices to
+  // indices[c * max_lights_per_cluster] onwards. Returns the number of
+  // clusters touched by more than max_lights_per_cluster lights.
+  uint32_t bin(const std::vector<Light>& lights, uint32_t* counts,
+               uint32_t* indices) const;
+
+  glm::vec3 cluster_min(uint32_t cluster) const { return min_bounds[cluster]; }
+  glm::vec3 cluster_max(uint32_t cluster) const { return max_bounds[cluster]; }
+
+ private:
+  glm::mat4 projection{0.0f};
+  float clip_near = 0.0f;
+  float clip_far = 0.0f;
+  std::vector<glm::vec3> min_bounds;
+  std::vector<glm::vec3> max_bounds;
+
+  uint32_t bin_slice(const SphereList& spheres, uint32_t slice,
+                     uint32_t* counts, uint32_t* indices) const;
+};
@@ -0,0 +1,52 @@
+#include "lod_selector.h"
+
+#include <algorithm>
+#include <cmath>
+
+float LodSelector::pixel_scale(const glm::mat4& projection,
+                               float viewport_height) {
+  // projection[1][1] is 1 / tan(fov_y / 2), NDC spans 2 units.
+  return std::abs(projection[1][1]) * viewport_height * 0.5f;
+}
+
+void LodSelector::begin(const glm::mat4& new_view,
+                        const glm::mat4& projection, float viewport_height) {
+  view = new_view;
+  scale = pixel_scale(projection, viewport_height);
+  triangle_count = 0;
+  full_triangle_count = 0;
+}
+
+uint32_t LodSelector::select(uint32_t object, const Mesh& mesh,
+                             const glm::mat4& to_world) {
+  if (object >= levels.size()) {
+    levels.resize(object + 1, 0);
+  }
+
+  glm::vec3 center = to_world * glm::vec4(mesh.sphere.center, 1);
+  float scale = std::max({glm::length(glm::vec3(to_world[0])),
+                          glm::length(glm::vec3(to_world[1])),
+                          glm::length(glm::vec3(to_world[2]))});
+  float radius = mesh.sphere.radius * scale;
+  // The camera looks down -z.
+  float distance = -(view * glm::vec4(center, 1)).z;
+
+  uint32_t max_level = mesh.lods.size() - 1;
+  uint32_t level = levels[object];
+  if (distance <= radius) {
+    // The camera is inside or right at the sphere.
+    level = 0;
+  } else {
+    float diameter = 2.0f * radius * scale / distance;
+    float ideal = 2.0f * std::log2(full_detail_size / diameter);
+    if (ideal < level - hysteresis || ideal > level + 1 + hysteresis) {
+      level = std::clamp(ideal, 0.0f, float(max_level));
+    }
+  }
+  level = std::min(level, max_level);
+  levels[object] = level;
+
+  triangle_count += mesh.lods[level].index_count / 3;
+  full_triangle_count += mesh.lods[0].index_count / 3;
+  return level;
+}
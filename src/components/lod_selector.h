@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "mesh.h"
+
+// Picks a level of a mesh's LOD chain per object from how large its
+// bounding sphere appears on screen. Every level halves the triangles, so
+// every halving of the screen space area (a factor of sqrt(2) in diameter)
+// drops one level and triangles per pixel stay about constant.
+//
+// The level of every object is remembered. It only changes once the size
+// left the range of the current level by hysteresis levels, so objects near
+// a threshold do not pop back and forth.
+class LodSelector {
+ public:
+  // Diameter in pixels below which an object drops to level 1.
+  static constexpr float full_detail_size = 512.0f;
+  static constexpr float hysteresis = 0.25f;
+
+  // Pixels per unit of world space size at view distance 1.
+  static float pixel_scale(const glm::mat4& projection,
+                           float viewport_height);
+
+  // Sets up the frame. viewport_height is in pixels.
+  void begin(const glm::mat4& view, const glm::mat4& projection,
+             float viewport_height);
+
+  // object indexes the remembered levels and has to be stable over frames.
+  uint32_t select(uint32_t object, const Mesh& mesh,
+                  const glm::mat4& to_world);
+
+  // Statistics since begin(), triangles of the selected levels and of level
+  // 0 for the same objects.
+  uint64_t triangle_count = 0;
+  uint64_t full_triangle_count = 0;
+
+ private:
+  glm::mat4 view;
+  float scale = 1.0f;
+  std::vector<uint8_t> levels;
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <utility>
+
+// Read only memory mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() {}
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  ~MappedFile() { close(); }
+
+  // Returns false if the file does not exist or cannot be mapped.
+  bool open(const std::string& path);
+  void close();
+
+  bool is_open() const { return mapping != nullptr; }
+  const char* data() const { return static_cast<const char*>(mapping); }
+  size_t size() const { return mapping_size; }
+
+ private:
+  void* mapping = nullptr;
+  size_t mapping_size = 0;
+};
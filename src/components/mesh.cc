@@ -1,100 +1,207 @@
 #include "mesh.h"
 
-#include "../vulkan_layer/vulkan_layer.h"
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iostream>
 
-void Mesh::record_draw(vk::CommandBuffer& cmd_buffer, const vk::PipelineLayout& pipe_layout, const glm::mat4& view,
-                       const glm::mat4& proj) {
-  update_projection_buffer(view, proj);
-  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-                                pipe_layout, 0, 1, &desc_set.set, 0,
-                                nullptr);
+#include "../core/hash.h"
+#include "../vulkan_layer/upload_manager.h"
+#include "../vulkan_layer/vulkan_layer.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+#include "vertex_packer.h"
 
+void Mesh::bind(vk::CommandBuffer& cmd_buffer,
+                const vk::PipelineLayout& pipe_layout) {
   std::vector<vk::Buffer> vertex_buffers = {vertecies};
   std::vector<vk::DeviceSize> offsets = {0};
   cmd_buffer.bindVertexBuffers(0, vertex_buffers, offsets);
 
-  cmd_buffer.bindIndexBuffer(indices, {0}, vk::IndexType::eUint32);
+  cmd_buffer.bindIndexBuffer(indices, {0}, index_type);
 
-  cmd_buffer.drawIndexed(num_indices, 1, 0, 0, 0);
+  cmd_buffer.pushConstants(pipe_layout, vk::ShaderStageFlagBits::eVertex,
+                           push_constant_offset, sizeof(MeshPushConstants),
+                           &decode);
 }
 
-void Mesh::update_projection_buffer(const glm::mat4& view,
-                                    const glm::mat4& proj) {
-  const auto to_view = view * entity_to_world;
-  const auto normal_matrix = glm::transpose(glm::inverse(to_view));
-  const auto render_matrix = proj * to_view;
-  MeshProjectionData proj_data{
-      .to_view = to_view,
-      .normal_to_view = normal_matrix,
-      .to_screen = render_matrix,
-  };
-
-  std::memcpy(proj_buffer_ptr, &proj_data, sizeof(MeshProjectionData));
-};
+void Mesh::record_draw(vk::CommandBuffer& cmd_buffer,
+                       const vk::PipelineLayout& pipe_layout,
+                       uint32_t first_object, uint32_t instance_count,
+                       uint32_t lod) {
+  bind(cmd_buffer, pipe_layout);
+  cmd_buffer.drawIndexed(lods[lod].index_count, instance_count,
+                         lods[lod].first_index, 0, first_object);
+}
 
 Mesh Mesh::load(const std::string& filepath) {
-  tinyobj::attrib_t attrib;
-  std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
-  std::string warn, err;
-
-  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-                        filepath.c_str())) {
-    throw std::runtime_error(warn + err);
+  MeshCache::SourceStamp stamp;
+  if (!stamp.read(filepath)) {
+    throw std::runtime_error("failed to open " + filepath);
   }
 
-  std::vector<Vertex> vertecies;
-  std::vector<uint32_t> indices;
+  auto cache_path = MeshCache::cache_path(filepath);
+  MeshCache cache;
+  bool cached = cache.open(cache_path);
+  auto from_cache = [&] {
+    return create(cache.vertex_format(), cache.vertex_data(),
+                  cache.vertex_count(), cache.index_data(),
+                  cache.index_count(), cache.bounds(), cache.sphere(),
+                  cache.lods(), cache.meshlets());
+  };
+  // An unchanged size and modification time skip reading the source.
+  if (cached && cache.source_stamp() == stamp) {
+    return from_cache();
+  }
 
-  for (const auto& shape : shapes) {
-    for (const auto& index : shape.mesh.indices) {
-      Vertex vertex{};
+  MappedFile source;
+  if (!source.open(filepath)) {
+    throw std::runtime_error("failed to open " + filepath);
+  }
+  uint64_t source_hash = hash_bytes(source.data(), source.size());
+  if (cached && cache.source_hash() == source_hash) {
+    Mesh mesh = from_cache();
+    MeshCache::restamp(cache_path, stamp);
+    return mesh;
+  }
 
-      vertex.position = {attrib.vertices[3 * index.vertex_index + 0],
-                         attrib.vertices[3 * index.vertex_index + 1],
-                         attrib.vertices[3 * index.vertex_index + 2]};
+  // Corners are welded as they stream in, the unwelded list never exists.
+  MeshOptimizer::Welder welder;
+  ObjParser::parse(source.data(), source.size(),
+                   [&](const Vertex* corners, size_t count) {
+                     welder.add(corners, count);
+                   });
+  source.close();
+
+  // Meshlets are cut first, the vertex cache and overdraw passes then only
+  // reorder triangles within them.
+  const auto& vertecies = welder.vertices;
+  auto& indices = welder.indices;
+  auto meshlets =
+      Meshlets::build(vertecies, indices.data(), indices.size());
+  std::cout << filepath << ": " << meshlets.size() << " meshlets\n";
+  std::vector<MeshOptimizer::IndexRange> ranges;
+  for (const auto& meshlet : meshlets) {
+    ranges.push_back({meshlet.first_index, meshlet.triangle_count * 3});
+  }
 
-      vertex.normal = {attrib.normals[3 * index.normal_index + 0],
-                       attrib.normals[3 * index.normal_index + 1],
-                       attrib.normals[3 * index.normal_index + 2]};
+  auto stats = MeshOptimizer::optimize(welder, ranges);
+  std::cout << filepath << ": " << stats.vertices_before << " -> "
+            << stats.vertices_after << " vertices, ACMR "
+            << stats.acmr_before << " -> " << stats.acmr_welded
+            << " (welded) -> " << stats.acmr_after << "\n";
 
-      vertex.tex_coord = {attrib.texcoords[2 * index.texcoord_index + 0],
-                          1.f - attrib.texcoords[2 * index.texcoord_index + 1]};
+  auto lods = MeshSimplifier::build_lods(vertecies, indices);
+  std::cout << filepath << ": " << lods.size() << " LODs, "
+            << lods.back().index_count / 3 << " triangles in the last\n";
 
-      vertecies.push_back(vertex);
-      indices.push_back(indices.size());
-    }
+  AABB bounds;
+  for (const auto& vertex : vertecies) {
+    bounds.extend(vertex.position);
   }
 
-  Mesh output;
-
-  output.num_indices = indices.size();
-
-  size_t vertex_buffer_size = vertecies.size() * sizeof(Vertex);
-  auto buffer = VulkanLayer::get_instance().create_buffer(
-      vertex_buffer_size, vk::BufferUsageFlagBits::eVertexBuffer);
+  // Tighter than the half diagonal of the box for round meshes.
+  Sphere sphere{bounds.center()};
+  for (const auto& vertex : vertecies) {
+    sphere.radius =
+        std::max(sphere.radius, glm::length(vertex.position - sphere.center));
+  }
 
-  void* data;
-  buffer.map(data);
+  // Everything above works on the float vertices and 32 bit indices, only
+  // the GPU copy is packed.
+  auto vertex_format = VertexPacker::select_format(vertecies);
+  auto vertex_data =
+      VertexPacker::pack_vertices(vertecies, vertex_format, bounds);
+  auto index_data = VertexPacker::pack_indices(indices, vertecies.size());
+  std::cout << filepath << ": "
+            << (vertex_data.size() + index_data.size()) / 1024
+            << " KiB of vertices and indices, "
+            << (vertecies.size() * sizeof(Vertex) +
+                indices.size() * sizeof(uint32_t)) /
+                   1024
+            << " KiB unpacked\n";
+
+  if (!MeshCache::write(cache_path, stamp, source_hash, vertex_format,
+                        vertex_data, vertecies.size(), index_data,
+                        indices.size(), bounds, sphere, lods, meshlets)) {
+    std::cerr << "Failed to write mesh cache " << cache_path << "\n";
+  }
 
-  memcpy(data, vertecies.data(), vertex_buffer_size);
+  return create(vertex_format, vertex_data.data(), vertecies.size(),
+                index_data.data(), indices.size(), bounds, sphere, lods,
+                meshlets);
+}
 
-  buffer.unmap();
-  output.vertecies = buffer.buffer;
+void Mesh::describe_vertex_input(VertexFormat format,
+                                 GraphicsPipelineDesc& desc) {
+  vk::VertexInputBindingDescription binding;
+  binding.binding = 0;
+  binding.stride = VertexPacker::vertex_stride(format);
+  binding.inputRate = vk::VertexInputRate::eVertex;
+  desc.bindings = {binding};
+
+  // Locations 0 to 2 are position, normal and texture coordinates.
+  if (format == VertexFormat::ePacked) {
+    desc.attributes = {
+        {0, 0, vk::Format::eR16G16B16A16Snorm,
+         offsetof(PackedVertex, position)},
+        {1, 0, vk::Format::eR16G16Snorm, offsetof(PackedVertex, normal)},
+        {2, 0, vk::Format::eR16G16Sfloat, offsetof(PackedVertex, tex_coord)},
+    };
+  } else {
+    desc.attributes = {
+        {0, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, position)},
+        {1, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, normal)},
+        {2, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, tex_coord)},
+    };
+  }
+}
 
-  size_t index_buffer_size = indices.size() * sizeof(uint32_t);
-  buffer = VulkanLayer::get_instance().create_buffer(
-      index_buffer_size, vk::BufferUsageFlagBits::eIndexBuffer);
+Mesh Mesh::create(VertexFormat vertex_format, const uint8_t* vertex_data,
+                  size_t vertex_count, const uint8_t* index_data,
+                  size_t index_count, const AABB& bounds,
+                  const Sphere& sphere,
+                  const std::vector<MeshLod>& lods,
+                  const std::vector<Meshlet>& meshlets) {
+  static std::atomic<uint32_t> next_id{0};
 
-  buffer.map(data);
+  Mesh output;
 
-  memcpy(data, indices.data(), index_buffer_size);
+  output.id = next_id++;
+  output.num_indices = lods[0].index_count;
+  output.lods = lods;
+  output.bounds = bounds;
+  output.sphere = sphere;
+  output.vertex_format = vertex_format;
+  uint32_t index_stride = VertexPacker::index_stride(vertex_count);
+  output.index_type = index_stride == sizeof(uint16_t)
+                          ? vk::IndexType::eUint16
+                          : vk::IndexType::eUint32;
+  if (vertex_format == VertexFormat::ePacked) {
+    output.decode = {bounds.center(), 1, bounds.extent(), 0.0f};
+  } else {
+    output.decode = {glm::vec3(0.0f), 0, glm::vec3(1.0f), 0.0f};
+  }
+  if (!meshlets.empty()) {
+    output.meshlets = std::make_shared<const Meshlets>(meshlets);
+  }
 
-  buffer.unmap();
-  output.indices = buffer.buffer;
+  // Static geometry lives in device local memory, UploadManager::flush()
+  // has to run before the first draw.
+  auto& upload_manager = UploadManager::get_instance();
+  output.vertecies = upload_manager
+                         .create_static_buffer(
+                             vertex_data,
+                             vertex_count *
+                                 VertexPacker::vertex_stride(vertex_format),
+                             vk::BufferUsageFlagBits::eVertexBuffer)
+                         .buffer;
+  output.indices = upload_manager
+                       .create_static_buffer(
+                           index_data, index_count * index_stride,
+                           vk::BufferUsageFlagBits::eIndexBuffer)
+                       .buffer;
 
   return output;
 }
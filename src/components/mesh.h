@@ -1,89 +1,84 @@
 #pragma once
+#include <memory>
 #include <vector>
 
+#include "../vulkan_layer/pipeline_cache.h"
 #include "../vulkan_layer/vulkan_layer.h"
-#include "entity.h"
 #include "Texture.h"
-
-struct MeshProjectionData {
-  glm::mat4 to_view;
-  glm::mat4 normal_to_view;
-  glm::mat4 to_screen;
-};
-
-struct Vertex {
-  glm::vec3 position;
-  glm::vec3 normal;
-  glm::vec2 tex_coord;
+#include "bounds.h"
+#include "mesh_simplifier.h"
+#include "meshlets.h"
+#include "vertex.h"
+
+// std430 layout of the vertex decode parameters, pushed to the vertex stage
+// after MaterialPushConstants. Positions are position_offset +
+// position_scale * the attribute, which is the identity for
+// VertexFormat::eFloat.
+struct MeshPushConstants {
+  glm::vec3 position_offset;
+  uint32_t octahedral_normals;
+  glm::vec3 position_scale;
+  float padding;
 };
 
-class Mesh : public Entity {
+class Mesh {
  public:
+  static constexpr uint32_t push_constant_offset = 16;
+
   vk::Buffer vertecies;
   vk::Buffer indices;
+  VertexFormat vertex_format;
+  vk::IndexType index_type;
+  MeshPushConstants decode;
 
+  // Of the full detail level.
   uint32_t num_indices;
+  // Unique per create(), copies share it along with the buffers.
+  uint32_t id;
 
-  Mesh() {
-    create_projection_buffer();
-    create_descriptor_set();
-  }
+  // Level 0 is the full mesh, every further level has about half the
+  // triangles. All of them are ranges of the one index buffer.
+  std::vector<MeshLod> lods;
 
-  void record_draw(vk::CommandBuffer& cmd_buffer,
-                   const vk::PipelineLayout& pipe_layout, const glm::mat4& view,
-                   const glm::mat4& proj);
-
-  void update_projection_buffer(const glm::mat4& view, const glm::mat4& proj);
-
-  static Mesh load(const std::string& filepath);
-
-  static vk::DescriptorSetLayout get_descriptor_set_layout() {
-    return VulkanLayer::get_instance().create_descriptor_set_layout(
-        get_descriptor_set_info());
-  }
+  // Clusters of level 0, shared by all copies.
+  std::shared_ptr<const Meshlets> meshlets;
 
- private:
-  Buffer proj_buffer;
-  void* proj_buffer_ptr;
+  // Object space bounds of all vertices.
+  AABB bounds;
+  Sphere sphere;
 
-  DescriptorSet desc_set;
+  // Binds the vertex and index buffer and pushes the decode parameters. The
+  // bound pipeline has to match vertex_format.
+  void bind(vk::CommandBuffer& cmd_buffer,
+            const vk::PipelineLayout& pipe_layout);
 
-  static DescriptorSetInfo get_descriptor_set_info() {
-    vk::DescriptorSetLayoutBinding model_mat_binding;
-    model_mat_binding.binding = 0;
-    model_mat_binding.setStageFlags(vk::ShaderStageFlagBits::eVertex);
-    model_mat_binding.descriptorType = vk::DescriptorType::eUniformBuffer;
-    model_mat_binding.descriptorCount = 1;
-
-    std::vector<vk::DescriptorSetLayoutBinding> bindings{model_mat_binding};
-
-    return DescriptorSetInfo(vk::DescriptorSetLayoutCreateInfo(), bindings);
-  }
-
-  void create_projection_buffer() {
-    proj_buffer = VulkanLayer::get_instance().create_buffer(
-        sizeof(MeshProjectionData), vk::BufferUsageFlagBits::eUniformBuffer);
-    proj_buffer.map(proj_buffer_ptr);
+  // Draws instance_count instances whose transforms start at first_object in
+  // the frame's ObjectBuffer, it is passed as firstInstance.
+  void record_draw(vk::CommandBuffer& cmd_buffer,
+                   const vk::PipelineLayout& pipe_layout,
+                   uint32_t first_object, uint32_t instance_count = 1,
+                   uint32_t lod = 0);
+
+  static vk::PushConstantRange get_push_constant_range() {
+    return vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex,
+                                 push_constant_offset,
+                                 sizeof(MeshPushConstants));
   }
 
-  void create_descriptor_set() {
-    auto set_layout_info = get_descriptor_set_info();
+  // Sets the vertex input state of desc for meshes in format.
+  static void describe_vertex_input(VertexFormat format,
+                                    GraphicsPipelineDesc& desc);
 
-    desc_set =
-        VulkanLayer::get_instance().allocate_descriptor_set(set_layout_info);
-
-    vk::DescriptorBufferInfo proj_buffer_info;
-    proj_buffer_info.buffer = proj_buffer.buffer;
-    proj_buffer_info.range = VK_WHOLE_SIZE;
-
-    std::vector<vk::WriteDescriptorSet> writes(1);
-    writes[0].dstSet = desc_set.set;
-    writes[0].dstBinding = 0;
-    writes[0].descriptorType = vk::DescriptorType::eUniformBuffer;
-    writes[0].dstArrayElement = 0;
-    writes[0].descriptorCount = 1;
-    writes[0].pBufferInfo = &proj_buffer_info;
+  // Loads an OBJ file and builds its LOD chain and meshlets. The result is
+  // cached next to it in a MeshCache and mapped directly on later loads.
+  static Mesh load(const std::string& filepath);
 
-    VulkanLayer::get_instance().device.updateDescriptorSets(writes, {});
-  }
-};
\ No newline at end of file
+  // Copies vertex and index data packed by VertexPacker into new GPU
+  // buffers. index_data holds the indices of all lods.
+  static Mesh create(VertexFormat vertex_format, const uint8_t* vertex_data,
+                     size_t vertex_count, const uint8_t* index_data,
+                     size_t index_count, const AABB& bounds,
+                     const Sphere& sphere,
+                     const std::vector<MeshLod>& lods,
+                     const std::vector<Meshlet>& meshlets);
+};
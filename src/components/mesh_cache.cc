@@ -0,0 +1,198 @@
+#include "mesh_cache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+
+static constexpr char mesh_cache_magic[4] = {'V', 'K', 'M', 'C'};
+static constexpr uint64_t mesh_cache_alignment = 16;
+
+static uint64_t align_up(uint64_t value) {
+  return (value + mesh_cache_alignment - 1) & ~(mesh_cache_alignment - 1);
+}
+
+// Whether count elements of stride bytes at offset lie within size bytes.
+// Divides instead of multiplying, so huge values cannot wrap around.
+static bool range_fits(uint64_t offset, uint64_t count, uint64_t stride,
+                       uint64_t size) {
+  return offset <= size && count <= (size - offset) / stride;
+}
+
+template <typename Index>
+static bool indices_valid(const char* data, uint64_t index_count,
+                          uint64_t vertex_count) {
+  auto indices = reinterpret_cast<const Index*>(data);
+  return std::all_of(indices, indices + index_count,
+                     [&](Index index) { return index < vertex_count; });
+}
+
+bool MeshCache::SourceStamp::read(const std::string& path) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    return false;
+  }
+  size = file_stat.st_size;
+  mtime = int64_t(file_stat.st_mtim.tv_sec) * 1000000000 +
+          file_stat.st_mtim.tv_nsec;
+  return true;
+}
+
+bool MeshCache::open(const std::string& path) {
+  header = nullptr;
+  if (!file.open(path) || file.size() < sizeof(MeshCacheHeader)) {
+    return false;
+  }
+
+  auto candidate = reinterpret_cast<const MeshCacheHeader*>(file.data());
+  if (std::memcmp(candidate->magic, mesh_cache_magic, 4) != 0 ||
+      candidate->version != version ||
+      (candidate->vertex_format != VertexFormat::eFloat &&
+       candidate->vertex_format != VertexFormat::ePacked) ||
+      candidate->vertex_stride !=
+          VertexPacker::vertex_stride(candidate->vertex_format) ||
+      candidate->index_stride !=
+          VertexPacker::index_stride(candidate->vertex_count)) {
+    return false;
+  }
+
+  // The mapping is page aligned, so aligned offsets give aligned pointers.
+  if (!range_fits(candidate->vertex_offset, candidate->vertex_count,
+                  candidate->vertex_stride, file.size()) ||
+      !range_fits(candidate->index_offset, candidate->index_count,
+                  candidate->index_stride, file.size()) ||
+      !range_fits(candidate->meshlet_offset, candidate->meshlet_count,
+                  sizeof(Meshlet), file.size()) ||
+      candidate->index_offset % candidate->index_stride != 0 ||
+      candidate->meshlet_offset % alignof(Meshlet) != 0 ||
+      candidate->lod_count == 0 ||
+      candidate->lod_count > MeshSimplifier::max_lods) {
+    return false;
+  }
+  for (uint32_t i = 0; i < candidate->lod_count; i++) {
+    const auto& lod = candidate->lods[i];
+    if (uint64_t(lod.first_index) + lod.index_count >
+        candidate->index_count) {
+      return false;
+    }
+  }
+  auto meshlets = reinterpret_cast<const Meshlet*>(
+      file.data() + candidate->meshlet_offset);
+  for (uint64_t i = 0; i < candidate->meshlet_count; i++) {
+    if (uint64_t(meshlets[i].first_index) +
+            uint64_t(meshlets[i].triangle_count) * 3 >
+        candidate->lods[0].index_count) {
+      return false;
+    }
+  }
+
+  // An index past the vertices would make the GPU read out of bounds.
+  const char* index_data = file.data() + candidate->index_offset;
+  bool indices_ok =
+      candidate->index_stride == sizeof(uint16_t)
+          ? indices_valid<uint16_t>(index_data, candidate->index_count,
+                                    candidate->vertex_count)
+          : indices_valid<uint32_t>(index_data, candidate->index_count,
+                                    candidate->vertex_count);
+  if (!indices_ok) {
+    return false;
+  }
+
+  header = candidate;
+  return true;
+}
+
+bool MeshCache::restamp(const std::string& path, const SourceStamp& stamp) {
+  std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+  if (!file.is_open()) {
+    return false;
+  }
+  file.seekp(offsetof(MeshCacheHeader, source_size));
+  file.write(reinterpret_cast<const char*>(&stamp.size), sizeof(stamp.size));
+  file.write(reinterpret_cast<const char*>(&stamp.mtime),
+             sizeof(stamp.mtime));
+  return file.good();
+}
+
+bool MeshCache::write(const std::string& path, const SourceStamp& stamp,
+                      uint64_t source_hash,
+                      VertexFormat vertex_format,
+                      const std::vector<uint8_t>& vertex_data,
+                      size_t vertex_count,
+                      const std::vector<uint8_t>& index_data,
+                      size_t index_count, const AABB& bounds,
+                      const Sphere& sphere,
+                      const std::vector<MeshLod>& lods,
+                      const std::vector<Meshlet>& meshlets) {
+  if (lods.empty() || lods.size() > MeshSimplifier::max_lods) {
+    return false;
+  }
+
+  MeshCacheHeader header{};
+  std::memcpy(header.magic, mesh_cache_magic, 4);
+  header.version = version;
+  header.source_hash = source_hash;
+  header.source_size = stamp.size;
+  header.source_mtime = stamp.mtime;
+  header.vertex_count = vertex_count;
+  header.index_count = index_count;
+  header.vertex_format = vertex_format;
+  header.vertex_stride = VertexPacker::vertex_stride(vertex_format);
+  header.index_stride = VertexPacker::index_stride(vertex_count);
+  header.bounds_min = bounds.min;
+  header.bounds_max = bounds.max;
+  header.sphere_center = sphere.center;
+  header.sphere_radius = sphere.radius;
+  header.lod_count = lods.size();
+  std::copy(lods.begin(), lods.end(), header.lods);
+  header.meshlet_count = meshlets.size();
+  header.vertex_offset = align_up(sizeof(MeshCacheHeader));
+  header.index_offset = align_up(header.vertex_offset + vertex_data.size());
+  header.meshlet_offset = align_up(header.index_offset + index_data.size());
+
+  // Written next to the final path and renamed, so a crash never leaves a
+  // truncated cache behind.
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+
+    const char padding[mesh_cache_alignment] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(padding, header.vertex_offset - sizeof(header));
+    out.write(reinterpret_cast<const char*>(vertex_data.data()),
+              vertex_data.size());
+    out.write(padding, header.index_offset - header.vertex_offset -
+                           vertex_data.size());
+    out.write(reinterpret_cast<const char*>(index_data.data()),
+              index_data.size());
+    out.write(padding,
+              header.meshlet_offset - header.index_offset - index_data.size());
+    out.write(reinterpret_cast<const char*>(meshlets.data()),
+              meshlets.size() * sizeof(Meshlet));
+    if (!out.good()) {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+const uint8_t* MeshCache::vertex_data() const {
+  return reinterpret_cast<const uint8_t*>(file.data() + header->vertex_offset);
+}
+
+const uint8_t* MeshCache::index_data() const {
+  return reinterpret_cast<const uint8_t*>(file.data() + header->index_offset);
+}
+
+std::vector<Meshlet> MeshCache::meshlets() const {
+  auto first = reinterpret_cast<const Meshlet*>(file.data() +
+                                                header->meshlet_offset);
+  return {first, first + header->meshlet_count};
+}
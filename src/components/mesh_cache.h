@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bounds.h"
+#include "mapped_file.h"
+#include "mesh_simplifier.h"
+#include "meshlets.h"
+#include "vertex.h"
+#include "vertex_packer.h"
+
+// On disk layout of a compiled mesh. The vertex and index blobs follow the
+// header at vertex_offset/index_offset and are in their final GPU layout:
+// vertex_format and 16 or 32 bit indices as chosen by VertexPacker.
+// The indices of all levels of detail are stored back to back, followed by
+// the meshlets of level 0 at meshlet_offset.
+struct MeshCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_hash;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t vertex_count;
+  uint64_t index_count;
+  VertexFormat vertex_format;
+  uint32_t vertex_stride;
+  uint32_t index_stride;
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  glm::vec3 sphere_center;
+  float sphere_radius;
+  uint32_t lod_count;
+  MeshLod lods[MeshSimplifier::max_lods];
+  uint64_t meshlet_count;
+  uint64_t vertex_offset;
+  uint64_t index_offset;
+  uint64_t meshlet_offset;
+};
+
+// Compiled, memory mapped form of a mesh so that later loads skip OBJ
+// parsing and optimization entirely.
+//
+// A cache belongs to the source whose size and modification time it
+// stores, so an unchanged source is never read. If those differ the
+// content hash decides, e.g. after a fresh checkout touched every file.
+class MeshCache {
+ public:
+  // Size and modification time of a source file, in nanoseconds.
+  struct SourceStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    // Returns false if the file does not exist.
+    bool read(const std::string& path);
+    bool operator==(const SourceStamp& other) const = default;
+  };
+
+  // Bump whenever Vertex, ObjParser or the output of MeshOptimizer,
+  // MeshSimplifier, Meshlets or VertexPacker changes.
+  static constexpr uint32_t version = 9;
+
+  static std::string cache_path(const std::string& source_path) {
+    return source_path + ".meshcache";
+  }
+
+  // Maps the cache file. Returns false if it is missing, truncated, written
+  // by another version or if its ranges or indices point outside of the
+  // file or the vertices. Which source it was compiled from is left to
+  // source_stamp() and source_hash().
+  bool open(const std::string& path);
+
+  // Stores stamp in the header of the cache at path, once the content hash
+  // showed that the source did not change.
+  static bool restamp(const std::string& path, const SourceStamp& stamp);
+
+  // vertex_data and index_data are packed by VertexPacker.
+  static bool write(const std::string& path, const SourceStamp& stamp,
+                    uint64_t source_hash,
+                    VertexFormat vertex_format,
+                    const std::vector<uint8_t>& vertex_data,
+                    size_t vertex_count, const std::vector<uint8_t>& index_data,
+                    size_t index_count, const AABB& bounds,
+                    const Sphere& sphere, const std::vector<MeshLod>& lods,
+                    const std::vector<Meshlet>& meshlets);
+
+  SourceStamp source_stamp() const {
+    return {header->source_size, header->source_mtime};
+  }
+  uint64_t source_hash() const { return header->source_hash; }
+  const uint8_t* vertex_data() const;
+  const uint8_t* index_data() const;
+  VertexFormat vertex_format() const { return header->vertex_format; }
+  size_t vertex_count() const { return header->vertex_count; }
+  size_t index_count() const { return header->index_count; }
+  AABB bounds() const { return {header->bounds_min, header->bounds_max}; }
+  Sphere sphere() const {
+    return {header->sphere_center, header->sphere_radius};
+  }
+  std::vector<MeshLod> lods() const {
+    return {header->lods, header->lods + header->lod_count};
+  }
+  std::vector<Meshlet> meshlets() const;
+
+ private:
+  MappedFile file;
+  const MeshCacheHeader* header = nullptr;
+};
@@ -0,0 +1,395 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+static_assert(sizeof(Vertex) == 8 * sizeof(float),
+              "Vertex is hashed and compared bytewise, it must not be padded");
+
+size_t MeshOptimizer::VertexHash::operator()(const Vertex& vertex) const {
+  // FNV-1a over the raw bytes.
+  const auto* bytes = reinterpret_cast<const unsigned char*>(&vertex);
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < sizeof(Vertex); i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool MeshOptimizer::VertexEqual::operator()(const Vertex& a,
+                                            const Vertex& b) const {
+  return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+}
+
+void MeshOptimizer::Welder::add(const Vertex* corners, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    auto [it, inserted] = unique_ids.try_emplace(corners[i], vertices.size());
+    if (inserted) {
+      vertices.push_back(corners[i]);
+    }
+    indices.push_back(it->second);
+  }
+  corner_count += count;
+}
+
+// FIFO cache simulation through timestamps: a vertex is cached while less
+// than cache_size misses happened since its own miss.
+class CacheSimulation {
+ public:
+  CacheSimulation(size_t vertex_count) : cache_time(vertex_count, 0) {}
+
+  uint32_t access(uint32_t vertex) {
+    if (timestamp - cache_time[vertex] > MeshOptimizer::cache_size) {
+      cache_time[vertex] = timestamp++;
+      return 1;
+    }
+    return 0;
+  }
+
+  uint32_t access_triangle(const uint32_t* triangle) {
+    return access(triangle[0]) + access(triangle[1]) + access(triangle[2]);
+  }
+
+  void reset() { timestamp += MeshOptimizer::cache_size + 1; }
+
+ private:
+  std::vector<uint32_t> cache_time;
+  uint32_t timestamp = MeshOptimizer::cache_size + 1;
+};
+
+MeshOptimizer::Statistics MeshOptimizer::optimize(
+    std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+  Statistics stats;
+  stats.vertices_before = vertices.size();
+  stats.acmr_before = compute_acmr(indices, vertices.size());
+
+  weld_vertices(vertices, indices);
+  stats.acmr_welded = compute_acmr(indices, vertices.size());
+
+  optimize_vertex_cache(indices, vertices.size());
+  optimize_overdraw(indices, vertices);
+  optimize_vertex_fetch(vertices, indices);
+
+  stats.vertices_after = vertices.size();
+  stats.acmr_after = compute_acmr(indices, vertices.size());
+  return stats;
+}
+
+MeshOptimizer::Statistics MeshOptimizer::optimize(
+    Welder& welder, const std::vector<IndexRange>& ranges) {
+  auto& vertices = welder.vertices;
+  auto& indices = welder.indices;
+
+  Statistics stats;
+  stats.vertices_before = welder.corner_count;
+  // Unwelded corners are never reused, every one of them is a miss.
+  stats.acmr_before = welder.corner_count > 0 ? 3.f : 0.f;
+  stats.acmr_welded = compute_acmr(indices, vertices.size());
+
+  optimize_ranges(indices, vertices, ranges);
+  optimize_vertex_fetch(vertices, indices);
+
+  stats.vertices_after = vertices.size();
+  stats.acmr_after = compute_acmr(indices, vertices.size());
+  return stats;
+}
+
+void MeshOptimizer::weld_vertices(std::vector<Vertex>& vertices,
+                                  std::vector<uint32_t>& indices) {
+  std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> unique_ids;
+  unique_ids.reserve(vertices.size());
+
+  std::vector<Vertex> unique_vertices;
+  std::vector<uint32_t> remap(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    auto [it, inserted] =
+        unique_ids.try_emplace(vertices[i], unique_vertices.size());
+    if (inserted) {
+      unique_vertices.push_back(vertices[i]);
+    }
+    remap[i] = it->second;
+  }
+
+  for (auto& index : indices) {
+    index = remap[index];
+  }
+  vertices = std::move(unique_vertices);
+}
+
+static int64_t skip_dead_end(const std::vector<uint32_t>& live_triangles,
+                             std::vector<uint32_t>& dead_end_stack,
+                             size_t& cursor) {
+  while (!dead_end_stack.empty()) {
+    uint32_t vertex = dead_end_stack.back();
+    dead_end_stack.pop_back();
+    if (live_triangles[vertex] > 0) {
+      return vertex;
+    }
+  }
+
+  for (; cursor < live_triangles.size(); cursor++) {
+    if (live_triangles[cursor] > 0) {
+      return cursor;
+    }
+  }
+  return -1;
+}
+
+void MeshOptimizer::optimize_vertex_cache(std::vector<uint32_t>& indices,
+                                          size_t vertex_count) {
+  size_t face_count = indices.size() / 3;
+
+  // Vertex to triangle adjacency in CSR layout.
+  std::vector<uint32_t> live_triangles(vertex_count, 0);
+  for (size_t i = 0; i < face_count * 3; i++) {
+    live_triangles[indices[i]]++;
+  }
+
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] = offsets[v] + live_triangles[v];
+  }
+
+  std::vector<uint32_t> adjacency(face_count * 3);
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t face = 0; face < face_count; face++) {
+    for (int k = 0; k < 3; k++) {
+      adjacency[fill[indices[3 * face + k]]++] = face;
+    }
+  }
+
+  std::vector<uint32_t> cache_time(vertex_count, 0);
+  uint32_t timestamp = cache_size + 1;
+
+  std::vector<bool> emitted(face_count, false);
+  std::vector<uint32_t> dead_end_stack;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(face_count * 3);
+
+  size_t cursor = 0;
+  int64_t fanning_vertex =
+      skip_dead_end(live_triangles, dead_end_stack, cursor);
+
+  while (fanning_vertex >= 0) {
+    candidates.clear();
+
+    for (uint32_t a = offsets[fanning_vertex];
+         a < offsets[fanning_vertex + 1]; a++) {
+      uint32_t face = adjacency[a];
+      if (emitted[face]) {
+        continue;
+      }
+      emitted[face] = true;
+
+      for (int k = 0; k < 3; k++) {
+        uint32_t vertex = indices[3 * face + k];
+        result.push_back(vertex);
+        dead_end_stack.push_back(vertex);
+        candidates.push_back(vertex);
+        live_triangles[vertex]--;
+        if (timestamp - cache_time[vertex] > cache_size) {
+          cache_time[vertex] = timestamp++;
+        }
+      }
+    }
+
+    // Prefer the oldest candidate that stays in the cache while its
+    // remaining triangles are fanned.
+    int64_t next_vertex = -1;
+    int64_t best_priority = -1;
+    for (uint32_t vertex : candidates) {
+      if (live_triangles[vertex] == 0) {
+        continue;
+      }
+      int64_t priority = 0;
+      int64_t age = timestamp - cache_time[vertex];
+      if (age + 2 * live_triangles[vertex] <= cache_size) {
+        priority = age;
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        next_vertex = vertex;
+      }
+    }
+
+    if (next_vertex < 0) {
+      next_vertex = skip_dead_end(live_triangles, dead_end_stack, cursor);
+    }
+    fanning_vertex = next_vertex;
+  }
+
+  indices = std::move(result);
+}
+
+void MeshOptimizer::optimize_overdraw(std::vector<uint32_t>& indices,
+                                      const std::vector<Vertex>& vertices) {
+  size_t face_count = indices.size() / 3;
+  if (face_count == 0) {
+    return;
+  }
+
+  // Hard boundaries: triangles that miss with all three vertices start a new
+  // cluster anyway, reordering there costs nothing.
+  std::vector<uint32_t> hard_clusters;
+  CacheSimulation cache(vertices.size());
+  for (size_t face = 0; face < face_count; face++) {
+    if (cache.access_triangle(&indices[3 * face]) == 3 || face == 0) {
+      hard_clusters.push_back(face);
+    }
+  }
+  hard_clusters.push_back(face_count);
+
+  // Soft boundaries: split further wherever the running ACMR already is
+  // within overdraw_threshold of the whole cluster's ACMR. Every cluster is
+  // measured with a cold cache since it may end up anywhere after sorting.
+  std::vector<uint32_t> clusters;
+  for (size_t c = 0; c + 1 < hard_clusters.size(); c++) {
+    uint32_t start = hard_clusters[c];
+    uint32_t end = hard_clusters[c + 1];
+
+    cache.reset();
+    uint32_t cluster_misses = 0;
+    for (uint32_t face = start; face < end; face++) {
+      cluster_misses += cache.access_triangle(&indices[3 * face]);
+    }
+    float cluster_threshold =
+        overdraw_threshold * cluster_misses / float(end - start);
+
+    cache.reset();
+    clusters.push_back(start);
+    uint32_t running_misses = 0;
+    uint32_t running_faces = 0;
+    for (uint32_t face = start; face < end; face++) {
+      running_misses += cache.access_triangle(&indices[3 * face]);
+      running_faces++;
+      if (running_misses <= cluster_threshold * running_faces &&
+          face + 1 < end) {
+        clusters.push_back(face + 1);
+        cache.reset();
+        running_misses = 0;
+        running_faces = 0;
+      }
+    }
+  }
+  clusters.push_back(face_count);
+
+  glm::vec3 mesh_centroid(0.f);
+  for (uint32_t index : indices) {
+    mesh_centroid += vertices[index].position;
+  }
+  mesh_centroid /= float(indices.size());
+
+  // Clusters whose area weighted normal points away from the mesh center
+  // are likely to occlude the rest and get drawn first.
+  size_t cluster_count = clusters.size() - 1;
+  std::vector<float> sort_keys(cluster_count);
+  for (size_t c = 0; c < cluster_count; c++) {
+    glm::vec3 centroid(0.f);
+    glm::vec3 normal(0.f);
+    float area = 0.f;
+    for (uint32_t face = clusters[c]; face < clusters[c + 1]; face++) {
+      const auto& p0 = vertices[indices[3 * face + 0]].position;
+      const auto& p1 = vertices[indices[3 * face + 1]].position;
+      const auto& p2 = vertices[indices[3 * face + 2]].position;
+      glm::vec3 face_normal = glm::cross(p1 - p0, p2 - p0);
+      float face_area = glm::length(face_normal);
+      centroid += (p0 + p1 + p2) * (face_area / 3.f);
+      normal += face_normal;
+      area += face_area;
+    }
+
+    float normal_length = glm::length(normal);
+    if (area > 0.f && normal_length > 0.f) {
+      centroid /= area;
+      sort_keys[c] = glm::dot(centroid - mesh_centroid, normal / normal_length);
+    } else {
+      sort_keys[c] = 0.f;
+    }
+  }
+
+  std::vector<uint32_t> cluster_order(cluster_count);
+  for (size_t c = 0; c < cluster_count; c++) {
+    cluster_order[c] = c;
+  }
+  std::stable_sort(cluster_order.begin(), cluster_order.end(),
+                   [&](uint32_t a, uint32_t b) {
+                     return sort_keys[a] > sort_keys[b];
+                   });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (uint32_t c : cluster_order) {
+    result.insert(result.end(), indices.begin() + 3 * clusters[c],
+                  indices.begin() + 3 * clusters[c + 1]);
+  }
+  indices = std::move(result);
+}
+
+void MeshOptimizer::optimize_ranges(std::vector<uint32_t>& indices,
+                                    const std::vector<Vertex>& vertices,
+                                    const std::vector<IndexRange>& ranges) {
+  // Ranges are small, so each runs on its own compact vertex ids.
+  std::vector<uint32_t> local_ids(vertices.size(), UINT32_MAX);
+  std::vector<uint32_t> global_ids;
+  std::vector<Vertex> local_vertices;
+  std::vector<uint32_t> local_indices;
+  for (const auto& range : ranges) {
+    auto begin = indices.begin() + range.first_index;
+    auto end = begin + range.index_count;
+    global_ids.clear();
+    local_vertices.clear();
+    local_indices.clear();
+    for (auto index = begin; index != end; index++) {
+      uint32_t& local_id = local_ids[*index];
+      if (local_id == UINT32_MAX) {
+        local_id = global_ids.size();
+        global_ids.push_back(*index);
+        local_vertices.push_back(vertices[*index]);
+      }
+      local_indices.push_back(local_id);
+    }
+
+    optimize_vertex_cache(local_indices, local_vertices.size());
+    optimize_overdraw(local_indices, local_vertices);
+
+    for (uint32_t global_id : global_ids) {
+      local_ids[global_id] = UINT32_MAX;
+    }
+    std::transform(local_indices.begin(), local_indices.end(), begin,
+                   [&](uint32_t local_id) { return global_ids[local_id]; });
+  }
+}
+
+void MeshOptimizer::optimize_vertex_fetch(std::vector<Vertex>& vertices,
+                                          std::vector<uint32_t>& indices) {
+  std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+
+  for (auto& index : indices) {
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = reordered.size();
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices = std::move(reordered);
+}
+
+float MeshOptimizer::compute_acmr(const std::vector<uint32_t>& indices,
+                                  size_t vertex_count) {
+  size_t face_count = indices.size() / 3;
+  if (face_count == 0) {
+    return 0.f;
+  }
+
+  CacheSimulation cache(vertex_count);
+  size_t misses = 0;
+  for (size_t face = 0; face < face_count; face++) {
+    misses += cache.access_triangle(&indices[3 * face]);
+  }
+  return misses / float(face_count);
+}
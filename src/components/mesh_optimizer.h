@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "vertex.h"
+
+// Load time optimization of indexed triangle lists. The individual passes
+// follow "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+// (Sander et al. 2007) and expect the order welding, vertex cache, overdraw,
+// vertex fetch.
+class MeshOptimizer {
+ public:
+  // Size of the simulated FIFO post-transform cache.
+  static constexpr uint32_t cache_size = 16;
+
+  // How much ACMR the overdraw pass may give up, 1.05 allows 5% more
+  // vertex shader invocations.
+  static constexpr float overdraw_threshold = 1.05f;
+
+  struct VertexHash {
+    size_t operator()(const Vertex& vertex) const;
+  };
+
+  struct VertexEqual {
+    bool operator()(const Vertex& a, const Vertex& b) const;
+  };
+
+  // Streaming form of weld_vertices: triangle corners can be added in
+  // batches without ever holding the unwelded vertex list.
+  class Welder {
+   public:
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    // Number of corners added so far, i.e. the unwelded vertex count.
+    size_t corner_count = 0;
+
+    void add(const Vertex* corners, size_t count);
+
+   private:
+    std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> unique_ids;
+  };
+
+  // Indices drawn on their own, such as a meshlet.
+  struct IndexRange {
+    uint32_t first_index;
+    uint32_t index_count;
+  };
+
+  struct Statistics {
+    size_t vertices_before = 0;
+    size_t vertices_after = 0;
+    float acmr_before = 0;
+    float acmr_welded = 0;
+    float acmr_after = 0;
+  };
+
+  // Runs all passes and reports vertex counts and ACMR along the way.
+  static Statistics optimize(std::vector<Vertex>& vertices,
+                             std::vector<uint32_t>& indices);
+
+  // Same as above for data that already went through a Welder. The vertex
+  // cache and overdraw passes run within each of ranges, which have to
+  // cover indices, so triangles never leave their range.
+  static Statistics optimize(Welder& welder,
+                             const std::vector<IndexRange>& ranges);
+
+  // Merges bitwise identical vertices and rewrites indices to match.
+  static void weld_vertices(std::vector<Vertex>& vertices,
+                            std::vector<uint32_t>& indices);
+
+  // Tipsify: reorders triangles for post-transform cache hits.
+  static void optimize_vertex_cache(std::vector<uint32_t>& indices,
+                                    size_t vertex_count);
+
+  // Splits the cache optimized order into clusters and sorts them so that
+  // outward facing clusters come first. Has to run after
+  // optimize_vertex_cache.
+  static void optimize_overdraw(std::vector<uint32_t>& indices,
+                                const std::vector<Vertex>& vertices);
+
+  // Both passes above on every range by itself.
+  static void optimize_ranges(std::vector<uint32_t>& indices,
+                              const std::vector<Vertex>& vertices,
+                              const std::vector<IndexRange>& ranges);
+
+  // Orders vertices by first use in indices and drops unreferenced ones.
+  static void optimize_vertex_fetch(std::vector<Vertex>& vertices,
+                                    std::vector<uint32_t>& indices);
+
+  // Average cache miss ratio: transformed vertices per triangle for a FIFO
+  // cache of cache_size entries. 3 is the worst, ~0.5 is the optimum.
+  static float compute_acmr(const std::vector<uint32_t>& indices,
+                            size_t vertex_count);
+};
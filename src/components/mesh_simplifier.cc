@@ -0,0 +1,368 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include "mesh_optimizer.h"
+
+// Symmetric 4x4 matrix of the summed squared distances to a set of planes,
+// weighted by triangle area. weight is the summed area, dividing by it turns
+// the error into a squared distance.
+struct Quadric {
+  double a2 = 0, ab = 0, ac = 0, ad = 0;
+  double b2 = 0, bc = 0, bd = 0;
+  double c2 = 0, cd = 0;
+  double d2 = 0;
+  double weight = 0;
+
+  static Quadric from_plane(const glm::dvec3& n, double d, double weight) {
+    Quadric q;
+    q.a2 = n.x * n.x * weight;
+    q.ab = n.x * n.y * weight;
+    q.ac = n.x * n.z * weight;
+    q.ad = n.x * d * weight;
+    q.b2 = n.y * n.y * weight;
+    q.bc = n.y * n.z * weight;
+    q.bd = n.y * d * weight;
+    q.c2 = n.z * n.z * weight;
+    q.cd = n.z * d * weight;
+    q.d2 = d * d * weight;
+    q.weight = weight;
+    return q;
+  }
+
+  Quadric& operator+=(const Quadric& o) {
+    a2 += o.a2, ab += o.ab, ac += o.ac, ad += o.ad;
+    b2 += o.b2, bc += o.bc, bd += o.bd;
+    c2 += o.c2, cd += o.cd;
+    d2 += o.d2;
+    weight += o.weight;
+    return *this;
+  }
+
+  // Squared distance to the planes at p, averaged by area.
+  double error(const glm::vec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+               b2 * y * y + 2 * bc * y * z + 2 * bd * y + c2 * z * z +
+               2 * cd * z + d2;
+    return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  double cost;
+  uint32_t from;
+  uint32_t to;
+};
+
+// How far a position may move.
+enum PositionKind : uint8_t {
+  eFree,
+  // Its vertices differ in texture coordinates. Moving it off the seam would
+  // tear the texture, so it only collapses onto other seam positions.
+  eSeam,
+  // On an open border, moving it would open holes.
+  eLocked,
+};
+
+// Vertices sharing a position get the id of the first of them. Differing
+// normals do not matter, flat shaded meshes have them everywhere.
+static std::vector<uint32_t> position_ids(const std::vector<Vertex>& vertices,
+                                          std::vector<uint8_t>& kinds) {
+  struct PositionHash {
+    size_t operator()(const glm::vec3& p) const {
+      uint32_t bits[3];
+      std::memcpy(bits, &p, sizeof(bits));
+      return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^
+             (bits[2] * 83492791u);
+    }
+  };
+
+  std::vector<uint32_t> ids(vertices.size());
+  std::unordered_map<glm::vec3, uint32_t, PositionHash> first;
+  for (uint32_t i = 0; i < vertices.size(); i++) {
+    auto [it, inserted] = first.try_emplace(vertices[i].position, i);
+    ids[i] = it->second;
+    if (vertices[i].tex_coord != vertices[it->second].tex_coord) {
+      kinds[it->second] = eSeam;
+    }
+  }
+  return ids;
+}
+
+// Locks both ends of edges used by a single triangle.
+static void lock_borders(const std::vector<uint32_t>& indices,
+                         const std::vector<uint32_t>& positions,
+                         std::vector<uint8_t>& kinds) {
+  std::vector<uint64_t> edges;
+  edges.reserve(indices.size());
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    for (int e = 0; e < 3; e++) {
+      uint64_t a = positions[indices[i + e]];
+      uint64_t b = positions[indices[i + (e + 1) % 3]];
+      edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+
+  for (size_t i = 0; i < edges.size();) {
+    size_t end = i + 1;
+    while (end < edges.size() && edges[end] == edges[i]) {
+      end++;
+    }
+    if (end - i == 1) {
+      kinds[edges[i] >> 32] = eLocked;
+      kinds[edges[i] & 0xffffffff] = eLocked;
+    }
+    i = end;
+  }
+}
+
+static glm::vec3 triangle_normal(const glm::vec3& a, const glm::vec3& b,
+                                 const glm::vec3& c) {
+  return glm::cross(b - a, c - a);
+}
+
+float MeshSimplifier::simplify(const std::vector<Vertex>& vertices,
+                               const std::vector<uint32_t>& indices,
+                               size_t target_index_count,
+                               std::vector<uint32_t>& result) {
+  result = indices;
+  size_t vertex_count = vertices.size();
+
+  // Collapses work on positions, kinds and quadrics are indexed by
+  // position id.
+  std::vector<uint8_t> kinds(vertex_count, eFree);
+  auto positions = position_ids(vertices, kinds);
+  lock_borders(indices, positions, kinds);
+  auto can_collapse = [&](uint32_t from, uint32_t to) {
+    return kinds[from] == eFree || (kinds[from] == eSeam && kinds[to] != eFree);
+  };
+
+  // Vertices at every position, to pick the replacement of a corner whose
+  // position collapsed.
+  std::vector<uint32_t> position_offsets(vertex_count + 1, 0);
+  for (uint32_t position : positions) {
+    position_offsets[position + 1]++;
+  }
+  for (size_t i = 0; i < vertex_count; i++) {
+    position_offsets[i + 1] += position_offsets[i];
+  }
+  std::vector<uint32_t> position_vertices(vertex_count);
+  {
+    auto fill = position_offsets;
+    for (uint32_t i = 0; i < vertex_count; i++) {
+      position_vertices[fill[positions[i]]++] = i;
+    }
+  }
+  auto closest_vertex = [&](uint32_t vertex, uint32_t position) {
+    const Vertex& original = vertices[vertex];
+    uint32_t best = position_vertices[position_offsets[position]];
+    float best_distance = INFINITY;
+    for (uint32_t i = position_offsets[position];
+         i < position_offsets[position + 1]; i++) {
+      const Vertex& candidate = vertices[position_vertices[i]];
+      glm::vec3 normal = candidate.normal - original.normal;
+      glm::vec2 tex_coord = candidate.tex_coord - original.tex_coord;
+      float distance =
+          glm::dot(normal, normal) + glm::dot(tex_coord, tex_coord);
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = position_vertices[i];
+      }
+    }
+    return best;
+  };
+
+  std::vector<Quadric> quadrics(vertex_count);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const glm::vec3& a = vertices[indices[i]].position;
+    glm::vec3 normal = triangle_normal(a, vertices[indices[i + 1]].position,
+                                       vertices[indices[i + 2]].position);
+    double area = glm::length(glm::dvec3(normal));
+    if (area == 0) {
+      continue;
+    }
+    glm::dvec3 n = glm::dvec3(normal) / area;
+    auto quadric = Quadric::from_plane(n, -glm::dot(n, glm::dvec3(a)), area);
+    for (int corner = 0; corner < 3; corner++) {
+      quadrics[positions[indices[i + corner]]] += quadric;
+    }
+  }
+
+  double max_error = 0;
+  std::vector<uint32_t> remap(vertex_count);
+  std::vector<uint8_t> touched(vertex_count);
+  std::vector<uint32_t> triangle_offsets(vertex_count + 1);
+  std::vector<uint32_t> position_triangles;
+  std::vector<uint64_t> edges;
+  std::vector<Collapse> collapses;
+
+  // Every pass collapses the cheapest edges whose neighbourhoods do not
+  // overlap, so the flip test of one collapse is not invalidated by another.
+  while (result.size() > target_index_count) {
+    size_t triangle_count = result.size() / 3;
+
+    std::fill(triangle_offsets.begin(), triangle_offsets.end(), 0);
+    for (uint32_t index : result) {
+      triangle_offsets[positions[index] + 1]++;
+    }
+    for (size_t i = 0; i < vertex_count; i++) {
+      triangle_offsets[i + 1] += triangle_offsets[i];
+    }
+    position_triangles.resize(result.size());
+    {
+      auto fill = triangle_offsets;
+      for (size_t i = 0; i < result.size(); i++) {
+        position_triangles[fill[positions[result[i]]]++] = i / 3;
+      }
+    }
+
+    edges.clear();
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int e = 0; e < 3; e++) {
+        uint64_t a = positions[result[i + e]];
+        uint64_t b = positions[result[i + (e + 1) % 3]];
+        edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    collapses.clear();
+    for (uint64_t edge : edges) {
+      uint32_t a = edge >> 32;
+      uint32_t b = edge & 0xffffffff;
+      Quadric sum = quadrics[a];
+      sum += quadrics[b];
+      if (can_collapse(a, b)) {
+        collapses.push_back({sum.error(vertices[b].position), a, b});
+      }
+      if (can_collapse(b, a)) {
+        collapses.push_back({sum.error(vertices[a].position), b, a});
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse& x, const Collapse& y) {
+                return x.cost < y.cost;
+              });
+
+    auto contains = [&](const uint32_t* triangle, uint32_t position) {
+      return positions[triangle[0]] == position ||
+             positions[triangle[1]] == position ||
+             positions[triangle[2]] == position;
+    };
+
+    auto flips = [&](uint32_t from, uint32_t to) {
+      const glm::vec3& target = vertices[to].position;
+      for (uint32_t t = triangle_offsets[from]; t < triangle_offsets[from + 1];
+           t++) {
+        const uint32_t* triangle = &result[position_triangles[t] * 3];
+        if (contains(triangle, to)) {
+          continue;
+        }
+        glm::vec3 corners[3];
+        for (int c = 0; c < 3; c++) {
+          corners[c] = vertices[triangle[c]].position;
+        }
+        glm::vec3 before = triangle_normal(corners[0], corners[1], corners[2]);
+        for (int c = 0; c < 3; c++) {
+          if (positions[triangle[c]] == from) {
+            corners[c] = target;
+          }
+        }
+        glm::vec3 after = triangle_normal(corners[0], corners[1], corners[2]);
+        if (glm::dot(before, after) <= 0.0f) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    for (uint32_t i = 0; i < vertex_count; i++) {
+      remap[i] = i;
+    }
+    std::fill(touched.begin(), touched.end(), 0);
+    size_t to_remove = triangle_count - target_index_count / 3;
+    size_t removed = 0;
+    size_t collapsed = 0;
+    for (const auto& collapse : collapses) {
+      if (removed >= to_remove) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to] ||
+          flips(collapse.from, collapse.to)) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] += quadrics[collapse.from];
+      max_error = std::max(max_error, collapse.cost);
+      collapsed++;
+      for (uint32_t t = triangle_offsets[collapse.from];
+           t < triangle_offsets[collapse.from + 1]; t++) {
+        const uint32_t* triangle = &result[position_triangles[t] * 3];
+        for (int c = 0; c < 3; c++) {
+          touched[positions[triangle[c]]] = 1;
+        }
+        removed += contains(triangle, collapse.to);
+      }
+    }
+    if (collapsed == 0) {
+      break;
+    }
+
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t corners[3];
+      for (int c = 0; c < 3; c++) {
+        uint32_t vertex = result[i + c];
+        uint32_t position = remap[positions[vertex]];
+        corners[c] = position == positions[vertex]
+                         ? vertex
+                         : closest_vertex(vertex, position);
+      }
+      if (positions[corners[0]] == positions[corners[1]] ||
+          positions[corners[1]] == positions[corners[2]] ||
+          positions[corners[0]] == positions[corners[2]]) {
+        continue;
+      }
+      result[write++] = corners[0];
+      result[write++] = corners[1];
+      result[write++] = corners[2];
+    }
+    result.resize(write);
+  }
+
+  return std::sqrt(max_error);
+}
+
+std::vector<MeshLod> MeshSimplifier::build_lods(
+    const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+  std::vector<MeshLod> lods{
+      {0, static_cast<uint32_t>(indices.size()), 0.0f}};
+  std::vector<uint32_t> previous(indices);
+  std::vector<uint32_t> level;
+  while (lods.size() < max_lods) {
+    size_t target = previous.size() / 6 * 3;
+    if (target < min_lod_triangles * 3) {
+      break;
+    }
+    float error = simplify(vertices, previous, target, level);
+    // Locked seams and borders can keep the mesh from simplifying further.
+    if (level.size() > previous.size() * 3 / 4) {
+      break;
+    }
+
+    MeshOptimizer::optimize_vertex_cache(level, vertices.size());
+    lods.push_back({static_cast<uint32_t>(indices.size()),
+                    static_cast<uint32_t>(level.size()),
+                    std::max(error, lods.back().error)});
+    indices.insert(indices.end(), level.begin(), level.end());
+    previous.swap(level);
+  }
+  return lods;
+}
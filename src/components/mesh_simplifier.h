@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "vertex.h"
+
+// One level of detail: a range of a mesh's index buffer. All levels index
+// the same vertices.
+struct MeshLod {
+  uint32_t first_index;
+  uint32_t index_count;
+  // Largest object space distance the surface moved by when simplifying.
+  float error;
+};
+
+// Load time simplification through edge collapses ordered by the quadric
+// error metric ("Surface Simplification Using Quadric Error Metrics",
+// Garland and Heckbert 1997). Vertices only collapse onto their neighbours,
+// so simplified index lists reuse the original vertex buffer. Vertices on
+// open borders and on attribute seams (one position, several vertices) stay
+// in place to keep the mesh closed.
+class MeshSimplifier {
+ public:
+  static constexpr uint32_t max_lods = 6;
+  // Levels below this are not worth a draw of their own.
+  static constexpr uint32_t min_lod_triangles = 32;
+
+  // Collapses edges until result has at most target_index_count indices or
+  // no collapse is possible any more. Returns the error of the result.
+  static float simplify(const std::vector<Vertex>& vertices,
+                        const std::vector<uint32_t>& indices,
+                        size_t target_index_count,
+                        std::vector<uint32_t>& result);
+
+  // Appends levels with about half the triangles of the one before to
+  // indices, which holds level 0 on entry. Stops at max_lods levels or once
+  // the mesh does not simplify any further. Every level is vertex cache
+  // optimized.
+  static std::vector<MeshLod> build_lods(const std::vector<Vertex>& vertices,
+                                         std::vector<uint32_t>& indices);
+};
@@ -0,0 +1,294 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MESHLETS_X86 1
+#endif
+
+// Clusters whose normals deviate further from the axis than this cosine are
+// almost never back facing as a whole, their cone is not worth testing.
+static constexpr float min_cone_cosine = 0.1f;
+
+// Unit normal of a counter-clockwise triangle, zero if it is degenerate.
+static glm::vec3 triangle_normal(const std::vector<Vertex>& vertices,
+                                 const uint32_t* corners) {
+  const glm::vec3& a = vertices[corners[0]].position;
+  glm::vec3 normal = glm::cross(vertices[corners[1]].position - a,
+                                vertices[corners[2]].position - a);
+  float length = glm::length(normal);
+  return length > 0.0f ? normal / length : normal;
+}
+
+// The cone is built from the winding: counter-clockwise triangles are front
+// facing, like in OBJ files and for the scene pipelines' front_face.
+static void finish_meshlet(const std::vector<Vertex>& vertices,
+                           const uint32_t* indices, Meshlet& meshlet) {
+  const uint32_t* begin = indices + meshlet.first_index;
+  const uint32_t* end = begin + meshlet.triangle_count * 3;
+
+  AABB bounds;
+  for (const uint32_t* i = begin; i != end; i++) {
+    bounds.extend(vertices[*i].position);
+  }
+  meshlet.center = bounds.center();
+  meshlet.radius = 0.0f;
+  for (const uint32_t* i = begin; i != end; i++) {
+    meshlet.radius = std::max(
+        meshlet.radius, glm::length(vertices[*i].position - meshlet.center));
+  }
+
+  std::vector<glm::vec3> normals;
+  glm::vec3 axis(0.0f);
+  for (const uint32_t* i = begin; i != end; i += 3) {
+    glm::vec3 normal = triangle_normal(vertices, i);
+    // Degenerate triangles cover no pixels and face nowhere.
+    if (normal != glm::vec3(0.0f)) {
+      normals.push_back(normal);
+      axis += normal;
+    }
+  }
+
+  meshlet.cone_axis = glm::vec3(0, 0, 1);
+  meshlet.cone_cutoff = 1.0f;
+  float axis_length = glm::length(axis);
+  if (axis_length == 0.0f) {
+    return;
+  }
+  axis /= axis_length;
+  float min_cosine = 1.0f;
+  for (const auto& normal : normals) {
+    min_cosine = std::min(min_cosine, glm::dot(normal, axis));
+  }
+  meshlet.cone_axis = axis;
+  if (min_cosine > min_cone_cosine) {
+    meshlet.cone_cutoff = std::sqrt(1.0f - min_cosine * min_cosine);
+  }
+}
+
+std::vector<Meshlet> Meshlets::build(const std::vector<Vertex>& vertices,
+                                     uint32_t* indices, size_t index_count) {
+  uint32_t triangle_count = index_count / 3;
+
+  // Scans repeat positions with a normal per face, so vertex indices rarely
+  // link neighbouring triangles. Equal positions get one id instead.
+  std::vector<uint32_t> by_position(vertices.size());
+  for (uint32_t i = 0; i < by_position.size(); i++) {
+    by_position[i] = i;
+  }
+  auto position_less = [&](uint32_t a, uint32_t b) {
+    const glm::vec3& p = vertices[a].position;
+    const glm::vec3& q = vertices[b].position;
+    return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+  };
+  std::sort(by_position.begin(), by_position.end(), position_less);
+  std::vector<uint32_t> position_id(vertices.size());
+  uint32_t position_count = 0;
+  for (uint32_t i = 0; i < by_position.size(); i++) {
+    if (i > 0 && position_less(by_position[i - 1], by_position[i])) {
+      position_count++;
+    }
+    position_id[by_position[i]] = position_count;
+  }
+  position_count += !vertices.empty();
+
+  // Triangles around every position, as offsets into one list.
+  std::vector<uint32_t> first_adjacent(position_count + 1, 0);
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    first_adjacent[position_id[indices[i]] + 1]++;
+  }
+  for (uint32_t p = 0; p < position_count; p++) {
+    first_adjacent[p + 1] += first_adjacent[p];
+  }
+  std::vector<uint32_t> adjacent(triangle_count * 3);
+  std::vector<uint32_t> filled(first_adjacent.begin(),
+                               first_adjacent.end() - 1);
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    adjacent[filled[position_id[indices[i]]]++] = i / 3;
+  }
+
+  // Clusters grow breadth first from the earliest free triangle over shared
+  // positions, so they stay compact patches whatever the index order.
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> order;
+  order.reserve(triangle_count);
+  std::vector<char> assigned(triangle_count, 0);
+  // Meshlet that last used every vertex, + 1 so 0 means none.
+  std::vector<uint32_t> used(vertices.size(), 0);
+  std::vector<uint32_t> frontier;
+  uint32_t seed = 0;
+  while (order.size() < triangle_count) {
+    while (assigned[seed]) {
+      seed++;
+    }
+    Meshlet current{};
+    current.first_index = order.size() * 3;
+    uint32_t stamp = meshlets.size() + 1;
+    uint32_t vertex_count = 0;
+    glm::vec3 normal_sum(0.0f);
+    frontier.assign(1, seed);
+    for (size_t next = 0; next < frontier.size() &&
+                          current.triangle_count < max_triangles;
+         next++) {
+      uint32_t triangle = frontier[next];
+      if (assigned[triangle]) {
+        continue;
+      }
+      const uint32_t* corners = indices + triangle * 3;
+      uint32_t new_vertices = 0;
+      for (int c = 0; c < 3; c++) {
+        // Corners repeating within the triangle are counted once.
+        bool repeated = (c > 0 && corners[c] == corners[0]) ||
+                        (c > 1 && corners[c] == corners[1]);
+        if (used[corners[c]] != stamp && !repeated) {
+          new_vertices++;
+        }
+      }
+      // Skipped triangles are left for a later cluster. So are triangles
+      // bending away from the cluster, which would widen its cone.
+      glm::vec3 normal = triangle_normal(vertices, corners);
+      bool bends_away =
+          normal != glm::vec3(0.0f) && normal_sum != glm::vec3(0.0f) &&
+          glm::dot(normal, glm::normalize(normal_sum)) < min_cone_cosine;
+      if (vertex_count + new_vertices > max_vertices || bends_away) {
+        continue;
+      }
+      normal_sum += normal;
+      for (int c = 0; c < 3; c++) {
+        used[corners[c]] = stamp;
+        uint32_t p = position_id[corners[c]];
+        for (uint32_t a = first_adjacent[p]; a < first_adjacent[p + 1]; a++) {
+          if (!assigned[adjacent[a]]) {
+            frontier.push_back(adjacent[a]);
+          }
+        }
+      }
+      vertex_count += new_vertices;
+      assigned[triangle] = 1;
+      order.push_back(triangle);
+      current.triangle_count++;
+    }
+    meshlets.push_back(current);
+  }
+
+  std::vector<uint32_t> reordered(triangle_count * 3);
+  for (uint32_t t = 0; t < triangle_count; t++) {
+    std::copy_n(indices + order[t] * 3, 3, reordered.begin() + t * 3);
+  }
+  std::copy(reordered.begin(), reordered.end(), indices);
+
+  for (auto& meshlet : meshlets) {
+    finish_meshlet(vertices, indices, meshlet);
+  }
+  return meshlets;
+}
+
+Meshlets::Meshlets(const std::vector<Meshlet>& meshlets) {
+  for (const auto& meshlet : meshlets) {
+    center_x.push_back(meshlet.center.x);
+    center_y.push_back(meshlet.center.y);
+    center_z.push_back(meshlet.center.z);
+    radius.push_back(meshlet.radius);
+    axis_x.push_back(meshlet.cone_axis.x);
+    axis_y.push_back(meshlet.cone_axis.y);
+    axis_z.push_back(meshlet.cone_axis.z);
+    cutoff.push_back(meshlet.cone_cutoff);
+    first_indices.push_back(meshlet.first_index);
+    index_counts.push_back(meshlet.triangle_count * 3);
+    cones = cones || meshlet.cone_cutoff < 1.0f;
+  }
+}
+
+void Meshlets::cull(const glm::mat4& to_world, const Frustum& frustum,
+                    const glm::vec3& camera,
+                    std::vector<uint32_t>& visible) const {
+  // A world plane p is transpose(to_world) * p in object space. Normalizing
+  // keeps the distances exact under non-uniform scale.
+  std::array<glm::vec4, 6> planes;
+  glm::mat4 to_world_t = glm::transpose(to_world);
+  for (int p = 0; p < 6; p++) {
+    planes[p] = to_world_t * frustum.planes[p];
+    planes[p] /= glm::length(glm::vec3(planes[p]));
+  }
+  glm::vec3 eye = glm::vec3(glm::inverse(to_world) * glm::vec4(camera, 1));
+
+  // Back facing if the direction from the camera to every point of the
+  // sphere lies within 90 degrees minus the cone's half angle of the axis,
+  // then every normal in the cone points away from the camera.
+  auto visible_scalar = [&](size_t i) {
+    for (const auto& plane : planes) {
+      float distance = plane.x * center_x[i] + plane.y * center_y[i] +
+                       plane.z * center_z[i] + plane.w;
+      if (distance < -radius[i]) {
+        return false;
+      }
+    }
+    glm::vec3 offset(center_x[i] - eye.x, center_y[i] - eye.y,
+                     center_z[i] - eye.z);
+    float along = offset.x * axis_x[i] + offset.y * axis_y[i] +
+                  offset.z * axis_z[i];
+    return along <
+           cutoff[i] * glm::length(offset) + radius[i] * (1.0f + cutoff[i]);
+  };
+
+  size_t count = size();
+  size_t i = 0;
+#if MESHLETS_X86
+  __m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  for (int p = 0; p < 6; p++) {
+    plane_x[p] = _mm_set1_ps(planes[p].x);
+    plane_y[p] = _mm_set1_ps(planes[p].y);
+    plane_z[p] = _mm_set1_ps(planes[p].z);
+    plane_w[p] = _mm_set1_ps(planes[p].w);
+  }
+  __m128 eye_x = _mm_set1_ps(eye.x);
+  __m128 eye_y = _mm_set1_ps(eye.y);
+  __m128 eye_z = _mm_set1_ps(eye.z);
+  __m128 one = _mm_set1_ps(1.0f);
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 cx = _mm_loadu_ps(&center_x[i]);
+    __m128 cy = _mm_loadu_ps(&center_y[i]);
+    __m128 cz = _mm_loadu_ps(&center_z[i]);
+    __m128 r = _mm_loadu_ps(&radius[i]);
+
+    __m128 culled = _mm_setzero_ps();
+    for (int p = 0; p < 6; p++) {
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(plane_x[p], cx), _mm_mul_ps(plane_y[p], cy)),
+          _mm_add_ps(_mm_mul_ps(plane_z[p], cz), plane_w[p]));
+      culled = _mm_or_ps(
+          culled, _mm_cmplt_ps(_mm_add_ps(distance, r), _mm_setzero_ps()));
+    }
+
+    __m128 ox = _mm_sub_ps(cx, eye_x);
+    __m128 oy = _mm_sub_ps(cy, eye_y);
+    __m128 oz = _mm_sub_ps(cz, eye_z);
+    __m128 along = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(ox, _mm_loadu_ps(&axis_x[i])),
+                   _mm_mul_ps(oy, _mm_loadu_ps(&axis_y[i]))),
+        _mm_mul_ps(oz, _mm_loadu_ps(&axis_z[i])));
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)),
+        _mm_mul_ps(oz, oz)));
+    __m128 c = _mm_loadu_ps(&cutoff[i]);
+    __m128 bound = _mm_add_ps(_mm_mul_ps(c, length),
+                              _mm_mul_ps(r, _mm_add_ps(one, c)));
+    culled = _mm_or_ps(culled, _mm_cmpge_ps(along, bound));
+
+    int mask = _mm_movemask_ps(culled);
+    for (int lane = 0; lane < 4; lane++) {
+      if (!(mask & (1 << lane))) {
+        visible.push_back(i + lane);
+      }
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    if (visible_scalar(i)) {
+      visible.push_back(i);
+    }
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "frustum_culler.h"
+#include "vertex.h"
+
+// A cluster of triangles: a range of a mesh's full detail index list with a
+// bounding sphere and a cone around the normals of its triangles, all in
+// object space.
+struct Meshlet {
+  glm::vec3 center;
+  float radius;
+  glm::vec3 cone_axis;
+  // Sine of the cone's half angle. 1 if the normals spread too far apart,
+  // the cluster is never rejected as back facing then.
+  float cone_cutoff;
+  uint32_t first_index;
+  uint32_t triangle_count;
+};
+
+// Meshlets of one mesh, stored as structure of arrays and culled four at a
+// time. Clusters are rejected if their sphere lies outside a frustum plane
+// or if every triangle in them faces away from the camera.
+//
+// The scene pipelines cull back faces, so a cluster whose triangles all face
+// away from the camera would not draw a single pixel.
+class Meshlets {
+ public:
+  static constexpr uint32_t max_vertices = 64;
+  static constexpr uint32_t max_triangles = 124;
+
+  // Groups the triangles of indices into clusters of at most max_vertices
+  // unique vertices and max_triangles triangles, grown over triangles that
+  // share a position. Reorders the triangles so every cluster is a
+  // consecutive range, reordering within a cluster keeps it valid.
+  static std::vector<Meshlet> build(const std::vector<Vertex>& vertices,
+                                    uint32_t* indices, size_t index_count);
+
+  explicit Meshlets(const std::vector<Meshlet>& meshlets);
+
+  size_t size() const { return radius.size(); }
+
+  // False if no cluster has a cone narrow enough to be tested, only the
+  // frustum can reject clusters then.
+  bool has_cones() const { return cones; }
+
+  uint32_t first_index(uint32_t meshlet) const {
+    return first_indices[meshlet];
+  }
+  uint32_t index_count(uint32_t meshlet) const {
+    return index_counts[meshlet];
+  }
+
+  // Appends the meshlets of an instance at to_world that may be visible
+  // from camera (world space) to visible. The test runs in object space.
+  void cull(const glm::mat4& to_world, const Frustum& frustum,
+            const glm::vec3& camera, std::vector<uint32_t>& visible) const;
+
+ private:
+  std::vector<float> center_x, center_y, center_z;
+  std::vector<float> radius;
+  std::vector<float> axis_x, axis_y, axis_z;
+  std::vector<float> cutoff;
+  std::vector<uint32_t> first_indices;
+  std::vector<uint32_t> index_counts;
+  bool cones = false;
+};
@@ -0,0 +1,438 @@
+#include "obj_parser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "../core/thread_pool.h"
+
+struct ObjChunk {
+  const char* begin;
+  const char* end;
+};
+
+struct ObjAttributeCounts {
+  size_t positions = 0;
+  size_t normals = 0;
+  size_t texcoords = 0;
+};
+
+struct ObjAttributes {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec2> texcoords;
+};
+
+enum class ObjLineType { eOther, ePosition, eNormal, eTexcoord, eFace };
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static bool is_digit(char c) { return static_cast<unsigned char>(c - '0') < 10; }
+
+static const char* skip_spaces(const char* cursor, const char* end) {
+  while (cursor < end && is_space(*cursor)) {
+    cursor++;
+  }
+  return cursor;
+}
+
+// Moves cursor behind the line type keyword.
+static ObjLineType classify_line(const char*& cursor, const char* end) {
+  cursor = skip_spaces(cursor, end);
+  if (end - cursor < 2) {
+    return ObjLineType::eOther;
+  }
+  if (cursor[0] == 'v') {
+    if (is_space(cursor[1])) {
+      cursor += 1;
+      return ObjLineType::ePosition;
+    }
+    if (end - cursor >= 3 && is_space(cursor[2])) {
+      if (cursor[1] == 'n') {
+        cursor += 2;
+        return ObjLineType::eNormal;
+      }
+      if (cursor[1] == 't') {
+        cursor += 2;
+        return ObjLineType::eTexcoord;
+      }
+    }
+  } else if (cursor[0] == 'f' && is_space(cursor[1])) {
+    cursor += 1;
+    return ObjLineType::eFace;
+  }
+  return ObjLineType::eOther;
+}
+
+template <typename LineFn>
+static void for_each_line(const ObjChunk& chunk, LineFn&& fn) {
+  const char* cursor = chunk.begin;
+  while (cursor < chunk.end) {
+    // memchr is vectorized in every libc we care about.
+    auto line_end = static_cast<const char*>(
+        std::memchr(cursor, '\n', chunk.end - cursor));
+    if (!line_end) {
+      line_end = chunk.end;
+    }
+    fn(cursor, line_end);
+    cursor = line_end + 1;
+  }
+}
+
+static std::vector<ObjChunk> split_chunks(const char* data, size_t size) {
+  std::vector<ObjChunk> chunks;
+  const char* end = data + size;
+  const char* cursor = data;
+  while (cursor < end) {
+    const char* chunk_end = cursor + std::min(ObjParser::chunk_size,
+                                              size_t(end - cursor));
+    if (chunk_end < end) {
+      auto newline = static_cast<const char*>(
+          std::memchr(chunk_end, '\n', end - chunk_end));
+      chunk_end = newline ? newline + 1 : end;
+    }
+    chunks.push_back({cursor, chunk_end});
+    cursor = chunk_end;
+  }
+  return chunks;
+}
+
+static bool is_eight_digits(uint64_t chars) {
+  return (((chars & 0xF0F0F0F0F0F0F0F0) |
+           (((chars + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+          0x3333333333333333);
+}
+
+// Converts 8 ASCII digits loaded little endian into their value with three
+// multiplications instead of eight.
+static uint32_t parse_eight_digits(uint64_t chars) {
+  const uint64_t mask = 0x000000FF000000FF;
+  const uint64_t mul1 = 0x000F424000000064;  // 100 + (1000000 << 32)
+  const uint64_t mul2 = 0x0000271000000001;  // 1 + (10000 << 32)
+  chars -= 0x3030303030303030;
+  chars = (chars * 10) + (chars >> 8);
+  chars = (((chars & mask) * mul1) + (((chars >> 16) & mask) * mul2)) >> 32;
+  return uint32_t(chars);
+}
+
+static float parse_float_fallback(const char*& cursor, const char* end) {
+  char buffer[64];
+  size_t length = 0;
+  while (cursor + length < end && !is_space(cursor[length]) &&
+         length + 1 < sizeof(buffer)) {
+    buffer[length] = cursor[length];
+    length++;
+  }
+  buffer[length] = '\0';
+
+  char* parsed_end;
+  float value = std::strtof(buffer, &parsed_end);
+  cursor += parsed_end - buffer;
+  return value;
+}
+
+float ObjParser::parse_float(const char*& cursor, const char* end) {
+  static const double powers_of_ten[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  const char* start = cursor;
+  bool negative = false;
+  if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+    negative = *cursor == '-';
+    cursor++;
+  }
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  bool any_digit = false;
+
+  // Up to 19 significant digits fit into the mantissa, further integer
+  // digits only scale it and further fraction digits are dropped.
+  auto consume_digits = [&](bool fraction) {
+    while (end - cursor >= 8 && digits + 8 <= 19) {
+      uint64_t chars;
+      std::memcpy(&chars, cursor, 8);
+      if (!is_eight_digits(chars)) {
+        break;
+      }
+      mantissa = mantissa * 100000000 + parse_eight_digits(chars);
+      cursor += 8;
+      digits += 8;
+      exponent -= fraction ? 8 : 0;
+      any_digit = true;
+    }
+    while (cursor < end && is_digit(*cursor)) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*cursor - '0');
+        digits++;
+        exponent -= fraction ? 1 : 0;
+      } else if (!fraction) {
+        exponent++;
+      }
+      cursor++;
+      any_digit = true;
+    }
+  };
+
+  consume_digits(false);
+  if (cursor < end && *cursor == '.') {
+    cursor++;
+    consume_digits(true);
+  }
+
+  if (!any_digit) {
+    // nan, inf and friends.
+    cursor = start;
+    return parse_float_fallback(cursor, end);
+  }
+
+  if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+    const char* exponent_start = cursor;
+    cursor++;
+    bool negative_exponent = false;
+    if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+      negative_exponent = *cursor == '-';
+      cursor++;
+    }
+    if (cursor < end && is_digit(*cursor)) {
+      int explicit_exponent = 0;
+      while (cursor < end && is_digit(*cursor)) {
+        explicit_exponent =
+            std::min(explicit_exponent * 10 + (*cursor - '0'), 100000);
+        cursor++;
+      }
+      exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    } else {
+      cursor = exponent_start;
+    }
+  }
+
+  // Exact for mantissas below 2^53 and exponents within +-22, everything
+  // else is still far more precise than the float we return.
+  double value = double(mantissa);
+  if (exponent < 0) {
+    value = exponent >= -22 ? value / powers_of_ten[-exponent]
+                            : value * std::pow(10.0, exponent);
+  } else if (exponent > 0) {
+    value = exponent <= 22 ? value * powers_of_ten[exponent]
+                           : value * std::pow(10.0, exponent);
+  }
+  return float(negative ? -value : value);
+}
+
+static int64_t parse_int(const char*& cursor, const char* end) {
+  bool negative = false;
+  if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+    negative = *cursor == '-';
+    cursor++;
+  }
+  int64_t value = 0;
+  while (cursor < end && is_digit(*cursor)) {
+    value = value * 10 + (*cursor - '0');
+    cursor++;
+  }
+  return negative ? -value : value;
+}
+
+// OBJ indices are 1-based, negative ones count back from the attributes
+// defined so far. Returns -1 for absent or invalid references.
+static int64_t resolve_index(int64_t index, size_t defined_so_far) {
+  if (index > 0 && size_t(index) <= defined_so_far) {
+    return index - 1;
+  }
+  if (index < 0 && size_t(-index) <= defined_so_far) {
+    return int64_t(defined_so_far) + index;
+  }
+  return -1;
+}
+
+static ObjAttributeCounts count_attributes(const ObjChunk& chunk) {
+  ObjAttributeCounts counts;
+  for_each_line(chunk, [&](const char* cursor, const char* line_end) {
+    switch (classify_line(cursor, line_end)) {
+      case ObjLineType::ePosition:
+        counts.positions++;
+        break;
+      case ObjLineType::eNormal:
+        counts.normals++;
+        break;
+      case ObjLineType::eTexcoord:
+        counts.texcoords++;
+        break;
+      default:
+        break;
+    }
+  });
+  return counts;
+}
+
+static void parse_attributes(const ObjChunk& chunk, ObjAttributeCounts base,
+                             ObjAttributes& attributes) {
+  for_each_line(chunk, [&](const char* cursor, const char* line_end) {
+    auto type = classify_line(cursor, line_end);
+    if (type == ObjLineType::eOther || type == ObjLineType::eFace) {
+      return;
+    }
+
+    float values[3] = {0.f, 0.f, 0.f};
+    int component_count = type == ObjLineType::eTexcoord ? 2 : 3;
+    for (int i = 0; i < component_count; i++) {
+      cursor = skip_spaces(cursor, line_end);
+      if (cursor < line_end) {
+        values[i] = ObjParser::parse_float(cursor, line_end);
+      }
+    }
+
+    switch (type) {
+      case ObjLineType::ePosition:
+        attributes.positions[base.positions++] = {values[0], values[1],
+                                                  values[2]};
+        break;
+      case ObjLineType::eNormal:
+        attributes.normals[base.normals++] = {values[0], values[1],
+                                              values[2]};
+        break;
+      case ObjLineType::eTexcoord:
+        attributes.texcoords[base.texcoords++] = {values[0], values[1]};
+        break;
+      default:
+        break;
+    }
+  });
+}
+
+struct ObjCorner {
+  int64_t position;
+  int64_t normal;
+  int64_t texcoord;
+};
+
+static void parse_faces(const ObjChunk& chunk, ObjAttributeCounts defined,
+                        const ObjAttributes& attributes,
+                        std::vector<Vertex>& corners) {
+  std::vector<ObjCorner> polygon;
+
+  for_each_line(chunk, [&](const char* cursor, const char* line_end) {
+    switch (classify_line(cursor, line_end)) {
+      case ObjLineType::ePosition:
+        defined.positions++;
+        return;
+      case ObjLineType::eNormal:
+        defined.normals++;
+        return;
+      case ObjLineType::eTexcoord:
+        defined.texcoords++;
+        return;
+      case ObjLineType::eOther:
+        return;
+      case ObjLineType::eFace:
+        break;
+    }
+
+    // v, v/vt, v//vn or v/vt/vn per corner, up to a trailing comment.
+    polygon.clear();
+    while ((cursor = skip_spaces(cursor, line_end)) < line_end &&
+           *cursor != '#') {
+      ObjCorner corner{-1, -1, -1};
+      corner.position =
+          resolve_index(parse_int(cursor, line_end), defined.positions);
+      if (cursor < line_end && *cursor == '/') {
+        cursor++;
+        if (cursor < line_end && *cursor != '/') {
+          corner.texcoord =
+              resolve_index(parse_int(cursor, line_end), defined.texcoords);
+        }
+        if (cursor < line_end && *cursor == '/') {
+          cursor++;
+          corner.normal =
+              resolve_index(parse_int(cursor, line_end), defined.normals);
+        }
+      }
+      if (corner.position < 0) {
+        throw std::runtime_error("OBJ face references an undefined vertex");
+      }
+      while (cursor < line_end && !is_space(*cursor) && *cursor != '#') {
+        cursor++;
+      }
+      polygon.push_back(corner);
+    }
+
+    // Triangle fan, OBJ polygons are convex.
+    for (size_t k = 1; k + 1 < polygon.size(); k++) {
+      const ObjCorner* triangle[3] = {&polygon[0], &polygon[k],
+                                      &polygon[k + 1]};
+
+      const auto& p0 = attributes.positions[triangle[0]->position];
+      const auto& p1 = attributes.positions[triangle[1]->position];
+      const auto& p2 = attributes.positions[triangle[2]->position];
+      glm::vec3 face_normal = glm::cross(p1 - p0, p2 - p0);
+      float face_normal_length = glm::length(face_normal);
+      face_normal = face_normal_length > 0.f ? face_normal / face_normal_length
+                                             : glm::vec3(0.f, 0.f, 1.f);
+
+      for (const ObjCorner* corner : triangle) {
+        Vertex vertex{};
+        vertex.position = attributes.positions[corner->position];
+        vertex.normal = corner->normal >= 0
+                            ? attributes.normals[corner->normal]
+                            : face_normal;
+        if (corner->texcoord >= 0) {
+          const auto& texcoord = attributes.texcoords[corner->texcoord];
+          // Vulkan's image origin is the top left corner.
+          vertex.tex_coord = {texcoord.x, 1.f - texcoord.y};
+        }
+        corners.push_back(vertex);
+      }
+    }
+  });
+}
+
+void ObjParser::parse(const char* data, size_t size, const CornerSink& sink) {
+  auto& pool = ThreadPool::get_instance();
+  auto chunks = split_chunks(data, size);
+
+  std::vector<ObjAttributeCounts> chunk_counts(chunks.size());
+  pool.parallel_for(chunks.size(), [&](size_t i) {
+    chunk_counts[i] = count_attributes(chunks[i]);
+  });
+
+  // Exclusive prefix sums give every chunk its first attribute slots.
+  std::vector<ObjAttributeCounts> chunk_bases(chunks.size());
+  ObjAttributeCounts total;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    chunk_bases[i] = total;
+    total.positions += chunk_counts[i].positions;
+    total.normals += chunk_counts[i].normals;
+    total.texcoords += chunk_counts[i].texcoords;
+  }
+
+  ObjAttributes attributes;
+  attributes.positions.resize(total.positions);
+  attributes.normals.resize(total.normals);
+  attributes.texcoords.resize(total.texcoords);
+  pool.parallel_for(chunks.size(), [&](size_t i) {
+    parse_attributes(chunks[i], chunk_bases[i], attributes);
+  });
+
+  // Faces are resolved in batches of one chunk per thread so that at most
+  // that many chunks of corners are alive at once.
+  size_t batch_size = pool.thread_count() + 1;
+  std::vector<std::vector<Vertex>> batch_corners(batch_size);
+  for (size_t first = 0; first < chunks.size(); first += batch_size) {
+    size_t count = std::min(batch_size, chunks.size() - first);
+    pool.parallel_for(count, [&](size_t i) {
+      batch_corners[i].clear();
+      parse_faces(chunks[first + i], chunk_bases[first + i], attributes,
+                  batch_corners[i]);
+    });
+    for (size_t i = 0; i < count; i++) {
+      sink(batch_corners[i].data(), batch_corners[i].size());
+    }
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+#include "vertex.h"
+
+// Parallel Wavefront OBJ parser for positions, normals, texture coordinates
+// and polygonal faces. Everything else (groups, materials, ...) is skipped.
+//
+// The file is split into line aligned chunks that are parsed on the
+// ThreadPool in three passes: counting attributes, parsing attributes into
+// their final slots and resolving faces. Only the attribute arrays are kept
+// for the whole file, triangulated faces are streamed to the sink chunk by
+// chunk in file order.
+class ObjParser {
+ public:
+  // Target size of a chunk, small files end up in a single chunk.
+  static constexpr size_t chunk_size = size_t(4) << 20;
+
+  // Receives triangle corners, 3 per triangle. Corners without a normal get
+  // the flat face normal, corners without texture coordinates (0, 0).
+  using CornerSink = std::function<void(const Vertex* corners, size_t count)>;
+
+  // Throws std::runtime_error on faces referencing undefined attributes.
+  static void parse(const char* data, size_t size, const CornerSink& sink);
+
+  // Parses a decimal float and advances cursor past it. 8 digit runs are
+  // converted at once (SWAR), uncommon forms fall back to strtod.
+  static float parse_float(const char*& cursor, const char* end);
+};
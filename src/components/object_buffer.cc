@@ -0,0 +1,118 @@
+#include "object_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+ObjectBuffer::ObjectBuffer(uint32_t max_objects)
+    : max_objects{std::max(max_objects, 1u)} {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  auto frames = VulkanLayer::frames_in_flight;
+
+  scene_slice_size = vulkan_layer.pad_uniform_buffer_size(sizeof(SceneData));
+  scene_buffer = vulkan_layer.create_buffer(
+      scene_slice_size * frames, vk::BufferUsageFlagBits::eUniformBuffer);
+  scene_buffer.map(scene_buffer_ptr);
+
+  vk::DeviceSize object_slice_size = sizeof(ObjectData) * this->max_objects;
+  object_buffer = vulkan_layer.create_buffer(
+      object_slice_size * frames, vk::BufferUsageFlagBits::eStorageBuffer);
+  object_buffer.map(object_buffer_ptr);
+
+  command_buffer = vulkan_layer.create_buffer(
+      sizeof(vk::DrawIndexedIndirectCommand) * max_commands * frames,
+      vk::BufferUsageFlagBits::eIndirectBuffer);
+  command_buffer.map(command_buffer_ptr);
+
+  auto set_layout_info = get_descriptor_set_info();
+  for (uint32_t i = 0; i < frames; i++) {
+    sets.push_back(vulkan_layer.allocate_descriptor_set(set_layout_info));
+
+    vk::DescriptorBufferInfo scene_info = scene_buffer_info(i);
+
+    vk::DescriptorBufferInfo object_info;
+    object_info.buffer = object_buffer.buffer;
+    object_info.offset = object_slice_size * i;
+    object_info.range = object_slice_size;
+
+    std::vector<vk::WriteDescriptorSet> writes(2);
+    writes[0].dstSet = sets[i].set;
+    writes[0].dstBinding = 0;
+    writes[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+    writes[0].descriptorCount = 1;
+    writes[0].pBufferInfo = &scene_info;
+    writes[1].dstSet = sets[i].set;
+    writes[1].dstBinding = 1;
+    writes[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+    writes[1].descriptorCount = 1;
+    writes[1].pBufferInfo = &object_info;
+
+    vulkan_layer.device.updateDescriptorSets(writes, {});
+  }
+}
+
+DescriptorSetInfo ObjectBuffer::get_descriptor_set_info() {
+  std::vector<vk::DescriptorSetLayoutBinding> bindings(2);
+  bindings[0].binding = 0;
+  bindings[0].setStageFlags(vk::ShaderStageFlagBits::eVertex);
+  bindings[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+  bindings[0].descriptorCount = 1;
+  bindings[1].binding = 1;
+  bindings[1].setStageFlags(vk::ShaderStageFlagBits::eVertex);
+  bindings[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+  bindings[1].descriptorCount = 1;
+
+  return DescriptorSetInfo(vk::DescriptorSetLayoutCreateInfo(), bindings);
+}
+
+void ObjectBuffer::begin_frame(uint32_t frame_index, const glm::mat4& view,
+                               const glm::mat4& projection) {
+  frame = frame_index;
+  transforms.clear();
+  command_count = 0;
+
+  SceneData scene{
+      .view = view,
+      .projection = projection,
+      .view_projection = projection * view,
+  };
+  std::memcpy(static_cast<char*>(scene_buffer_ptr) + scene_slice_size * frame,
+              &scene, sizeof(SceneData));
+
+  objects = reinterpret_cast<ObjectData*>(
+      static_cast<char*>(object_buffer_ptr) +
+      sizeof(ObjectData) * max_objects * frame);
+}
+
+uint32_t ObjectBuffer::push(const glm::mat4& to_world) {
+  if (transforms.size() == max_objects) {
+    throw std::runtime_error("object buffer is full!");
+  }
+  return transforms.add(to_world);
+}
+
+vk::DeviceSize ObjectBuffer::push_command(
+    const vk::DrawIndexedIndirectCommand& command) {
+  if (command_count == max_commands) {
+    throw std::runtime_error("indirect command buffer is full!");
+  }
+  vk::DeviceSize offset =
+      sizeof(vk::DrawIndexedIndirectCommand) *
+      (uint64_t(max_commands) * frame + command_count++);
+  std::memcpy(static_cast<char*>(command_buffer_ptr) + offset, &command,
+              sizeof(command));
+  return offset;
+}
+
+void ObjectBuffer::end_frame() {
+  transforms.compute(objects);
+  scene_buffer.flush();
+  object_buffer.flush();
+  command_buffer.flush();
+}
+
+void ObjectBuffer::bind(vk::CommandBuffer& cmd_buffer,
+                        const vk::PipelineLayout& pipe_layout,
+                        uint32_t set_index) {
+  cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipe_layout,
+                                set_index, 1, &sets[frame].set, 0, nullptr);
+}
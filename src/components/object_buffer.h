@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "../vulkan_layer/vulkan_layer.h"
+#include "transform_batch.h"
+
+// std140/std430 layout of the per-frame scene uniforms.
+struct SceneData {
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 view_projection;
+};
+
+// Transforms of every object drawn in a frame, written contiguously into one
+// storage buffer. Draws select their object through firstInstance, so a
+// frame binds set 0 once instead of once per object. Pushed transforms are
+// collected in a TransformBatch and expanded in bulk by end_frame().
+// Indirect draw commands written on the CPU go to a third buffer.
+//
+// All buffers hold one slice per frame in flight and every frame has its own
+// descriptor set pointing at its slice.
+class ObjectBuffer {
+ public:
+  static constexpr uint32_t max_commands = 1 << 16;
+
+  // Every frame has room for max_objects transforms, at least the number of
+  // objects in the scene.
+  explicit ObjectBuffer(uint32_t max_objects);
+
+  // Starts filling the slice of frame_index. The frame's fence must have
+  // been waited on.
+  void begin_frame(uint32_t frame_index, const glm::mat4& view,
+                   const glm::mat4& projection);
+
+  // Returns the index to pass as firstInstance.
+  uint32_t push(const glm::mat4& to_world);
+
+  // Returns the offset of the command in indirect_buffer().
+  vk::DeviceSize push_command(const vk::DrawIndexedIndirectCommand& command);
+
+  vk::Buffer indirect_buffer() const { return command_buffer.buffer; }
+
+  uint32_t free_commands() const { return max_commands - command_count; }
+
+  // Computes the ObjectData of every pushed transform and flushes the
+  // frame's writes, call before submitting.
+  void end_frame();
+
+  void bind(vk::CommandBuffer& cmd_buffer,
+            const vk::PipelineLayout& pipe_layout, uint32_t set_index);
+
+  // Objects pushed since begin_frame.
+  uint32_t object_count() const { return transforms.size(); }
+
+  // Slice of the scene uniforms written for frame_index.
+  vk::DescriptorBufferInfo scene_buffer_info(uint32_t frame_index) const {
+    return vk::DescriptorBufferInfo(scene_buffer.buffer,
+                                    scene_slice_size * frame_index,
+                                    sizeof(SceneData));
+  }
+
+  static DescriptorSetInfo get_descriptor_set_info();
+
+  static vk::DescriptorSetLayout get_descriptor_set_layout() {
+    return VulkanLayer::get_instance().create_descriptor_set_layout(
+        get_descriptor_set_info());
+  }
+
+ private:
+  Buffer scene_buffer;
+  void* scene_buffer_ptr;
+  vk::DeviceSize scene_slice_size;
+
+  uint32_t max_objects;
+  Buffer object_buffer;
+  void* object_buffer_ptr;
+
+  Buffer command_buffer;
+  void* command_buffer_ptr;
+  uint32_t command_count = 0;
+
+  std::vector<DescriptorSet> sets;
+
+  uint32_t frame = 0;
+  TransformBatch transforms;
+  ObjectData* objects = nullptr;
+};
@@ -0,0 +1,58 @@
+#include "render_queue.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+uint64_t RenderQueue::make_key(uint32_t pipeline, uint32_t material,
+                               uint32_t mesh, uint32_t lod, float depth) {
+  if (pipeline >> pipeline_bits || material >> material_bits ||
+      mesh >> mesh_bits || lod >> lod_bits) {
+    throw std::runtime_error("draw state does not fit into a sort key!");
+  }
+
+  // Positive floats order like their bit patterns, the top bits keep the
+  // exponent and the leading mantissa bits. The sign bit is 0 for them.
+  uint32_t depth_bits_value = 0;
+  if (depth > 0.0f) {
+    std::memcpy(&depth_bits_value, &depth, sizeof(float));
+  }
+  uint64_t quantized_depth = depth_bits_value >> (31 - depth_bits);
+
+  uint64_t key = pipeline;
+  key = (key << material_bits) | material;
+  key = (key << mesh_bits) | mesh;
+  key = (key << lod_bits) | lod;
+  key = (key << depth_bits) | quantized_depth;
+  return key;
+}
+
+void RenderQueue::sort() {
+  constexpr uint32_t digit_count = sizeof(uint64_t);
+  std::array<std::array<uint32_t, 256>, digit_count> counts{};
+  for (const auto& entry : items) {
+    for (uint32_t digit = 0; digit < digit_count; digit++) {
+      counts[digit][(entry.key >> (digit * 8)) & 0xff]++;
+    }
+  }
+
+  scratch.resize(items.size());
+  for (uint32_t digit = 0; digit < digit_count; digit++) {
+    auto& count = counts[digit];
+    if (items.empty() ||
+        count[(items[0].key >> (digit * 8)) & 0xff] == items.size()) {
+      continue;
+    }
+
+    std::array<uint32_t, 256> offsets;
+    uint32_t offset = 0;
+    for (uint32_t value = 0; value < 256; value++) {
+      offsets[value] = offset;
+      offset += count[value];
+    }
+    for (const auto& entry : items) {
+      scratch[offsets[(entry.key >> (digit * 8)) & 0xff]++] = entry;
+    }
+    items.swap(scratch);
+  }
+}
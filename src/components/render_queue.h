@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Draws of a frame tagged with 64 bit sort keys. From the most significant
+// bits down a key holds the pipeline, the material, the mesh, its level of
+// detail and the quantized view depth, so sorting groups draws by the state
+// they need, most expensive change first, and orders each group front to
+// back.
+class RenderQueue {
+ public:
+  static constexpr uint32_t pipeline_bits = 8;
+  static constexpr uint32_t material_bits = 12;
+  static constexpr uint32_t mesh_bits = 17;
+  static constexpr uint32_t lod_bits = 3;
+  static constexpr uint32_t depth_bits = 24;
+  static_assert(pipeline_bits + material_bits + mesh_bits + lod_bits +
+                    depth_bits ==
+                64);
+
+  struct Entry {
+    uint64_t key;
+    // Up to the owner of the queue, usually an index into its draws.
+    uint32_t payload;
+  };
+
+  // Throws if an id does not fit into its bits. Negative depths count as 0.
+  static uint64_t make_key(uint32_t pipeline, uint32_t material,
+                           uint32_t mesh, uint32_t lod, float depth);
+
+  // Equal for draws that can share all bound state.
+  static uint64_t state(uint64_t key) { return key >> depth_bits; }
+
+  void push(uint64_t key, uint32_t payload) {
+    items.push_back({key, payload});
+  }
+
+  // Stable radix sort by key, 8 bits per pass. Passes over bits that are
+  // equal in all keys are skipped.
+  void sort();
+
+  void clear() { items.clear(); }
+  size_t size() const { return items.size(); }
+  const std::vector<Entry>& entries() const { return items; }
+
+ private:
+  std::vector<Entry> items;
+  std::vector<Entry> scratch;
+};
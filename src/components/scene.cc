@@ -0,0 +1,189 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "../core/thread_pool.h"
+
+// Objects per job when splitting work over the ThreadPool.
+static constexpr size_t objects_per_job = 1024;
+
+uint32_t Scene::add_mesh(const Mesh& mesh) {
+  meshes.push_back(mesh);
+  return meshes.size() - 1;
+}
+
+uint32_t Scene::add_material(const Material& material) {
+  materials.push_back(material);
+  return materials.size() - 1;
+}
+
+uint32_t Scene::add_renderable(uint32_t entity, uint32_t mesh,
+                               uint32_t material) {
+  entity_objects.resize(transforms.size(), no_object);
+  if (entity_objects[entity] != no_object) {
+    throw std::runtime_error("entity already has a renderable!");
+  }
+
+  uint32_t object = size();
+  entity_objects[entity] = object;
+  object_entities.push_back(entity);
+  object_meshes.push_back(mesh);
+  object_materials.push_back(material);
+  world_bounds.push_back(
+      meshes[mesh].bounds.transformed(transforms.world(entity)));
+
+  // The world matrix may be stale if the entity is new, marking it dirty
+  // makes update() recompute the bounds.
+  transforms.set_local(entity, transforms.local(entity));
+  needs_build = true;
+  return object;
+}
+
+void Scene::rebuild() {
+  bvh.build(world_bounds);
+  built_cost = bvh.cost();
+  needs_build = false;
+  refits_since_check = 0;
+  rebuild_count++;
+}
+
+void Scene::update() {
+  transforms.update();
+  entity_objects.resize(transforms.size(), no_object);
+
+  changed.clear();
+  for (uint32_t entity : transforms.changed()) {
+    uint32_t object = entity_objects[entity];
+    if (object != no_object) {
+      changed.push_back(object);
+    }
+  }
+
+  // Every changed object writes only its own bounds, the refits walk shared
+  // nodes and stay serial.
+  auto transform_bounds = [this](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      uint32_t object = changed[i];
+      world_bounds[object] = mesh(object).bounds.transformed(to_world(object));
+    }
+  };
+  if (changed.size() < parallel_threshold) {
+    transform_bounds(0, changed.size());
+  } else {
+    size_t jobs = (changed.size() + objects_per_job - 1) / objects_per_job;
+    ThreadPool::get_instance().parallel_for(jobs, [&](size_t job) {
+      transform_bounds(job * objects_per_job,
+                       std::min(changed.size(), (job + 1) * objects_per_job));
+    });
+  }
+  if (!needs_build) {
+    for (uint32_t object : changed) {
+      bvh.refit(object, world_bounds[object]);
+    }
+  }
+  refits_since_check += changed.size();
+
+  // Computing the cost walks every node, so it is only checked after a
+  // number of refits proportional to the scene size.
+  if (!needs_build &&
+      refits_since_check >= std::max<size_t>(64, size() / 4)) {
+    refits_since_check = 0;
+    needs_build = bvh.cost() > rebuild_cost_factor * built_cost;
+  }
+
+  if (needs_build) {
+    rebuild();
+  }
+}
+
+void Scene::cull_subtree(const Frustum& frustum, uint32_t root,
+                         CullJob& job) {
+  job.culler.clear();
+  job.candidates.clear();
+  job.visible.clear();
+  bvh.traverse([&](const AABB& box) { return frustum.classify(box); },
+               [&](uint32_t object, bool inside) {
+                 if (inside) {
+                   job.visible.push_back(object);
+                   return;
+                 }
+                 const auto& object_mesh = mesh(object);
+                 job.culler.add(object_mesh.bounds, object_mesh.sphere,
+                                to_world(object));
+                 job.candidates.push_back(object);
+               },
+               root);
+
+  job.culler.cull(frustum);
+  for (uint32_t i = 0; i < job.candidates.size(); i++) {
+    if (job.culler.visible(i)) {
+      job.visible.push_back(job.candidates[i]);
+    }
+  }
+}
+
+void Scene::cull(const Frustum& frustum, std::vector<uint32_t>& visible) {
+  size_t first_visible = visible.size();
+  tested_count = 0;
+  visible_count = 0;
+  if (size() == 0) {
+    return;
+  }
+
+  if (size() < parallel_threshold) {
+    cull_roots.assign(1, 0);
+  } else {
+    bvh.split(size() / objects_per_job, cull_roots);
+  }
+  cull_jobs.resize(std::max(cull_jobs.size(), cull_roots.size()));
+
+  if (cull_roots.size() == 1) {
+    cull_subtree(frustum, cull_roots[0], cull_jobs[0]);
+  } else {
+    ThreadPool::get_instance().parallel_for(
+        cull_roots.size(), [&](size_t job) {
+          cull_subtree(frustum, cull_roots[job], cull_jobs[job]);
+        });
+  }
+
+  // In subtree order, so the result does not depend on the scheduling.
+  for (size_t job = 0; job < cull_roots.size(); job++) {
+    const auto& job_visible = cull_jobs[job].visible;
+    visible.insert(visible.end(), job_visible.begin(), job_visible.end());
+    tested_count += cull_jobs[job].candidates.size();
+  }
+  visible_count = visible.size() - first_visible;
+}
+
+std::optional<RayHit> Scene::raycast(const glm::vec3& origin,
+                                     const glm::vec3& direction,
+                                     float max_distance) const {
+  return bvh.raycast(origin, direction, max_distance);
+}
+
+void Scene::overlap_sphere(const glm::vec3& center, float radius,
+                           std::vector<uint32_t>& result) const {
+  float radius2 = radius * radius;
+  auto distance2 = [&](const AABB& box) {
+    glm::vec3 offset = center - glm::clamp(center, box.min, box.max);
+    return glm::dot(offset, offset);
+  };
+
+  bvh.traverse(
+      [&](const AABB& box) {
+        if (distance2(box) > radius2) {
+          return Containment::eOutside;
+        }
+        // Inside if the farthest corner is.
+        glm::vec3 far = glm::max(glm::abs(box.min - center),
+                                 glm::abs(box.max - center));
+        return glm::dot(far, far) <= radius2 ? Containment::eInside
+                                             : Containment::eIntersecting;
+      },
+      [&](uint32_t object, bool inside) {
+        if (inside || distance2(bvh.bounds(object)) <= radius2) {
+          result.push_back(object);
+        }
+      });
+}
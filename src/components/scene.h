@@ -1,2 +1,113 @@
 #pragma once
-class Scene {};
\ No newline at end of file
+#include <optional>
+#include <vector>
+
+#include "Material.h"
+#include "bvh.h"
+#include "entity_store.h"
+#include "frustum_culler.h"
+#include "mesh.h"
+
+// Entities of a level and the components attached to them. Transforms live
+// in an EntityStore; renderables (mesh, material) and their world space
+// bounds are structure of arrays indexed by object id, referring to meshes
+// and materials by index, so iterating them never chases pointers. A Bvh
+// over the world bounds answers culling, ray and overlap queries.
+//
+// Objects whose entity changed are refit by the next update(), which also
+// rebuilds the tree once refits made it noticeably worse than a fresh build.
+// Queries see the state of the last update().
+class Scene {
+ public:
+  static constexpr uint32_t no_object = UINT32_MAX;
+
+  // Rebuild once the Bvh cost grew by this factor since the last build.
+  static constexpr float rebuild_cost_factor = 1.3f;
+
+  // Work below this many objects stays on the calling thread, larger updates
+  // and culls are split into jobs on the ThreadPool.
+  static constexpr size_t parallel_threshold = 4096;
+
+  uint32_t add_mesh(const Mesh& mesh);
+  uint32_t add_material(const Material& material);
+
+  uint32_t create_entity(const glm::mat4& local,
+                         uint32_t parent = EntityStore::no_parent) {
+    return transforms.create(local, parent);
+  }
+
+  void set_local_transform(uint32_t entity, const glm::mat4& local) {
+    transforms.set_local(entity, local);
+  }
+
+  // An entity has at most one renderable. Returns the object id.
+  uint32_t add_renderable(uint32_t entity, uint32_t mesh, uint32_t material);
+
+  size_t size() const { return object_entities.size(); }
+  Mesh& mesh(uint32_t object) { return meshes[object_meshes[object]]; }
+  Material& material(uint32_t object) {
+    return materials[object_materials[object]];
+  }
+  const glm::mat4& to_world(uint32_t object) const {
+    return transforms.world(object_entities[object]);
+  }
+
+  // Objects whose to_world changed in the last update().
+  const std::vector<uint32_t>& changed_objects() const {
+    return changed;
+  }
+
+  void update();
+
+  // Appends the objects that intersect the frustum to visible. Objects in
+  // subtrees fully inside are accepted without testing them one by one.
+  void cull(const Frustum& frustum, std::vector<uint32_t>& visible);
+
+  std::optional<RayHit> raycast(const glm::vec3& origin,
+                                const glm::vec3& direction,
+                                float max_distance) const;
+
+  // Appends the objects whose boxes overlap the sphere to result.
+  void overlap_sphere(const glm::vec3& center, float radius,
+                      std::vector<uint32_t>& result) const;
+
+  // Statistics, the counts are of the last cull().
+  uint32_t tested_count = 0;
+  uint32_t visible_count = 0;
+  uint32_t rebuild_count = 0;
+
+ private:
+  std::vector<Mesh> meshes;
+  std::vector<Material> materials;
+
+  EntityStore transforms;
+  // Object of every entity, no_object if it has no renderable.
+  std::vector<uint32_t> entity_objects;
+
+  // Renderable and bounds components.
+  std::vector<uint32_t> object_entities;
+  std::vector<uint32_t> object_meshes;
+  std::vector<uint32_t> object_materials;
+  std::vector<AABB> world_bounds;
+
+  std::vector<uint32_t> changed;
+
+  Bvh bvh;
+  bool needs_build = true;
+  float built_cost = 0.0f;
+  size_t refits_since_check = 0;
+
+  // A cull traverses one Bvh subtree per job, objects in partially visible
+  // leaves are tested by the job's FrustumCuller.
+  struct CullJob {
+    FrustumCuller culler;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> visible;
+  };
+  std::vector<CullJob> cull_jobs;
+  std::vector<uint32_t> cull_roots;
+
+  void rebuild();
+
+  void cull_subtree(const Frustum& frustum, uint32_t root, CullJob& job);
+};
@@ -0,0 +1,321 @@
+#include "texture_cooker.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "../core/hash.h"
+#include "../core/thread_pool.h"
+#include "block_compressor.h"
+
+static constexpr char texture_cache_magic[4] = {'V', 'K', 'T', 'C'};
+static constexpr uint64_t texture_cache_alignment = 16;
+
+static uint64_t align_up(uint64_t value) {
+  return (value + texture_cache_alignment - 1) &
+         ~(texture_cache_alignment - 1);
+}
+
+// Both directions of the sRGB transfer function. Going back uses 4096 steps
+// so that dark values survive the round trip.
+struct SrgbTables {
+  float to_linear[256];
+  uint8_t to_srgb[4096];
+
+  SrgbTables() {
+    for (int i = 0; i < 256; i++) {
+      float c = i / 255.0f;
+      to_linear[i] = c <= 0.04045f ? c / 12.92f
+                                   : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < 4096; i++) {
+      float c = i / 4095.0f;
+      float srgb = c <= 0.0031308f
+                       ? c * 12.92f
+                       : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+      to_srgb[i] = uint8_t(std::clamp(srgb * 255.0f + 0.5f, 0.0f, 255.0f));
+    }
+  }
+};
+
+static const SrgbTables& srgb_tables() {
+  static SrgbTables tables;
+  return tables;
+}
+
+static uint32_t block_bytes(TextureFormat format) {
+  switch (format) {
+    case TextureFormat::eBC1:
+      return 8;
+    case TextureFormat::eBC5:
+    case TextureFormat::eBC7:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+uint64_t TextureCooker::level_size(TextureFormat format, uint32_t width,
+                                   uint32_t height) {
+  if (format == TextureFormat::eRGBA8) {
+    return uint64_t(width) * height * 4;
+  }
+  uint64_t blocks = uint64_t((width + 3) / 4) * ((height + 3) / 4);
+  return blocks * block_bytes(format);
+}
+
+bool TextureCooker::load(const std::string& path, TextureUsage usage,
+                         TextureFormat format, CookedTexture& out) {
+  MappedFile source;
+  if (!source.open(path)) {
+    return false;
+  }
+  uint64_t source_hash = hash_bytes(source.data(), source.size());
+
+  auto cache = cache_path(path);
+  if (open(cache, source_hash, usage, format, out)) {
+    return true;
+  }
+
+  int width, height, channels;
+  stbi_uc* pixels = stbi_load_from_memory(
+      reinterpret_cast<const stbi_uc*>(source.data()), int(source.size()),
+      &width, &height, &channels, STBI_rgb_alpha);
+  source.close();
+  if (!pixels) {
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  out = cook(pixels, width, height, usage, format);
+  stbi_image_free(pixels);
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::cout << path << ": " << out.levels.size() << " levels, "
+            << uint64_t(width) * height * 4 << " -> " << out.size()
+            << " bytes in " << elapsed.count() << " ms\n";
+
+  if (!write(cache, source_hash, out)) {
+    std::cerr << "Failed to write texture cache " << cache << "\n";
+  }
+  return true;
+}
+
+CookedTexture TextureCooker::cook(const uint8_t* pixels, uint32_t width,
+                                  uint32_t height, TextureUsage usage,
+                                  TextureFormat format) {
+  CookedTexture output;
+  output.format = format;
+  output.usage = usage;
+
+  uint64_t offset = 0;
+  uint32_t level_width = width;
+  uint32_t level_height = height;
+  while (output.levels.size() < TextureCacheHeader::max_levels) {
+    uint64_t size = level_size(format, level_width, level_height);
+    output.levels.push_back({level_width, level_height, offset, size});
+    offset = align_up(offset + size);
+    if (level_width == 1 && level_height == 1) {
+      break;
+    }
+    level_width = std::max(1u, level_width / 2);
+    level_height = std::max(1u, level_height / 2);
+  }
+
+  output.storage.resize(offset);
+  output.bytes = output.storage.data();
+  output.byte_size = output.storage.size();
+
+  // Every level is filtered from the one above it, only two are alive at a
+  // time.
+  std::vector<uint8_t> current(pixels, pixels + uint64_t(width) * height * 4);
+  std::vector<uint8_t> next;
+  for (size_t i = 0; i < output.levels.size(); i++) {
+    const auto& level = output.levels[i];
+    encode(current.data(), level.width, level.height, format,
+           output.storage.data() + level.offset);
+
+    if (i + 1 < output.levels.size()) {
+      const auto& next_level = output.levels[i + 1];
+      next.resize(uint64_t(next_level.width) * next_level.height * 4);
+      downsample(current.data(), level.width, level.height, next.data(),
+                 next_level.width, next_level.height, usage);
+      std::swap(current, next);
+    }
+  }
+
+  return output;
+}
+
+void TextureCooker::downsample(const uint8_t* src, uint32_t src_width,
+                               uint32_t src_height, uint8_t* dst,
+                               uint32_t width, uint32_t height,
+                               TextureUsage usage) {
+  const auto& tables = srgb_tables();
+
+  // 2x2 box filter, odd edges clamp to the last row and column.
+  ThreadPool::get_instance().parallel_for(height, [&](size_t y) {
+    uint32_t y0 = std::min<uint32_t>(y * 2, src_height - 1);
+    uint32_t y1 = std::min<uint32_t>(y * 2 + 1, src_height - 1);
+    for (uint32_t x = 0; x < width; x++) {
+      uint32_t x0 = std::min(x * 2, src_width - 1);
+      uint32_t x1 = std::min(x * 2 + 1, src_width - 1);
+      const uint8_t* texels[4] = {src + (uint64_t(y0) * src_width + x0) * 4,
+                                  src + (uint64_t(y0) * src_width + x1) * 4,
+                                  src + (uint64_t(y1) * src_width + x0) * 4,
+                                  src + (uint64_t(y1) * src_width + x1) * 4};
+      uint8_t* out = dst + (uint64_t(y) * width + x) * 4;
+
+      float sum[4] = {};
+      if (usage == TextureUsage::eColor) {
+        for (const auto* texel : texels) {
+          for (int c = 0; c < 3; c++) {
+            sum[c] += tables.to_linear[texel[c]];
+          }
+          sum[3] += texel[3];
+        }
+        for (int c = 0; c < 3; c++) {
+          out[c] = tables.to_srgb[int(sum[c] / 4.0f * 4095.0f + 0.5f)];
+        }
+        out[3] = uint8_t(sum[3] / 4.0f + 0.5f);
+      } else {
+        for (const auto* texel : texels) {
+          for (int c = 0; c < 3; c++) {
+            sum[c] += texel[c] / 127.5f - 1.0f;
+          }
+          sum[3] += texel[3];
+        }
+        float length =
+            std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+        if (length == 0.0f) {
+          sum[2] = length = 1.0f;
+        }
+        for (int c = 0; c < 3; c++) {
+          out[c] = uint8_t(
+              std::clamp((sum[c] / length * 0.5f + 0.5f) * 255.0f + 0.5f,
+                         0.0f, 255.0f));
+        }
+        out[3] = uint8_t(sum[3] / 4.0f + 0.5f);
+      }
+    }
+  });
+}
+
+void TextureCooker::encode(const uint8_t* pixels, uint32_t width,
+                           uint32_t height, TextureFormat format,
+                           uint8_t* out) {
+  if (format == TextureFormat::eRGBA8) {
+    std::memcpy(out, pixels, uint64_t(width) * height * 4);
+    return;
+  }
+
+  uint32_t blocks_x = (width + 3) / 4;
+  uint32_t blocks_y = (height + 3) / 4;
+  uint32_t bytes = block_bytes(format);
+
+  ThreadPool::get_instance().parallel_for(blocks_y, [&](size_t by) {
+    uint8_t block[64];
+    for (uint32_t bx = 0; bx < blocks_x; bx++) {
+      // Blocks reaching over the edge repeat the last texels, those are
+      // never sampled but still influence the endpoints.
+      for (uint32_t y = 0; y < 4; y++) {
+        uint32_t py = std::min<uint32_t>(by * 4 + y, height - 1);
+        for (uint32_t x = 0; x < 4; x++) {
+          uint32_t px = std::min(bx * 4 + x, width - 1);
+          std::memcpy(block + (y * 4 + x) * 4,
+                      pixels + (uint64_t(py) * width + px) * 4, 4);
+        }
+      }
+
+      uint8_t* block_out = out + (uint64_t(by) * blocks_x + bx) * bytes;
+      switch (format) {
+        case TextureFormat::eBC1:
+          BlockCompressor::encode_bc1(block, block_out);
+          break;
+        case TextureFormat::eBC5:
+          BlockCompressor::encode_bc5(block, block_out);
+          break;
+        default:
+          BlockCompressor::encode_bc7(block, block_out);
+          break;
+      }
+    }
+  });
+}
+
+bool TextureCooker::open(const std::string& path, uint64_t source_hash,
+                         TextureUsage usage, TextureFormat format,
+                         CookedTexture& out) {
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(TextureCacheHeader)) {
+    return false;
+  }
+
+  auto header = reinterpret_cast<const TextureCacheHeader*>(file.data());
+  if (std::memcmp(header->magic, texture_cache_magic, 4) != 0 ||
+      header->version != version || header->source_hash != source_hash ||
+      header->format != uint32_t(format) ||
+      header->usage != uint32_t(usage) || header->level_count == 0 ||
+      header->level_count > TextureCacheHeader::max_levels ||
+      header->data_offset > file.size()) {
+    return false;
+  }
+
+  uint64_t data_size = file.size() - header->data_offset;
+  for (uint32_t i = 0; i < header->level_count; i++) {
+    const auto& level = header->levels[i];
+    if (level.size != level_size(format, level.width, level.height) ||
+        level.offset + level.size > data_size) {
+      return false;
+    }
+  }
+
+  out.format = format;
+  out.usage = usage;
+  out.levels.assign(header->levels, header->levels + header->level_count);
+  out.storage.clear();
+  out.bytes = reinterpret_cast<const uint8_t*>(file.data()) +
+              header->data_offset;
+  out.byte_size = data_size;
+  out.file = std::move(file);
+  return true;
+}
+
+bool TextureCooker::write(const std::string& path, uint64_t source_hash,
+                          const CookedTexture& texture) {
+  TextureCacheHeader header{};
+  std::memcpy(header.magic, texture_cache_magic, 4);
+  header.version = version;
+  header.source_hash = source_hash;
+  header.format = uint32_t(texture.format);
+  header.usage = uint32_t(texture.usage);
+  header.level_count = texture.levels.size();
+  header.data_offset = align_up(sizeof(TextureCacheHeader));
+  std::copy(texture.levels.begin(), texture.levels.end(), header.levels);
+
+  // Same tmp file and rename dance as MeshCache::write.
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+
+    const char padding[texture_cache_alignment] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(padding, header.data_offset - sizeof(header));
+    out.write(reinterpret_cast<const char*>(texture.data()), texture.size());
+    if (!out.good()) {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
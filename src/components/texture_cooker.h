@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// GPU layout of a cooked texture. The BC formats use 4x4 blocks.
+enum class TextureFormat : uint32_t {
+  eRGBA8 = 0,
+  eBC1 = 1,
+  eBC5 = 2,
+  eBC7 = 3,
+};
+
+// Color textures are sRGB encoded and filtered in linear space, normal maps
+// are renormalized on every level.
+enum class TextureUsage : uint32_t { eColor = 0, eNormal = 1 };
+
+struct TextureLevel {
+  uint32_t width;
+  uint32_t height;
+  // Relative to CookedTexture::data().
+  uint64_t offset;
+  uint64_t size;
+};
+
+// On disk layout of a cooked texture. The levels follow the header at
+// data_offset in their final GPU layout.
+struct TextureCacheHeader {
+  static constexpr uint32_t max_levels = 16;
+
+  char magic[4];
+  uint32_t version;
+  uint64_t source_hash;
+  uint32_t format;
+  uint32_t usage;
+  uint32_t level_count;
+  uint32_t reserved;
+  uint64_t data_offset;
+  TextureLevel levels[max_levels];
+};
+
+// Complete mip chain of a texture, level 0 first. Maps the cache file it was
+// loaded from or owns the freshly cooked levels.
+class CookedTexture {
+ public:
+  TextureFormat format = TextureFormat::eRGBA8;
+  TextureUsage usage = TextureUsage::eColor;
+  std::vector<TextureLevel> levels;
+
+  const uint8_t* data() const { return bytes; }
+  uint64_t size() const { return byte_size; }
+
+ private:
+  friend class TextureCooker;
+
+  MappedFile file;
+  std::vector<uint8_t> storage;
+  const uint8_t* bytes = nullptr;
+  uint64_t byte_size = 0;
+};
+
+// Turns source images into mip chains in a block compressed format and
+// caches the result next to the source, so that later loads are a mapping
+// and a copy.
+class TextureCooker {
+ public:
+  // Bump whenever the filtering or one of the encoders changes.
+  static constexpr uint32_t version = 1;
+
+  static std::string cache_path(const std::string& source_path) {
+    return source_path + ".texcache";
+  }
+
+  // Maps the cache if it was cooked from the same source with the same
+  // settings, decodes, cooks and writes it otherwise. Returns false if the
+  // source cannot be read or decoded.
+  static bool load(const std::string& path, TextureUsage usage,
+                   TextureFormat format, CookedTexture& out);
+
+  // Generates all levels down to 1x1 from tightly packed RGBA8 pixels and
+  // encodes them. Both run on the ThreadPool.
+  static CookedTexture cook(const uint8_t* pixels, uint32_t width,
+                            uint32_t height, TextureUsage usage,
+                            TextureFormat format);
+
+  static bool write(const std::string& path, uint64_t source_hash,
+                    const CookedTexture& texture);
+
+  static uint64_t level_size(TextureFormat format, uint32_t width,
+                             uint32_t height);
+
+ private:
+  static bool open(const std::string& path, uint64_t source_hash,
+                   TextureUsage usage, TextureFormat format,
+                   CookedTexture& out);
+
+  static void downsample(const uint8_t* src, uint32_t src_width,
+                         uint32_t src_height, uint8_t* dst, uint32_t width,
+                         uint32_t height, TextureUsage usage);
+
+  static void encode(const uint8_t* pixels, uint32_t width, uint32_t height,
+                     TextureFormat format, uint8_t* out);
+};
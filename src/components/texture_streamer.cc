@@ -0,0 +1,113 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "../core/thread_pool.h"
+#include "../vulkan_layer/upload_manager.h"
+#include "bindless_materials.h"
+
+TextureStreamer::TextureStreamer() {
+  // Grey/magenta checker, obviously not final but not distracting either.
+  const uint32_t grey = 0xff808080;
+  const uint32_t magenta = 0xffff00ff;
+  uint32_t pixels[4 * 4];
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) {
+      pixels[y * 4 + x] = (x + y) % 2 ? magenta : grey;
+    }
+  }
+  placeholder = Texture::create(pixels, 4, 4);
+  UploadManager::get_instance().wait(UploadManager::get_instance().flush());
+  placeholder_index =
+      BindlessMaterials::get_instance().add_texture(placeholder);
+}
+
+TextureHandle TextureStreamer::load(const std::string& path,
+                                    TextureUsage usage) {
+  auto handle = std::make_shared<StreamedTexture>();
+  handle->texture = placeholder;
+  handle->texture_index = placeholder_index;
+
+  auto format = Texture::preferred_format(usage);
+  decoding++;
+  ThreadPool::get_instance().submit([this, handle, path, usage, format]() {
+    CookedTexture cooked;
+    bool loaded = TextureCooker::load(path, usage, format, cooked);
+    if (!loaded) {
+      std::cerr << "Failed to load texture " << path << "\n";
+    }
+
+    std::lock_guard<std::mutex> lock(decoded_mutex);
+    decoded.push_back({handle, loaded, std::move(cooked)});
+    decoding--;
+  });
+
+  return handle;
+}
+
+void TextureStreamer::update() {
+  auto& upload_manager = UploadManager::get_instance();
+
+  for (auto it = uploading.begin(); it != uploading.end();) {
+    if (upload_manager.is_complete(it->timeline_value)) {
+      it->handle->texture = it->texture;
+      it->handle->texture_index =
+          BindlessMaterials::get_instance().add_texture(it->texture);
+      it->handle->resident = true;
+      it->handle->generation++;
+      it = uploading.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  std::vector<DecodedTexture> batch;
+  {
+    std::lock_guard<std::mutex> lock(decoded_mutex);
+    vk::DeviceSize budget = upload_budget;
+    while (!decoded.empty()) {
+      auto& next = decoded.front();
+      vk::DeviceSize size = next.cooked.size();
+      if (!batch.empty() && size > budget) {
+        break;
+      }
+      budget -= std::min(budget, size);
+      batch.push_back(std::move(next));
+      decoded.pop_front();
+    }
+  }
+
+  if (batch.empty()) {
+    return;
+  }
+
+  size_t first_new = uploading.size();
+  for (auto& texture : batch) {
+    if (!texture.loaded) {
+      texture.handle->failed = true;
+      continue;
+    }
+    // The UploadManager copies the levels into its staging ring, the batch
+    // and with it any mapped cache file can go right after.
+    uploading.push_back({texture.handle, Texture::create(texture.cooked), 0});
+  }
+
+  uint64_t timeline_value = upload_manager.flush();
+  for (size_t i = first_new; i < uploading.size(); i++) {
+    uploading[i].timeline_value = timeline_value;
+  }
+}
+
+void TextureStreamer::wait_idle() {
+  while (pending() > 0) {
+    update();
+    std::this_thread::yield();
+  }
+}
+
+size_t TextureStreamer::pending() {
+  std::lock_guard<std::mutex> lock(decoded_mutex);
+  return decoding + decoded.size() + uploading.size();
+}
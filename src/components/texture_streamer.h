@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Texture.h"
+
+struct StreamedTexture {
+  // The placeholder until the real image is resident.
+  Texture texture;
+  bool resident = false;
+  bool failed = false;
+  // Bumped whenever texture changes so that users can refresh descriptors.
+  uint32_t generation = 0;
+  // Element of the BindlessMaterials texture array showing texture.
+  uint32_t texture_index = 0;
+};
+
+using TextureHandle = std::shared_ptr<StreamedTexture>;
+
+// Loads textures without stalling the render loop. Files are decoded and
+// cooked (or their cache mapped) on the ThreadPool, the main thread batches
+// their uploads through the UploadManager in update() and swaps them in once
+// the upload's timeline value completed.
+class TextureStreamer {
+ public:
+  static TextureStreamer& get_instance() {
+    static TextureStreamer instance;
+    return instance;
+  }
+
+  // Upper bound for bytes handed to the UploadManager per update(), one
+  // texture is always let through.
+  static constexpr vk::DeviceSize upload_budget = vk::DeviceSize(32) << 20;
+
+  // Returns immediately with a handle showing the placeholder texture.
+  TextureHandle load(const std::string& path,
+                     TextureUsage usage = TextureUsage::eColor);
+
+  // Main thread only, once per frame.
+  void update();
+
+  // Blocks until every requested texture is resident or failed.
+  void wait_idle();
+
+  // Textures decoding, waiting for upload or uploading.
+  size_t pending();
+
+ private:
+  struct DecodedTexture {
+    TextureHandle handle;
+    bool loaded;
+    CookedTexture cooked;
+  };
+
+  struct UploadingTexture {
+    TextureHandle handle;
+    Texture texture;
+    uint64_t timeline_value;
+  };
+
+  Texture placeholder;
+  uint32_t placeholder_index;
+
+  std::atomic<size_t> decoding{0};
+
+  std::mutex decoded_mutex;
+  std::deque<DecodedTexture> decoded;
+
+  std::vector<UploadingTexture> uploading;
+
+  TextureStreamer();
+};
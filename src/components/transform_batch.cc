@@ -0,0 +1,134 @@
+#include "transform_batch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../core/thread_pool.h"
+#include "transform_kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRANSFORM_BATCH_X86 1
+
+struct SseLanes {
+  using type = __m128;
+  static constexpr size_t width = 4;
+  static type load(const float* p) { return _mm_loadu_ps(p); }
+  static void store(float* p, type v) { _mm_storeu_ps(p, v); }
+  static type set1(float v) { return _mm_set1_ps(v); }
+  static type add(type a, type b) { return _mm_add_ps(a, b); }
+  static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+  static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+  static type div(type a, type b) { return _mm_div_ps(a, b); }
+};
+
+void transform_range_sse(const TransformArrays& arrays, size_t begin,
+                         size_t end, float* out) {
+  transform_range<SseLanes>(arrays, begin, end, out);
+}
+#endif
+
+// Columns of equal length that are orthogonal to each other.
+static bool has_uniform_scale(const glm::mat4& m) {
+  glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+  float length2 = glm::dot(c0, c0);
+  float tolerance = 1e-5f * length2;
+  return length2 > 0.0f &&
+         std::abs(glm::dot(c1, c1) - length2) <= tolerance &&
+         std::abs(glm::dot(c2, c2) - length2) <= tolerance &&
+         std::abs(glm::dot(c0, c1)) <= tolerance &&
+         std::abs(glm::dot(c1, c2)) <= tolerance &&
+         std::abs(glm::dot(c2, c0)) <= tolerance;
+}
+
+uint32_t TransformBatch::add(const glm::mat4& to_world) {
+  for (auto& element : elements) {
+    element.push_back(0.0f);
+  }
+  uniform_scale.push_back(0);
+  uint32_t index = uniform_scale.size() - 1;
+  set(index, to_world);
+  return index;
+}
+
+void TransformBatch::set(uint32_t index, const glm::mat4& to_world) {
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 3; r++) {
+      elements[c * 3 + r][index] = to_world[c][r];
+    }
+  }
+  uniform_scale[index] = has_uniform_scale(to_world);
+}
+
+glm::mat4 TransformBatch::get(uint32_t index) const {
+  glm::mat4 to_world(1.0f);
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 3; r++) {
+      to_world[c][r] = elements[c * 3 + r][index];
+    }
+  }
+  return to_world;
+}
+
+void TransformBatch::clear() {
+  for (auto& element : elements) {
+    element.clear();
+  }
+  uniform_scale.clear();
+}
+
+TransformBatch::Kernel TransformBatch::best_kernel() {
+#if TRANSFORM_BATCH_X86 && defined(__GNUC__)
+  static const Kernel kernel = __builtin_cpu_supports("avx2")
+                                   ? Kernel::eAVX2
+                                   : Kernel::eSSE;
+  return kernel;
+#elif TRANSFORM_BATCH_X86
+  return Kernel::eSSE;
+#else
+  return Kernel::eScalar;
+#endif
+}
+
+void TransformBatch::compute(ObjectData* out) const {
+  compute(out, best_kernel());
+}
+
+void TransformBatch::compute(ObjectData* out, Kernel kernel,
+                             bool parallel) const {
+  static_assert(sizeof(ObjectData) == object_data_floats * sizeof(float));
+
+  TransformArrays arrays;
+  for (int i = 0; i < 12; i++) {
+    arrays.elements[i] = elements[i].data();
+  }
+  arrays.uniform_scale = uniform_scale.data();
+  auto out_floats = reinterpret_cast<float*>(out);
+
+  auto run = [&](size_t begin, size_t end) {
+    switch (kernel) {
+#if TRANSFORM_BATCH_X86
+      case Kernel::eAVX2:
+        transform_range_avx2(arrays, begin, end, out_floats);
+        break;
+      case Kernel::eSSE:
+        transform_range_sse(arrays, begin, end, out_floats);
+        break;
+#endif
+      default:
+        transform_range<ScalarLanes>(arrays, begin, end, out_floats);
+        break;
+    }
+  };
+
+  size_t count = size();
+  if (!parallel) {
+    run(0, count);
+    return;
+  }
+
+  size_t chunks = (count + chunk_size - 1) / chunk_size;
+  ThreadPool::get_instance().parallel_for(chunks, [&](size_t chunk) {
+    run(chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size));
+  });
+}
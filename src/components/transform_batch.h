@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// std430 layout of one object, indexed by gl_InstanceIndex. Only the upper
+// 3x3 of normal_to_world is meaningful.
+struct ObjectData {
+  glm::mat4 to_world;
+  glm::mat4 normal_to_world;
+};
+
+// Affine object to world transforms in structure of arrays layout: one array
+// per element of the upper 3x4 of the column major matrix. compute() turns
+// them into ObjectData several objects at a time.
+class TransformBatch {
+ public:
+  enum class Kernel { eScalar, eSSE, eAVX2 };
+
+  // Objects per ThreadPool task.
+  static constexpr size_t chunk_size = 4096;
+
+  // The bottom row of to_world is assumed to be (0, 0, 0, 1).
+  uint32_t add(const glm::mat4& to_world);
+  void set(uint32_t index, const glm::mat4& to_world);
+  glm::mat4 get(uint32_t index) const;
+
+  size_t size() const { return uniform_scale.size(); }
+
+  // Keeps the capacity.
+  void clear();
+
+  // Writes the ObjectData of every transform to out with the widest kernel
+  // the CPU supports, split across the ThreadPool.
+  void compute(ObjectData* out) const;
+  void compute(ObjectData* out, Kernel kernel, bool parallel = true) const;
+
+  static Kernel best_kernel();
+
+ private:
+  // Column c, row r of every matrix lives in elements[c * 3 + r].
+  std::array<std::vector<float>, 12> elements;
+  // Rotation times a uniform scale, the normal matrix is a scaled copy then
+  // and needs no inverse.
+  std::vector<uint8_t> uniform_scale;
+};
@@ -0,0 +1,24 @@
+// Built with AVX2 enabled, only called after TransformBatch::best_kernel()
+// checked the CPU for it.
+#include "transform_kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+struct Avx2Lanes {
+  using type = __m256;
+  static constexpr size_t width = 8;
+  static type load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, type v) { _mm256_storeu_ps(p, v); }
+  static type set1(float v) { return _mm256_set1_ps(v); }
+  static type add(type a, type b) { return _mm256_add_ps(a, b); }
+  static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+  static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+  static type div(type a, type b) { return _mm256_div_ps(a, b); }
+};
+
+void transform_range_avx2(const TransformArrays& arrays, size_t begin,
+                          size_t end, float* out) {
+  transform_range<Avx2Lanes>(arrays, begin, end, out);
+}
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Shared by the kernels in transform_batch.cc and transform_batch_avx2.cc,
+// which include it with different instruction sets enabled. Deliberately
+// free of glm: its inline functions would be emitted with AVX2 as well.
+
+// Floats per ObjectData: to_world followed by normal_to_world.
+constexpr size_t object_data_floats = 32;
+
+struct TransformArrays {
+  const float* elements[12];
+  const uint8_t* uniform_scale;
+};
+
+void transform_range_sse(const TransformArrays& arrays, size_t begin,
+                         size_t end, float* out);
+
+void transform_range_avx2(const TransformArrays& arrays, size_t begin,
+                          size_t end, float* out);
+
+// Internal linkage, otherwise the linker could pick an instantiation built
+// with AVX2 for the code paths that run on every CPU.
+namespace {
+
+// Scalar lane type, also used for the tails of the wide kernels.
+struct ScalarLanes {
+  using type = float;
+  static constexpr size_t width = 1;
+  static type load(const float* p) { return *p; }
+  static void store(float* p, type v) { *p = v; }
+  static type set1(float v) { return v; }
+  static type add(type a, type b) { return a + b; }
+  static type sub(type a, type b) { return a - b; }
+  static type mul(type a, type b) { return a * b; }
+  static type div(type a, type b) { return a / b; }
+};
+
+// Computes ObjectData for objects [first, first + V::width). The normal
+// matrix is the inverse transpose of the upper 3x3 M = [c0 c1 c2], which is
+// [c1 x c2, c2 x c0, c0 x c1] / det(M). For a uniform scale s it is M / s^2.
+template <typename V>
+inline void transform_lanes(const TransformArrays& arrays, size_t first,
+                            float* out) {
+  using T = typename V::type;
+
+  T m[9];
+  for (int i = 0; i < 9; i++) {
+    m[i] = V::load(arrays.elements[i] + first);
+  }
+
+  bool all_uniform = true;
+  for (size_t lane = 0; lane < V::width; lane++) {
+    all_uniform = all_uniform && arrays.uniform_scale[first + lane];
+  }
+
+  T n[9];
+  if (all_uniform) {
+    T length2 = V::add(V::add(V::mul(m[0], m[0]), V::mul(m[1], m[1])),
+                       V::mul(m[2], m[2]));
+    T inverse = V::div(V::set1(1.0f), length2);
+    for (int i = 0; i < 9; i++) {
+      n[i] = V::mul(m[i], inverse);
+    }
+  } else {
+    auto cross = [](const T* a, const T* b, T* result) {
+      result[0] = V::sub(V::mul(a[1], b[2]), V::mul(a[2], b[1]));
+      result[1] = V::sub(V::mul(a[2], b[0]), V::mul(a[0], b[2]));
+      result[2] = V::sub(V::mul(a[0], b[1]), V::mul(a[1], b[0]));
+    };
+    cross(m + 3, m + 6, n);
+    cross(m + 6, m, n + 3);
+    cross(m, m + 3, n + 6);
+
+    T det = V::add(V::add(V::mul(m[0], n[0]), V::mul(m[1], n[1])),
+                   V::mul(m[2], n[2]));
+    T inverse = V::div(V::set1(1.0f), det);
+    for (int i = 0; i < 9; i++) {
+      n[i] = V::mul(n[i], inverse);
+    }
+  }
+
+  alignas(32) float normal[9][V::width];
+  for (int i = 0; i < 9; i++) {
+    V::store(normal[i], n[i]);
+  }
+
+  for (size_t lane = 0; lane < V::width; lane++) {
+    size_t object = first + lane;
+    float* to_world = out + object * object_data_floats;
+    float* normal_to_world = to_world + 16;
+    for (int c = 0; c < 4; c++) {
+      for (int r = 0; r < 3; r++) {
+        to_world[c * 4 + r] = arrays.elements[c * 3 + r][object];
+      }
+      to_world[c * 4 + 3] = c == 3 ? 1.0f : 0.0f;
+    }
+    for (int c = 0; c < 3; c++) {
+      for (int r = 0; r < 3; r++) {
+        normal_to_world[c * 4 + r] = normal[c * 3 + r][lane];
+      }
+      normal_to_world[c * 4 + 3] = 0.0f;
+    }
+    std::memset(normal_to_world + 12, 0, 3 * sizeof(float));
+    normal_to_world[15] = 1.0f;
+  }
+}
+
+template <typename V>
+inline void transform_range(const TransformArrays& arrays, size_t begin,
+                            size_t end, float* out) {
+  size_t i = begin;
+  for (; i + V::width <= end; i += V::width) {
+    transform_lanes<V>(arrays, i, out);
+  }
+  for (; i < end; i++) {
+    transform_lanes<ScalarLanes>(arrays, i, out);
+  }
+}
+
+}  // namespace
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+
+struct Vertex {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 tex_coord;
+};
+
+// Layout of a mesh's vertex buffer, picked per mesh by VertexPacker.
+enum class VertexFormat : uint32_t {
+  // Vertex as is, 32 bytes.
+  eFloat,
+  // PackedVertex, 16 bytes.
+  ePacked,
+};
+
+struct PackedVertex {
+  // snorm16 within the mesh's bounds, w is padding.
+  int16_t position[4];
+  // Octahedral encoding as snorm16.
+  int16_t normal[2];
+  // Half floats.
+  uint16_t tex_coord[2];
+};
+static_assert(sizeof(PackedVertex) == 16);
@@ -0,0 +1,106 @@
+#include "vertex_packer.h"
+
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+
+static glm::vec2 sign_not_zero(const glm::vec2& v) {
+  return {v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f};
+}
+
+VertexFormat VertexPacker::select_format(
+    const std::vector<Vertex>& vertices) {
+  for (const auto& vertex : vertices) {
+    if (std::abs(vertex.tex_coord.x) > max_packed_tex_coord ||
+        std::abs(vertex.tex_coord.y) > max_packed_tex_coord) {
+      return VertexFormat::eFloat;
+    }
+  }
+  return VertexFormat::ePacked;
+}
+
+uint32_t VertexPacker::vertex_stride(VertexFormat format) {
+  return format == VertexFormat::ePacked ? sizeof(PackedVertex)
+                                         : sizeof(Vertex);
+}
+
+uint32_t VertexPacker::index_stride(size_t vertex_count) {
+  return vertex_count <= 1 << 16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+std::vector<uint8_t> VertexPacker::pack_vertices(
+    const std::vector<Vertex>& vertices, VertexFormat format,
+    const AABB& bounds) {
+  std::vector<uint8_t> result(vertices.size() * vertex_stride(format));
+  if (format == VertexFormat::eFloat) {
+    std::memcpy(result.data(), vertices.data(), result.size());
+    return result;
+  }
+
+  // Flat meshes have no extent along one axis, every position is 0 there.
+  glm::vec3 center = bounds.center();
+  glm::vec3 extent = bounds.extent();
+  glm::vec3 inverse_extent(0.0f);
+  for (int axis = 0; axis < 3; axis++) {
+    if (extent[axis] > 0.0f) {
+      inverse_extent[axis] = 1.0f / extent[axis];
+    }
+  }
+
+  auto packed = reinterpret_cast<PackedVertex*>(result.data());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    const Vertex& vertex = vertices[i];
+    glm::vec3 position = (vertex.position - center) * inverse_extent;
+    glm::vec2 normal = encode_octahedral(vertex.normal);
+    for (int axis = 0; axis < 3; axis++) {
+      packed[i].position[axis] = glm::packSnorm1x16(position[axis]);
+    }
+    packed[i].position[3] = 0;
+    packed[i].normal[0] = glm::packSnorm1x16(normal.x);
+    packed[i].normal[1] = glm::packSnorm1x16(normal.y);
+    packed[i].tex_coord[0] = glm::packHalf1x16(vertex.tex_coord.x);
+    packed[i].tex_coord[1] = glm::packHalf1x16(vertex.tex_coord.y);
+  }
+  return result;
+}
+
+std::vector<uint8_t> VertexPacker::pack_indices(
+    const std::vector<uint32_t>& indices, size_t vertex_count) {
+  std::vector<uint8_t> result(indices.size() * index_stride(vertex_count));
+  if (index_stride(vertex_count) == sizeof(uint32_t)) {
+    std::memcpy(result.data(), indices.data(), result.size());
+    return result;
+  }
+
+  auto short_indices = reinterpret_cast<uint16_t*>(result.data());
+  for (size_t i = 0; i < indices.size(); i++) {
+    short_indices[i] = indices[i];
+  }
+  return result;
+}
+
+// The upper hemisphere is projected onto the inner diamond of the square,
+// the lower one is folded over the corners.
+glm::vec2 VertexPacker::encode_octahedral(const glm::vec3& normal) {
+  float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (sum == 0.0f) {
+    return glm::vec2(0.0f);
+  }
+  glm::vec2 encoded = glm::vec2(normal) / sum;
+  if (normal.z < 0.0f) {
+    encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) *
+              sign_not_zero(encoded);
+  }
+  return encoded;
+}
+
+glm::vec3 VertexPacker::decode_octahedral(const glm::vec2& encoded) {
+  glm::vec3 normal(encoded, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+  if (normal.z < 0.0f) {
+    glm::vec2 folded = (1.0f - glm::abs(glm::vec2(normal.y, normal.x))) *
+                       sign_not_zero(glm::vec2(normal));
+    normal.x = folded.x;
+    normal.y = folded.y;
+  }
+  return glm::normalize(normal);
+}
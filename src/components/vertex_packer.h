@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "bounds.h"
+#include "vertex.h"
+
+// Load time conversion of vertices and indices into their GPU formats.
+// Packed positions are quantized relative to the mesh's AABB and decoded in
+// the vertex shader as center + extent * position, normals are octahedral
+// ("A Survey of Efficient Representations for Independent Unit Vectors",
+// Cigolle et al. 2014). Index buffers are 16 bit whenever the vertex count
+// allows.
+class VertexPacker {
+ public:
+  // Half floats resolve 1/2048 below 1 and 1/1024 below 2. Larger texture
+  // coordinates tile so often that their error becomes visible.
+  static constexpr float max_packed_tex_coord = 2.0f;
+
+  // ePacked unless a texture coordinate is out of range.
+  static VertexFormat select_format(const std::vector<Vertex>& vertices);
+
+  static uint32_t vertex_stride(VertexFormat format);
+
+  // 2 if every index fits in 16 bits, otherwise 4.
+  static uint32_t index_stride(size_t vertex_count);
+
+  static std::vector<uint8_t> pack_vertices(
+      const std::vector<Vertex>& vertices, VertexFormat format,
+      const AABB& bounds);
+
+  static std::vector<uint8_t> pack_indices(
+      const std::vector<uint32_t>& indices, size_t vertex_count);
+
+  // Both take and return unit vectors, the encoding is in [-1, 1]^2.
+  static glm::vec2 encode_octahedral(const glm::vec3& normal);
+  static glm::vec3 decode_octahedral(const glm::vec2& encoded);
+};
@@ -0,0 +1,155 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Index of the worker running on this thread, SIZE_MAX on other threads.
+static thread_local size_t current_worker = SIZE_MAX;
+
+ThreadPool::ThreadPool() {
+  // The thread calling parallel_for works as well.
+  unsigned int count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+  for (unsigned int i = 0; i <= count; i++) {
+    queues.push_back(std::make_unique<WorkQueue>());
+  }
+  for (unsigned int i = 0; i < count; i++) {
+    workers.emplace_back(&ThreadPool::worker_loop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+size_t ThreadPool::thread_index() const {
+  return std::min(current_worker, workers.size());
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  auto future = packaged.get_future();
+  auto& queue = *queues[thread_index()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(packaged));
+  }
+  {
+    // Under the sleep mutex, a worker that just found nothing to do would
+    // otherwise miss the notification.
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    pending++;
+  }
+  condition.notify_one();
+  return future;
+}
+
+void ThreadPool::parallel_for(size_t count,
+                              const std::function<void(size_t)>& fn) {
+  if (count == 0) {
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  auto run = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+
+  std::vector<std::future<void>> helpers;
+  size_t helper_count = std::min(count - 1, workers.size());
+  for (size_t i = 0; i < helper_count; i++) {
+    helpers.push_back(submit(run));
+  }
+
+  std::exception_ptr error;
+  try {
+    run();
+  } catch (...) {
+    error = std::current_exception();
+    next = count;
+  }
+
+  // run references this stack frame, wait for every helper before leaving.
+  // Queued tasks are run meanwhile, parallel_for may be called from a worker
+  // and its helpers could otherwise sit behind tasks that wait themselves.
+  for (auto& helper : helpers) {
+    while (helper.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      if (!run_pending_task()) {
+        std::this_thread::yield();
+      }
+    }
+    try {
+      helper.get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+bool ThreadPool::pop_task(std::packaged_task<void()>& task) {
+  size_t self = thread_index();
+
+  // Newest first from the own queue, its data is most likely still cached.
+  {
+    auto& queue = *queues[self];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      pending--;
+      return true;
+    }
+  }
+
+  // Oldest first from the others, usually the largest remaining pieces.
+  for (size_t offset = 1; offset < queues.size(); offset++) {
+    auto& queue = *queues[(self + offset) % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      pending--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::run_pending_task() {
+  std::packaged_task<void()> task;
+  if (!pop_task(task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+void ThreadPool::worker_loop(size_t index) {
+  current_worker = index;
+  while (true) {
+    if (run_pending_task()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    condition.wait(lock, [this] { return stopping || pending > 0; });
+    if (stopping && pending == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads shared by the whole engine. Every worker
+// owns a deque of tasks: tasks submitted from a worker go to its own deque
+// and are taken newest first, idle workers steal the oldest tasks of the
+// others. Tasks submitted from any other thread go to a shared queue.
+class ThreadPool {
+ public:
+  static ThreadPool& get_instance() {
+    static ThreadPool instance;
+    return instance;
+  }
+
+  size_t thread_count() const { return workers.size(); }
+
+  // Workers are 0 to thread_count() - 1, every other thread gets
+  // thread_count(). Lets tasks pick per thread resources, which is only safe
+  // if a single thread besides the workers uses them.
+  size_t thread_index() const;
+
+  std::future<void> submit(std::function<void()> task);
+
+  // Calls fn(i) for every i in [0, count) on the pool and the calling thread
+  // and blocks until all calls returned. Rethrows the first exception.
+  void parallel_for(size_t count, const std::function<void(size_t)>& fn);
+
+ private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::packaged_task<void()>> tasks;
+  };
+
+  std::vector<std::thread> workers;
+  // One per worker, the last one is shared by all other threads.
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+
+  // Tasks in all queues. Workers sleep while it is 0.
+  std::atomic<size_t> pending{0};
+  std::mutex sleep_mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+
+  ThreadPool();
+  ~ThreadPool();
+
+  void worker_loop(size_t index);
+
+  // Takes a task from the calling thread's own queue, or steals one.
+  bool pop_task(std::packaged_task<void()>& task);
+
+  // Runs one queued task on the calling thread, false if there was none.
+  bool run_pending_task();
+};
@@ -1,11 +1,27 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtx/transform.hpp>
 #include <iostream>
+#include <memory>
+#include <random>
 
 #include "components/FreeFlyCamera.h"
-#include "components/Model.h"
+#include "components/gbuffer.h"
+#include "components/gpu_culler.h"
+#include "components/instance_batcher.h"
+#include "components/light_clusters.h"
+#include "components/lod_selector.h"
+#include "components/scene.h"
+#include "components/object_buffer.h"
+#include "core/thread_pool.h"
+#include "offscreen_layer/offscreen_layer.h"
+#include "vulkan_layer/descriptor_allocator.h"
+#include "vulkan_layer/pipeline_cache.h"
+#include "vulkan_layer/thread_command_pools.h"
+#include "vulkan_layer/upload_manager.h"
 
 struct SyncStructres {
   vk::Fence render_fence;
@@ -13,207 +29,383 @@ struct SyncStructres {
   vk::Semaphore render_sem;
 };
 
-struct MeshPushConstants {
-  glm::mat4 render_matrix;
+// Everything a frame in flight owns. The CPU only touches it again once
+// render_fence signaled, so recording frame N+1 overlaps GPU work of frame N.
+struct FrameData {
+  vk::CommandPool cmd_pool;
+  vk::CommandBuffer cmd_buffer;
+  SyncStructres sync;
+  // Secondary command buffers recorded by jobs, reset with cmd_pool too.
+  ThreadCommandPools secondary_pools;
+};
+
+struct RenderSettings {
+  // Renders into an OffscreenTarget instead of an SDL window.
+  bool headless = false;
+  vk::Extent2D extent = {1700, 800};
+  // Headless only: number of frames to render and where to store the last.
+  int frames = 100;
+  std::string output_path = "frame.ppm";
+  uint32_t frames_in_flight = 2;
+  // Additional bunnies placed on a grid, to stress many identical models.
+  uint32_t copies = 0;
+  // Culls and builds draws in a compute shader if the device supports it.
+  bool gpu_culling = false;
+  // Driver pipeline cache kept between runs.
+  std::string pipeline_cache_path = "vulkan3d.pipelinecache";
+  // Draws into a GBuffer and shades in a fullscreen pass afterwards, instead
+  // of shading while drawing.
+  bool deferred = true;
+  // Deferred only: point and spot lights circling the scene, binned into
+  // clusters by a compute shader or on the CPU.
+  uint32_t lights = 2048;
+  bool gpu_light_culling = true;
 };
 
 class TMP {
  public:
-  Display display = Display({1700, 800});
-  FreeFlyCamera camera = FreeFlyCamera(&display);
-
-  vk::Pipeline pipeline;
+  RenderSettings settings;
+
+  // Exactly one of display and offscreen is set.
+  std::unique_ptr<Display> display;
+  std::unique_ptr<OffscreenTarget> offscreen;
+  std::unique_ptr<Camera> camera;
+  std::unique_ptr<ObjectBuffer> object_buffer;
+  InstanceBatcher instance_batcher;
+  LodSelector lod_selector;
+  // Set if settings.gpu_culling, replaces culling through the scene and
+  // instance_batcher. Object ids equal scene object ids.
+  std::unique_ptr<GpuCuller> gpu_culler;
+  // Set if settings.deferred.
+  std::unique_ptr<GBuffer> gbuffer;
+  std::unique_ptr<DeferredLighting> lighting;
+  std::unique_ptr<LightClusters> light_clusters;
+  // World space, before they are rotated around light_center.
+  std::vector<Light> lights;
+  glm::vec3 light_center{0, 0, -5};
+
+  // Scene pipeline of every VertexFormat, indexed by it.
+  std::vector<vk::Pipeline> pipelines;
   vk::PipelineLayout pipeline_layout;
 
   void* proj_data_ptr;
   Buffer proj_data_buffer;
 
-  std::vector<Mesh> meshes;
-  std::vector<Material> materials;
-  std::vector<Model> models;
+  Scene scene;
+  // Spins around its own y axis starting from this transform.
+  uint32_t rotating_entity;
+  glm::mat4 rotating_base;
+  std::vector<uint32_t> visible_objects;
+
+  std::vector<FrameData> frames;
+
+  TMP(const RenderSettings& settings) : settings{settings} {
+    if (settings.headless) {
+      offscreen = std::make_unique<OffscreenTarget>(settings.extent);
+      camera = std::make_unique<Camera>(settings.extent);
+    } else {
+      display = std::make_unique<Display>(settings.extent);
+      camera = std::make_unique<FreeFlyCamera>(display.get());
+    }
+
+    // The scene pipelines compile on the ThreadPool while assets load.
+    auto& pipeline_cache = PipelineCache::get_instance();
+    pipeline_cache.load(settings.pipeline_cache_path);
+    create_pipeline_layout();
+    std::vector<GraphicsPipelineDesc> scene_pipelines;
+    for (auto format : {VertexFormat::eFloat, VertexFormat::ePacked}) {
+      scene_pipelines.push_back(create_pipeline_desc(format));
+      pipeline_cache.prefetch(scene_pipelines.back());
+    }
 
-  TMP() {
-    create_pipeline();
+    create_frame_data();
 
     // tmp area for model loading
-    materials = {
-        Material(Texture::load(
-            "/home/malte/Documents/vscode/Vulkan3D/assets/viking_room.png")),
-        Material(Texture::load("/home/malte/Documents/vscode/Vulkan3D/assets/"
-                               "statue-g27c0aa581_640.jpg"))};
-    meshes = {
-        Mesh::load("/home/malte/Documents/vscode/Vulkan3D/assets/bunny.obj"),
-        Mesh::load(
-            "/home/malte/Documents/vscode/Vulkan3D/assets/viking_room.obj")};
-
-    meshes[0].entity_to_world =
-        glm::scale(glm::vec3(8, 8, 8)) * meshes[0].entity_to_world;
-    meshes[0].entity_to_world =
-        glm::translate(glm::vec3(1, 0, -3)) * meshes[0].entity_to_world;
-
-    meshes[1].entity_to_world =
-        glm::rotate(glm::radians(-90.f), glm::vec3(1, 0, 0)) *
-        meshes[1].entity_to_world;
-    meshes[1].entity_to_world =
+    auto& texture_streamer = TextureStreamer::get_instance();
+    uint32_t room_material = scene.add_material(Material(texture_streamer.load(
+        "/home/malte/Documents/vscode/Vulkan3D/assets/viking_room.png")));
+    uint32_t statue_material = scene.add_material(
+        Material(texture_streamer.load("/home/malte/Documents/vscode/Vulkan3D/"
+                                       "assets/statue-g27c0aa581_640.jpg")));
+    uint32_t bunny_mesh = scene.add_mesh(
+        Mesh::load("/home/malte/Documents/vscode/Vulkan3D/assets/bunny.obj"));
+    uint32_t room_mesh = scene.add_mesh(Mesh::load(
+        "/home/malte/Documents/vscode/Vulkan3D/assets/viking_room.obj"));
+
+    glm::mat4 room_to_world =
+        glm::translate(glm::vec3(-1, 0, -3)) *
         glm::rotate(glm::radians(-125.f), glm::vec3(0, 1, 0)) *
-        meshes[1].entity_to_world;
-    meshes[1].entity_to_world =
-        glm::translate(glm::vec3(-1, 0, -3)) * meshes[1].entity_to_world;
+        glm::rotate(glm::radians(-90.f), glm::vec3(1, 0, 0));
+    scene.add_renderable(scene.create_entity(room_to_world), room_mesh,
+                         room_material);
+
+    rotating_base =
+        glm::translate(glm::vec3(1, 0, -3)) * glm::scale(glm::vec3(8, 8, 8));
+    rotating_entity = scene.create_entity(rotating_base);
+    scene.add_renderable(rotating_entity, bunny_mesh, statue_material);
+
+    // The copies are children of one grid entity.
+    uint32_t grid = scene.create_entity(glm::translate(glm::vec3(0, -1, -5)));
+    uint32_t grid_size = std::ceil(std::sqrt(float(settings.copies)));
+    for (uint32_t i = 0; i < settings.copies; i++) {
+      glm::vec3 position(float(i % grid_size) - grid_size * 0.5f, 0,
+                         -float(i / grid_size));
+      uint32_t copy = scene.create_entity(
+          glm::translate(position) * glm::scale(glm::vec3(4, 4, 4)), grid);
+      scene.add_renderable(copy, bunny_mesh, statue_material);
+    }
+    scene.update();
+    // Sized for the whole scene, so no frame can overflow it.
+    object_buffer = std::make_unique<ObjectBuffer>(scene.size());
 
-    models = {Model(meshes[1], materials[0]), Model(meshes[0], materials[1])};
-  }
+    for (const auto& desc : scene_pipelines) {
+      pipelines.push_back(pipeline_cache.get(desc));
+    }
+
+    if (settings.deferred) {
+      auto extent = display ? display->swapchain.get_surface_extend()
+                            : offscreen->get_extent();
+      gbuffer = std::make_unique<GBuffer>(extent);
+      lighting = std::make_unique<DeferredLighting>(
+          "/home/malte/Documents/vscode/Vulkan3D/shaders/lighting.vert.spv",
+          "/home/malte/Documents/vscode/Vulkan3D/shaders/lighting.frag.spv",
+          get_color_format());
+      std::cout << "G-buffer: " << GBuffer::bytes_per_pixel()
+                << " bytes per pixel, "
+                << uint64_t(GBuffer::bytes_per_pixel()) * extent.width *
+                       extent.height / (1024 * 1024)
+                << " MiB at " << extent.width << "x" << extent.height
+                << "\n";
+
+      light_clusters = std::make_unique<LightClusters>(
+          "/home/malte/Documents/vscode/Vulkan3D/shaders/"
+          "cluster_lights.comp.spv",
+          settings.gpu_light_culling);
+      create_lights();
+      if (!lights.empty()) {
+        lighting->headlight = 0.2f;
+      }
+      std::cout << "Lights: " << lights.size() << " in "
+                << LightGrid::cluster_count << " clusters, binned "
+                << (light_clusters->bins_on_gpu() ? "in a compute shader"
+                                                  : "on the CPU")
+                << "\n";
+    }
+
+    if (settings.gpu_culling) {
+      if (VulkanLayer::get_instance().gpu_driven_rendering) {
+        gpu_culler = std::make_unique<GpuCuller>(
+            "/home/malte/Documents/vscode/Vulkan3D/shaders/cull.comp.spv",
+            *object_buffer);
+        for (uint32_t object = 0; object < scene.size(); object++) {
+          auto& mesh = scene.mesh(object);
+          gpu_culler->add(pipeline_for(mesh), mesh, scene.material(object),
+                          scene.to_world(object));
+        }
+        gpu_culler->build();
+      } else {
+        std::cerr << "GPU culling is not supported, culling on the CPU\n";
+      }
+    }
 
-  void create_pipeline() {
-    auto vertex_shader = VulkanLayer::get_instance().create_shader_stage(
-        "/home/malte/Documents/vscode/Vulkan3D/shaders/shader.vert.spv",
-        vk::ShaderStageFlagBits::eVertex);
-    auto frag_shader = VulkanLayer::get_instance().create_shader_stage(
-        "/home/malte/Documents/vscode/Vulkan3D/shaders/shader.frag.spv",
-        vk::ShaderStageFlagBits::eFragment);
+    UploadManager::get_instance().flush();
 
-    std::vector<vk::PipelineShaderStageCreateInfo> shader_stages{vertex_shader,
-                                                                 frag_shader};
+    pipeline_cache.release_shader_modules();
+    if (!pipeline_cache.save()) {
+      std::cerr << "Failed to write " << settings.pipeline_cache_path << "\n";
+    }
+    std::cout << "Pipelines: " << pipeline_cache.compiled_count.load()
+              << " compiled, cache "
+              << (pipeline_cache.loaded_from_disk ? "loaded from disk"
+                                                  : "started empty")
+              << "\n";
+
+    auto& descriptor_allocator = DescriptorAllocator::get_instance();
+    auto& layout_cache = DescriptorLayoutCache::get_instance();
+    std::cout << "Descriptors: " << descriptor_allocator.allocated_sets
+              << " sets in " << descriptor_allocator.pool_count()
+              << " pools, " << layout_cache.layout_count() << " layouts ("
+              << layout_cache.hits << " cache hits)\n";
+  }
 
-    std::vector<vk::DynamicState> dynamic_states{vk::DynamicState::eViewport,
-                                                 vk::DynamicState::eScissor};
-    vk::PipelineDynamicStateCreateInfo dynamic_state_info({}, dynamic_states);
+  void create_frame_data() {
+    auto& vulkan_layer = VulkanLayer::get_instance();
+    for (uint32_t i = 0; i < VulkanLayer::frames_in_flight; i++) {
+      FrameData frame;
+      frame.cmd_pool = vulkan_layer.create_command_pool(
+          vulkan_layer.graphics_queue_family,
+          vk::CommandPoolCreateFlagBits::eTransient);
+      frame.cmd_buffer = vulkan_layer.create_command_buffer(frame.cmd_pool);
+      frame.secondary_pools =
+          ThreadCommandPools(vulkan_layer.graphics_queue_family);
+      frame.sync = SyncStructres{
+          .render_fence = vulkan_layer.create_fence(),
+          .aquire_sem = vulkan_layer.create_semaphore(),
+          .render_sem = vulkan_layer.create_semaphore(),
+      };
+      frames.push_back(std::move(frame));
+    }
+  }
 
-    vk::PipelineViewportStateCreateInfo viewport_state;
-    viewport_state.viewportCount = 1;
-    viewport_state.scissorCount = 1;
+  // Scattered through the box the models stand in, a quarter of them spot
+  // lights pointing down. Seeded, so headless frames stay comparable.
+  void create_lights() {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (uint32_t i = 0; i < settings.lights; i++) {
+      glm::vec3 position(unit(rng) * 8.0f - 4.0f, unit(rng) * 3.0f - 1.0f,
+                         -unit(rng) * 8.0f - 1.0f);
+      glm::vec3 color =
+          glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 0.1f);
+      float range = 0.3f + unit(rng) * 0.6f;
+      if (i % 4 == 0) {
+        glm::vec3 direction(unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f);
+        float outer_angle = glm::radians(25.0f + unit(rng) * 20.0f);
+        lights.push_back(Light::spot(position, direction, range * 2.0f,
+                                     color * 2.0f, outer_angle * 0.7f,
+                                     outer_angle));
+      } else {
+        lights.push_back(Light::point(position, range, color));
+      }
+    }
+  }
 
+  vk::Format get_color_format() {
+    if (display) {
+      return display->swapchain.get_swapchain_image_format();
+    }
+    return offscreen->get_color_format();
+  }
+
+  // Shared by the scene pipelines of all vertex formats.
+  void create_pipeline_layout() {
     vk::PipelineLayoutCreateInfo layout_ci;
-    layout_ci.pushConstantRangeCount = 0;
+    std::vector<vk::PushConstantRange> push_constant_ranges{
+        Material::get_push_constant_range(), Mesh::get_push_constant_range()};
+    layout_ci.setPushConstantRanges(push_constant_ranges);
     std::vector<vk::DescriptorSetLayout> desc_set_layouts{
-        Mesh::get_descriptor_set_layout(),
+        ObjectBuffer::get_descriptor_set_layout(),
         Material::get_descriptor_set_layout()};
     layout_ci.setSetLayouts(desc_set_layouts);
     pipeline_layout =
         VulkanLayer::get_instance().device.createPipelineLayout(layout_ci);
+  }
 
-    vk::VertexInputBindingDescription vertex_binding_info;
-    vertex_binding_info.binding = 0;
-    vertex_binding_info.stride = sizeof(Vertex);
-    vertex_binding_info.inputRate = vk::VertexInputRate::eVertex;
-
-    vk::VertexInputAttributeDescription vert_pos_att_info;
-    vert_pos_att_info.binding = 0;
-    vert_pos_att_info.format = vk::Format::eR32G32B32Sfloat;
-    vert_pos_att_info.location = 0;
-    vert_pos_att_info.offset = 0;
-
-    vk::VertexInputAttributeDescription vert_normal_att_info;
-    vert_normal_att_info.binding = 0;
-    vert_normal_att_info.format = vk::Format::eR32G32B32Sfloat;
-    vert_normal_att_info.location = 1;
-    vert_normal_att_info.offset = offsetof(Vertex, normal);
-
-    vk::VertexInputAttributeDescription vert_texcoord_att_info;
-    vert_texcoord_att_info.binding = 0;
-    vert_texcoord_att_info.format = vk::Format::eR32G32Sfloat;
-    vert_texcoord_att_info.location = 2;
-    vert_texcoord_att_info.offset = offsetof(Vertex, tex_coord);
-
-    std::vector<vk::VertexInputAttributeDescription> vert_att_descriptions{
-        vert_pos_att_info, vert_normal_att_info, vert_texcoord_att_info};
-
-    vk::PipelineVertexInputStateCreateInfo vertex_state;
-    vertex_state.vertexBindingDescriptionCount = 1;
-    vertex_state.pVertexBindingDescriptions = &vertex_binding_info;
-    vertex_state.setVertexAttributeDescriptions(vert_att_descriptions);
-
-    vk::PipelineInputAssemblyStateCreateInfo input_assembly_state;
-    input_assembly_state.setTopology(vk::PrimitiveTopology::eTriangleList);
-
-    vk::PipelineRasterizationStateCreateInfo rasterizer_info;
-    rasterizer_info.lineWidth = 1.0f;
-    rasterizer_info.depthClampEnable = false;
-    rasterizer_info.rasterizerDiscardEnable = false;
-    rasterizer_info.polygonMode = vk::PolygonMode::eFill;
-    rasterizer_info.cullMode = vk::CullModeFlagBits::eNone;
-    rasterizer_info.frontFace = vk::FrontFace::eClockwise;
-    rasterizer_info.depthBiasEnable = false;
-
-    vk::PipelineMultisampleStateCreateInfo multisampling;
-    multisampling.sampleShadingEnable = false;
-    multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
-
-    vk::PipelineColorBlendAttachmentState color_attachment_state;
-    color_attachment_state.colorWriteMask =
-        vk::ColorComponentFlagBits::eA | vk::ColorComponentFlagBits::eR |
-        vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB;
-    color_attachment_state.blendEnable = false;
-
-    vk::PipelineColorBlendStateCreateInfo color_blend;
-    color_blend.logicOpEnable = false;
-    color_blend.attachmentCount = 1;
-    color_blend.pAttachments = &color_attachment_state;
-
-    vk::Format swapchain_format =
-        display.swapchain.get_swapchain_image_format();
-    vk::PipelineRenderingCreateInfo rendering_info;
-    rendering_info.colorAttachmentCount = 1;
-    rendering_info.pColorAttachmentFormats = &swapchain_format;
-    rendering_info.depthAttachmentFormat = vk::Format::eD32Sfloat;
-
-    vk::PipelineDepthStencilStateCreateInfo depth_stencial_state;
-    depth_stencial_state.depthTestEnable = true;
-    depth_stencial_state.depthWriteEnable = true;
-    depth_stencial_state.stencilTestEnable = false;
-    depth_stencial_state.maxDepthBounds = 1.f;
-    depth_stencial_state.minDepthBounds = 0.f;
-    depth_stencial_state.depthCompareOp = vk::CompareOp::eLess;
-
-    vk::GraphicsPipelineCreateInfo pipeline_create_info;
-    pipeline_create_info.setStages(shader_stages);
-    pipeline_create_info.layout = pipeline_layout;
-    pipeline_create_info.pDynamicState = &dynamic_state_info;
-    pipeline_create_info.pViewportState = &viewport_state;
-    pipeline_create_info.pVertexInputState = &vertex_state;
-    pipeline_create_info.pInputAssemblyState = &input_assembly_state;
-    pipeline_create_info.pRasterizationState = &rasterizer_info;
-    pipeline_create_info.pColorBlendState = &color_blend;
-    pipeline_create_info.pNext = &rendering_info;
-    pipeline_create_info.pDepthStencilState = &depth_stencial_state;
-
-    auto pipeline_result =
-        VulkanLayer::get_instance().device.createGraphicsPipeline(
-            {}, pipeline_create_info);
-    VK_CHECK(pipeline_result.result);
-    pipeline = pipeline_result.value;
+  // Color attachments of the pass drawing the scene.
+  std::vector<vk::Format> scene_color_formats() {
+    if (settings.deferred) {
+      return GBuffer::color_formats();
+    }
+    return {get_color_format()};
   }
 
-  void draw(vk::CommandBuffer& cmd_buffer, const SyncStructres& sync_struct,
-            const int& frame_number) {
-    VK_CHECK(VulkanLayer::get_instance().device.waitForFences(
-        1, &sync_struct.render_fence, true, UINT32_MAX));
-    VulkanLayer::get_instance().device.resetFences({sync_struct.render_fence});
+  // Describes the pipeline drawing meshes in format.
+  GraphicsPipelineDesc create_pipeline_desc(VertexFormat format) {
+    GraphicsPipelineDesc desc;
+    desc.vertex_shader =
+        "/home/malte/Documents/vscode/Vulkan3D/shaders/shader.vert.spv";
+    desc.fragment_shader =
+        settings.deferred
+            ? "/home/malte/Documents/vscode/Vulkan3D/shaders/gbuffer.frag.spv"
+            : "/home/malte/Documents/vscode/Vulkan3D/shaders/shader.frag.spv";
+    desc.layout = pipeline_layout;
+    // OBJ faces wind counter-clockwise seen from outside, which the flipped
+    // y of the projection keeps counter-clockwise on screen.
+    desc.cull_mode = vk::CullModeFlagBits::eBack;
+    desc.front_face = vk::FrontFace::eCounterClockwise;
+    Mesh::describe_vertex_input(format, desc);
+    desc.color_formats = scene_color_formats();
+    desc.depth_format = vk::Format::eD32Sfloat;
+    return desc;
+  }
 
-    cmd_buffer.reset();
-    vk::CommandBufferBeginInfo cmd_begin_info;
-    cmd_buffer.begin(cmd_begin_info);
+  vk::Pipeline pipeline_for(const Mesh& mesh) {
+    return pipelines[static_cast<uint32_t>(mesh.vertex_format)];
+  }
 
-    auto aquire_result_value =
-        VulkanLayer::get_instance().device.acquireNextImageKHR(
-            display.swapchain.swapchain, UINT64_MAX, {sync_struct.aquire_sem},
-            {});
+  // Records the scene into color_view/depth_view, or through the GBuffer
+  // into color_view. Leaves the color image in eColorAttachmentOptimal,
+  // transitions out of it are up to the caller.
+  void record_scene(FrameData& frame, const ImageView& color_view,
+                    const ImageView& depth_view, const vk::Extent2D& extend,
+                    uint32_t frame_index) {
+    auto& cmd_buffer = frame.cmd_buffer;
+    static auto startTime = std::chrono::high_resolution_clock::now();
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    float time = std::chrono::duration<float, std::chrono::seconds::period>(
+                     currentTime - startTime)
+                     .count();
 
-    VK_CHECK(aquire_result_value.result);
-    uint32_t swapchain_index = aquire_result_value.value;
+    auto cam_proj_data = camera->get_projection_data();
+
+    scene.set_local_transform(
+        rotating_entity,
+        rotating_base *
+            glm::rotate(glm::radians(time * 45.f), glm::vec3(0, 1, 0)));
+    scene.update();
+
+    // Every material lives in this one set, draws only push their slot.
+    auto& bindless_materials = BindlessMaterials::get_instance();
+    bindless_materials.update(frame_index);
+
+    object_buffer->begin_frame(frame_index, cam_proj_data.view,
+                               cam_proj_data.projection);
+
+    // Compute work has to be recorded outside of rendering.
+    if (light_clusters) {
+      light_clusters->begin_frame(frame_index, cam_proj_data.view,
+                                  cam_proj_data.projection, camera->clip_near,
+                                  camera->clip_far);
+      glm::mat4 orbit =
+          glm::translate(light_center) *
+          glm::rotate(glm::radians(time * 15.f), glm::vec3(0, 1, 0)) *
+          glm::translate(-light_center);
+      for (Light light : lights) {
+        light.position = glm::vec3(orbit * glm::vec4(light.position, 1.0f));
+        light.direction = glm::mat3(orbit) * light.direction;
+        light_clusters->push(light);
+      }
+      light_clusters->record_cull(cmd_buffer);
+    }
 
+    if (gpu_culler) {
+      for (uint32_t object : scene.changed_objects()) {
+        gpu_culler->set_transform(object, scene.to_world(object));
+      }
+      gpu_culler->record_cull(cmd_buffer, frame_index, cam_proj_data.view,
+                              cam_proj_data.projection, extend.height);
+    } else {
+      batch_visible_models(cam_proj_data.view, cam_proj_data.projection,
+                           extend);
+    }
+
+    // Source stages chain onto the acquire semaphore wait and onto the
+    // previous frame, which may still be using the shared depth image.
     VulkanLayer::get_instance().record_layout_transition(
-        cmd_buffer,
-        display.swapchain.swapchain_image_views[swapchain_index].image.image,
-        vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal,
-        vk::PipelineStageFlagBits::eTopOfPipe,
+        cmd_buffer, color_view.image.image, vk::ImageLayout::eUndefined,
+        vk::ImageLayout::eColorAttachmentOptimal,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
         vk::PipelineStageFlagBits::eColorAttachmentOutput,
         vk::AccessFlagBits::eNone, vk::AccessFlagBits::eColorAttachmentWrite,
         vk::ImageAspectFlagBits::eColor);
 
+    if (gbuffer) {
+      gbuffer->record_begin_geometry(cmd_buffer);
+    } else {
+      VulkanLayer::get_instance().record_layout_transition(
+          cmd_buffer, depth_view.image.image, vk::ImageLayout::eUndefined,
+          vk::ImageLayout::eDepthAttachmentOptimal,
+          vk::PipelineStageFlagBits::eLateFragmentTests,
+          vk::PipelineStageFlagBits::eEarlyFragmentTests |
+              vk::PipelineStageFlagBits::eLateFragmentTests,
+          vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+          vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+          vk::ImageAspectFlagBits::eDepth);
+    }
+
     vk::RenderingAttachmentInfoKHR color_att_info;
     color_att_info.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
-    color_att_info.imageView =
-        display.swapchain.swapchain_image_views[swapchain_index].view;
+    color_att_info.imageView = color_view.view;
     color_att_info.loadOp = vk::AttachmentLoadOp::eClear;
     color_att_info.storeOp = vk::AttachmentStoreOp::eStore;
     color_att_info.setClearValue(vk::ClearValue({1.f, 1.f, 0.f, 1.f}));
@@ -221,60 +413,179 @@ class TMP {
     vk::RenderingAttachmentInfoKHR depth_att_info;
     depth_att_info.clearValue = vk::ClearValue({1, 0});
     depth_att_info.imageLayout = vk::ImageLayout::eDepthAttachmentOptimal;
-    depth_att_info.imageView = display.swapchain.depth_image_view.view;
+    depth_att_info.imageView = depth_view.view;
     depth_att_info.loadOp = vk::AttachmentLoadOp::eClear;
     depth_att_info.storeOp = vk::AttachmentStoreOp::eDontCare;
 
-    auto swapchain_extend = display.swapchain.get_surface_extend();
+    // The deferred path draws into the GBuffer, color_view is written by
+    // the lighting pass.
+    std::vector<vk::RenderingAttachmentInfoKHR> scene_color_atts{
+        color_att_info};
+    if (gbuffer) {
+      scene_color_atts = gbuffer->color_attachments();
+      depth_att_info = gbuffer->depth_attachment();
+    }
 
     vk::RenderingInfoKHR rendering_info;
-    rendering_info.setColorAttachmentCount(1);
-    rendering_info.setPColorAttachments(&color_att_info);
+    rendering_info.setColorAttachments(scene_color_atts);
     rendering_info.layerCount = 1;
     rendering_info.setViewMask(0);
-    rendering_info.setRenderArea(vk::Rect2D({0, 0}, swapchain_extend));
+    rendering_info.setRenderArea(vk::Rect2D({0, 0}, extend));
     rendering_info.pDepthAttachment = &depth_att_info;
 
-    cmd_buffer.beginRendering(rendering_info);
+    if (gpu_culler) {
+      cmd_buffer.beginRendering(rendering_info);
+      bind_draw_state(cmd_buffer, extend);
+      gpu_culler->record_draw(cmd_buffer, pipeline_layout, frame_index);
+      object_buffer->end_frame();
+    } else {
+      // The transforms are computed while the draws are being recorded.
+      auto transforms_done = ThreadPool::get_instance().submit(
+          [this] { object_buffer->end_frame(); });
+      auto secondaries = record_model_jobs(frame, extend, frame_index);
+      transforms_done.get();
+
+      rendering_info.flags =
+          vk::RenderingFlagBits::eContentsSecondaryCommandBuffers;
+      cmd_buffer.beginRendering(rendering_info);
+      cmd_buffer.executeCommands(secondaries);
+    }
+
+    cmd_buffer.endRendering();
 
-    cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    if (gbuffer) {
+      gbuffer->record_end_geometry(cmd_buffer);
+
+      vk::RenderingInfoKHR lighting_info;
+      lighting_info.setColorAttachments(color_att_info);
+      lighting_info.layerCount = 1;
+      lighting_info.setRenderArea(vk::Rect2D({0, 0}, extend));
+      cmd_buffer.beginRendering(lighting_info);
+      lighting->record(cmd_buffer, *gbuffer, *light_clusters);
+      cmd_buffer.endRendering();
+    }
+  }
 
+  // Viewport and material state every draw command buffer starts with.
+  void bind_draw_state(vk::CommandBuffer& cmd_buffer,
+                       const vk::Extent2D& extend) {
     vk::Viewport viewport;
     viewport.x = 0.0f;
     viewport.y = 0.0f;
-    viewport.width = swapchain_extend.width;
-    viewport.height = swapchain_extend.height;
+    viewport.width = extend.width;
+    viewport.height = extend.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     cmd_buffer.setViewport(0, 1, &viewport);
 
-    cmd_buffer.setScissor(0, 1, &rendering_info.renderArea);
+    vk::Rect2D scissor({0, 0}, extend);
+    cmd_buffer.setScissor(0, 1, &scissor);
 
-    static auto startTime = std::chrono::high_resolution_clock::now();
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(
-                     currentTime - startTime)
-                     .count();
+    BindlessMaterials::get_instance().bind(cmd_buffer, pipeline_layout, 1);
+  }
 
-    auto cam_proj_data = camera.get_projection_data();
+  // CPU path: culls the scene, picks a level of detail for every visible
+  // model and sorts them into groups. Full detail models are culled by
+  // meshlet if multi draw indirect is available.
+  void batch_visible_models(const glm::mat4& view,
+                            const glm::mat4& projection,
+                            const vk::Extent2D& extend) {
+    visible_objects.clear();
+    Frustum frustum = Frustum::from_matrix(projection * view);
+    scene.cull(frustum, visible_objects);
+
+    lod_selector.begin(view, projection, extend.height);
+    for (uint32_t object : visible_objects) {
+      auto& mesh = scene.mesh(object);
+      const auto& to_world = scene.to_world(object);
+      instance_batcher.add(pipeline_for(mesh), mesh, scene.material(object),
+                           to_world,
+                           lod_selector.select(object, mesh, to_world));
+    }
+    bool cull_meshlets = VulkanLayer::get_instance().gpu_driven_rendering;
+    instance_batcher.build(*object_buffer, view,
+                           cull_meshlets ? &frustum : nullptr);
+  }
 
-    auto& mesh = models[1].mesh;
-    auto old_mat = mesh.entity_to_world;
-    mesh.entity_to_world =
-        old_mat * glm::rotate(glm::radians(time * 45.f), glm::vec3(0, 1, 0));
+  // Records the groups of instance_batcher into secondary command buffers,
+  // one job per contiguous range of groups, returned in group order.
+  std::vector<vk::CommandBuffer> record_model_jobs(FrameData& frame,
+                                                   const vk::Extent2D& extend,
+                                                   uint32_t frame_index) {
+    // Fewer groups are not worth a command buffer of their own.
+    constexpr size_t groups_per_job = 64;
+    auto& thread_pool = ThreadPool::get_instance();
+    size_t group_count = instance_batcher.group_count();
+    size_t job_count = std::clamp<size_t>(group_count / groups_per_job, 1,
+                                          2 * (thread_pool.thread_count() + 1));
+
+    auto color_formats = scene_color_formats();
+    vk::CommandBufferInheritanceRenderingInfo inheritance_rendering;
+    inheritance_rendering.setColorAttachmentFormats(color_formats);
+    inheritance_rendering.depthAttachmentFormat = vk::Format::eD32Sfloat;
+    inheritance_rendering.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+    vk::CommandBufferInheritanceInfo inheritance;
+    inheritance.pNext = &inheritance_rendering;
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                       vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    begin_info.pInheritanceInfo = &inheritance;
+
+    std::vector<vk::CommandBuffer> secondaries(job_count);
+    thread_pool.parallel_for(job_count, [&](size_t job) {
+      auto cmd_buffer = frame.secondary_pools.allocate_secondary();
+      cmd_buffer.begin(begin_info);
+      bind_draw_state(cmd_buffer, extend);
+      object_buffer->bind(cmd_buffer, pipeline_layout, 0);
+      instance_batcher.record(cmd_buffer, pipeline_layout, frame_index,
+                              group_count * job / job_count,
+                              group_count * (job + 1) / job_count);
+      cmd_buffer.end();
+      secondaries[job] = cmd_buffer;
+    });
+    return secondaries;
+  }
 
-    for (Model& model : models) {
-      model.record_draw(cmd_buffer, pipeline_layout, cam_proj_data.view,
-                        cam_proj_data.projection);
-    }
+  void draw(const int& frame_number) {
+    uint32_t frame_index = frame_number % frames.size();
+    FrameData& frame = frames[frame_index];
+    auto& cmd_buffer = frame.cmd_buffer;
+    const auto& sync_struct = frame.sync;
 
-    mesh.entity_to_world = old_mat;
+    // Only blocks if the GPU is frames_in_flight frames behind.
+    VK_CHECK(VulkanLayer::get_instance().device.waitForFences(
+        1, &sync_struct.render_fence, true, UINT64_MAX));
+    VulkanLayer::get_instance().device.resetFences({sync_struct.render_fence});
 
-    cmd_buffer.endRendering();
+    // Uploads queued since the last frame are ordered before this frame's
+    // submission on the graphics queue.
+    TextureStreamer::get_instance().update();
+    UploadManager::get_instance().flush();
+
+    VulkanLayer::get_instance().device.resetCommandPool(frame.cmd_pool);
+    frame.secondary_pools.reset();
+    vk::CommandBufferBeginInfo cmd_begin_info;
+    cmd_begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd_buffer.begin(cmd_begin_info);
+
+    auto aquire_result_value =
+        VulkanLayer::get_instance().device.acquireNextImageKHR(
+            display->swapchain.swapchain, UINT64_MAX, {sync_struct.aquire_sem},
+            {});
+
+    VK_CHECK(aquire_result_value.result);
+    uint32_t swapchain_index = aquire_result_value.value;
+
+    auto& swapchain_view =
+        display->swapchain.swapchain_image_views[swapchain_index];
+    record_scene(frame, swapchain_view,
+                 display->swapchain.depth_image_view,
+                 display->swapchain.get_surface_extend(), frame_index);
 
     VulkanLayer::get_instance().record_layout_transition(
-        cmd_buffer,
-        display.swapchain.swapchain_image_views[swapchain_index].image.image,
+        cmd_buffer, swapchain_view.image.image,
         vk::ImageLayout::eColorAttachmentOptimal,
         vk::ImageLayout::ePresentSrcKHR,
         vk::PipelineStageFlagBits::eColorAttachmentOutput,
@@ -301,7 +612,7 @@ class TMP {
     vk::PresentInfoKHR present_info;
     present_info.pImageIndices = &swapchain_index;
     present_info.swapchainCount = 1;
-    present_info.pSwapchains = &display.swapchain.swapchain;
+    present_info.pSwapchains = &display->swapchain.swapchain;
     present_info.waitSemaphoreCount = 1;
     present_info.pWaitSemaphores = &sync_struct.render_sem;
 
@@ -312,40 +623,174 @@ class TMP {
     }
   }
 
+  // Renders one frame into the offscreen target and blocks until it, and the
+  // readback of its color image, finished on the GPU. There is only one
+  // readback buffer, so headless frames are not overlapped.
+  void draw_offscreen(const int& frame_number) {
+    uint32_t frame_index = frame_number % frames.size();
+    FrameData& frame = frames[frame_index];
+    auto& cmd_buffer = frame.cmd_buffer;
+    const auto& render_fence = frame.sync.render_fence;
+
+    VulkanLayer::get_instance().device.resetFences({render_fence});
+
+    TextureStreamer::get_instance().update();
+    UploadManager::get_instance().flush();
+
+    VulkanLayer::get_instance().device.resetCommandPool(frame.cmd_pool);
+    frame.secondary_pools.reset();
+    vk::CommandBufferBeginInfo cmd_begin_info;
+    cmd_begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd_buffer.begin(cmd_begin_info);
+
+    record_scene(frame, offscreen->color_image_view,
+                 offscreen->depth_image_view, offscreen->get_extent(),
+                 frame_index);
+
+    offscreen->record_readback(cmd_buffer);
+
+    cmd_buffer.end();
+
+    vk::SubmitInfo sub_info;
+    sub_info.commandBufferCount = 1;
+    sub_info.pCommandBuffers = &cmd_buffer;
+    VulkanLayer::get_instance().graphics_queue.submit(sub_info, render_fence);
+
+    VK_CHECK(VulkanLayer::get_instance().device.waitForFences(
+        1, &render_fence, true, UINT64_MAX));
+  }
+
+  void run_headless() {
+    // Keeps the output independent of how fast textures stream in.
+    TextureStreamer::get_instance().wait_idle();
+
+    double total_ms = 0;
+    for (int frame_number = 0; frame_number < settings.frames;
+         frame_number++) {
+      auto frame_start = std::chrono::high_resolution_clock::now();
+      draw_offscreen(frame_number);
+      auto frame_end = std::chrono::high_resolution_clock::now();
+      total_ms += std::chrono::duration<double, std::milli>(frame_end -
+                                                            frame_start)
+                      .count();
+    }
+
+    if (settings.frames > 0) {
+      std::cout << "Rendered " << settings.frames << " frames, "
+                << total_ms / settings.frames << " ms/frame on average\n";
+      if (gpu_culler) {
+        std::cout << "GPU culling: " << gpu_culler->visible_count << " of "
+                  << gpu_culler->object_count() << " objects visible, "
+                  << gpu_culler->batch_count()
+                  << " indirect draws, meshlets not used\n";
+      } else {
+        std::cout << "Last frame: " << scene.visible_count << " of "
+                  << scene.size() << " objects visible, "
+                  << scene.tested_count << " tested individually, "
+                  << instance_batcher.instance_count << " objects in "
+                  << instance_batcher.draw_count << " draws\n";
+        std::cout << "Binds: " << instance_batcher.pipeline_binds
+                  << " pipeline, " << instance_batcher.material_binds
+                  << " material, " << instance_batcher.mesh_binds
+                  << " mesh, " << instance_batcher.skipped_binds
+                  << " skipped\n";
+        std::cout << "LODs: " << lod_selector.triangle_count << " of "
+                  << lod_selector.full_triangle_count << " triangles\n";
+        std::cout << "Meshlets: " << instance_batcher.visible_meshlet_count
+                  << " of " << instance_batcher.meshlet_count
+                  << " visible\n";
+      }
+      if (light_clusters) {
+        std::cout << "Lights: " << light_clusters->light_count()
+                  << " binned, " << light_clusters->overflowed_clusters()
+                  << " clusters over " << LightGrid::max_lights_per_cluster
+                  << " dropped lights\n";
+      }
+
+      if (!offscreen->write_ppm(settings.output_path)) {
+        std::cerr << "Failed to write " << settings.output_path << "\n";
+      }
+    }
+  }
+
   void run() {
+    if (settings.headless) {
+      run_headless();
+      return;
+    }
+
     SDL_Event e;
     bool bQuit = false;
 
-    auto cmd_buffer = VulkanLayer::get_instance().create_command_buffer(
-        VulkanLayer::get_instance().graphics_command_pool);
-    SyncStructres sync_structs{
-        .render_fence = VulkanLayer::get_instance().create_fence(),
-        .aquire_sem = VulkanLayer::get_instance().create_semaphore(),
-        .render_sem = VulkanLayer::get_instance().create_semaphore(),
-    };
-
     int frame_number = 0;
 
     // main loop
     while (!bQuit) {
       // Handle events on queue
       while (SDL_PollEvent(&e) != 0) {
-        camera.sdl_event_handler(e);
+        camera->sdl_event_handler(e);
         // close the window when user clicks the X button or alt-f4s
         if (e.type == SDL_QUIT ||
             (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE))
           bQuit = true;
       }
-      camera.sdl_handle_tick();
+      camera->sdl_handle_tick();
 
-      draw(cmd_buffer, sync_structs, frame_number);
+      draw(frame_number);
       frame_number += 1;
     }
   }
 };
 
-int main() {
-  auto test = TMP();
+RenderSettings parse_args(int argc, char* argv[]) {
+  RenderSettings settings;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--headless") {
+      settings.headless = true;
+    } else if (arg == "--frames" && has_value) {
+      settings.frames = std::stoi(argv[++i]);
+    } else if (arg == "--width" && has_value) {
+      settings.extent.width = std::stoul(argv[++i]);
+    } else if (arg == "--height" && has_value) {
+      settings.extent.height = std::stoul(argv[++i]);
+    } else if (arg == "--output" && has_value) {
+      settings.output_path = argv[++i];
+    } else if (arg == "--forward") {
+      settings.deferred = false;
+    } else if (arg == "--lights" && has_value) {
+      // The light buffer has room for max_lights per frame.
+      unsigned long lights = std::stoul(argv[++i]);
+      if (lights > LightClusters::max_lights) {
+        std::cerr << "Clamping --lights " << lights << " to "
+                  << LightClusters::max_lights << "\n";
+        lights = LightClusters::max_lights;
+      }
+      settings.lights = lights;
+    } else if (arg == "--cpu-light-culling") {
+      settings.gpu_light_culling = false;
+    } else if (arg == "--gpu-culling") {
+      settings.gpu_culling = true;
+    } else if (arg == "--copies" && has_value) {
+      settings.copies = std::stoul(argv[++i]);
+    } else if (arg == "--pipeline-cache" && has_value) {
+      settings.pipeline_cache_path = argv[++i];
+    } else if (arg == "--frames-in-flight" && has_value) {
+      settings.frames_in_flight = std::max(1, std::stoi(argv[++i]));
+    } else {
+      std::cerr << "Ignoring unknown argument: " << arg << "\n";
+    }
+  }
+  return settings;
+}
+
+int main(int argc, char* argv[]) {
+  auto settings = parse_args(argc, argv);
+  VulkanLayer::headless = settings.headless;
+  VulkanLayer::frames_in_flight = settings.frames_in_flight;
+
+  auto test = TMP(settings);
   test.run();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "offscreen_layer.h"
+
+#include <cstring>
+#include <fstream>
+
+OffscreenTarget::OffscreenTarget(const vk::Extent2D& extent,
+                                 vk::Format color_format)
+    : extent{extent}, color_format{color_format} {
+  color_image_view = VulkanLayer::get_instance().create_2d_image_view(
+      extent, color_format,
+      vk::ImageUsageFlagBits::eColorAttachment |
+          vk::ImageUsageFlagBits::eTransferSrc,
+      vk::ImageAspectFlagBits::eColor, VMA_MEMORY_USAGE_GPU_ONLY);
+
+  depth_image_view = VulkanLayer::get_instance().create_2d_image_view(
+      extent, vk::Format::eD32Sfloat,
+      vk::ImageUsageFlagBits::eDepthStencilAttachment,
+      vk::ImageAspectFlagBits::eDepth, VMA_MEMORY_USAGE_GPU_ONLY);
+
+  readback_buffer = VulkanLayer::get_instance().create_buffer(
+      vk::DeviceSize(extent.width) * extent.height * 4,
+      vk::BufferUsageFlagBits::eTransferDst, VMA_MEMORY_USAGE_GPU_TO_CPU);
+  readback_buffer.map(readback_ptr);
+}
+
+void OffscreenTarget::record_readback(vk::CommandBuffer& cmd_buffer) {
+  VulkanLayer::get_instance().record_layout_transition(
+      cmd_buffer, color_image_view.image.image,
+      vk::ImageLayout::eColorAttachmentOptimal,
+      vk::ImageLayout::eTransferSrcOptimal,
+      vk::PipelineStageFlagBits::eColorAttachmentOutput,
+      vk::PipelineStageFlagBits::eTransfer,
+      vk::AccessFlagBits::eColorAttachmentWrite,
+      vk::AccessFlagBits::eTransferRead, vk::ImageAspectFlagBits::eColor);
+
+  vk::BufferImageCopy region;
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = vk::Offset3D();
+  region.imageExtent = vk::Extent3D(extent.width, extent.height, 1);
+
+  cmd_buffer.copyImageToBuffer(color_image_view.image.image,
+                               vk::ImageLayout::eTransferSrcOptimal,
+                               readback_buffer.buffer, 1, &region);
+
+  vk::BufferMemoryBarrier host_barrier;
+  host_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  host_barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+  host_barrier.buffer = readback_buffer.buffer;
+  host_barrier.offset = 0;
+  host_barrier.size = VK_WHOLE_SIZE;
+  cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                             vk::PipelineStageFlagBits::eHost, {}, {},
+                             host_barrier, {});
+}
+
+std::vector<uint8_t> OffscreenTarget::read_pixels() {
+  readback_buffer.invalidate();
+
+  size_t size = size_t(extent.width) * extent.height * 4;
+  std::vector<uint8_t> pixels(size);
+  std::memcpy(pixels.data(), readback_ptr, size);
+
+  // The swapchain path renders to BGRA, keep the host side RGBA either way.
+  if (color_format == vk::Format::eB8G8R8A8Srgb ||
+      color_format == vk::Format::eB8G8R8A8Unorm) {
+    for (size_t i = 0; i < size; i += 4) {
+      std::swap(pixels[i], pixels[i + 2]);
+    }
+  }
+  return pixels;
+}
+
+bool OffscreenTarget::write_ppm(const std::string& path) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  auto pixels = read_pixels();
+  file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+  for (size_t i = 0; i < pixels.size(); i += 4) {
+    file.write(reinterpret_cast<const char*>(&pixels[i]), 3);
+  }
+  return file.good();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../vulkan_layer/vulkan_layer.h"
+
+// Render target for headless rendering. Replaces Display/SwapchainLayer on
+// machines without a window system: color and depth live in VMA images and
+// the color result can be copied back to the host through a staging buffer.
+class OffscreenTarget {
+ public:
+  ImageView color_image_view;
+  ImageView depth_image_view;
+
+  OffscreenTarget(){};
+  OffscreenTarget(const vk::Extent2D& extent,
+                  vk::Format color_format = vk::Format::eR8G8B8A8Srgb);
+
+  vk::Extent2D get_extent() const { return extent; }
+
+  vk::Format get_color_format() const { return color_format; }
+
+  // Expects the color image in eColorAttachmentOptimal. Leaves it in
+  // eTransferSrcOptimal with the pixels queued for copy to the readback
+  // buffer.
+  void record_readback(vk::CommandBuffer& cmd_buffer);
+
+  // Tightly packed RGBA8 rows. Only valid once the command buffer that
+  // recorded the readback has finished executing.
+  std::vector<uint8_t> read_pixels();
+
+  // Writes the last read back frame as binary PPM.
+  bool write_ppm(const std::string& path);
+
+ private:
+  vk::Extent2D extent;
+  vk::Format color_format;
+
+  Buffer readback_buffer;
+  void* readback_ptr;
+};
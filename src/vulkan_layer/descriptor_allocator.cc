@@ -0,0 +1,148 @@
+#include "descriptor_allocator.h"
+
+#include <algorithm>
+#include <functional>
+
+bool DescriptorLayoutCache::LayoutKey::operator==(
+    const LayoutKey& other) const {
+  if (flags != other.flags || bindings.size() != other.bindings.size() ||
+      binding_flags != other.binding_flags) {
+    return false;
+  }
+  for (size_t i = 0; i < bindings.size(); i++) {
+    const auto& a = bindings[i];
+    const auto& b = other.bindings[i];
+    if (a.binding != b.binding || a.descriptorType != b.descriptorType ||
+        a.descriptorCount != b.descriptorCount ||
+        a.stageFlags != b.stageFlags ||
+        a.pImmutableSamplers != b.pImmutableSamplers) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t DescriptorLayoutCache::LayoutKeyHash::operator()(
+    const LayoutKey& key) const {
+  size_t hash = std::hash<uint32_t>()(uint32_t(key.flags));
+  auto combine = [&hash](size_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+  };
+  for (const auto& binding : key.bindings) {
+    combine(binding.binding);
+    combine(uint32_t(binding.descriptorType));
+    combine(binding.descriptorCount);
+    combine(uint32_t(binding.stageFlags));
+  }
+  for (auto binding_flags : key.binding_flags) {
+    combine(uint32_t(binding_flags));
+  }
+  return hash;
+}
+
+vk::DescriptorSetLayout DescriptorLayoutCache::get(
+    const DescriptorSetInfo& layout_info) {
+  // Sorted by binding number, binding flags stay next to their binding.
+  std::vector<size_t> order(layout_info.bindings.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return layout_info.bindings[a].binding < layout_info.bindings[b].binding;
+  });
+
+  LayoutKey key{layout_info.info.flags, {}, {}};
+  for (size_t i : order) {
+    key.bindings.push_back(layout_info.bindings[i]);
+    if (!layout_info.binding_flags.empty()) {
+      key.binding_flags.push_back(layout_info.binding_flags[i]);
+    }
+  }
+
+  auto it = layouts.find(key);
+  if (it != layouts.end()) {
+    hits++;
+    return it->second;
+  }
+
+  vk::DescriptorSetLayoutCreateInfo create_info(key.flags, key.bindings);
+  vk::DescriptorSetLayoutBindingFlagsCreateInfo flags_info(key.binding_flags);
+  if (!key.binding_flags.empty()) {
+    create_info.pNext = &flags_info;
+  }
+  auto layout =
+      VulkanLayer::get_instance().device.createDescriptorSetLayout(create_info);
+  layouts.emplace(std::move(key), layout);
+  return layout;
+}
+
+const std::vector<std::pair<vk::DescriptorType, float>>
+    DescriptorAllocator::pool_ratios = {
+        {vk::DescriptorType::eUniformBuffer, 1.0f},
+        {vk::DescriptorType::eUniformBufferDynamic, 1.0f},
+        {vk::DescriptorType::eStorageBuffer, 1.0f},
+        {vk::DescriptorType::eStorageBufferDynamic, 0.5f},
+        {vk::DescriptorType::eCombinedImageSampler, 2.0f},
+        {vk::DescriptorType::eSampledImage, 1.0f},
+        {vk::DescriptorType::eSampler, 0.5f},
+        {vk::DescriptorType::eStorageImage, 0.5f},
+};
+
+vk::DescriptorPool DescriptorAllocator::grab_pool() {
+  if (!free_pools.empty()) {
+    auto pool = free_pools.back();
+    free_pools.pop_back();
+    return pool;
+  }
+
+  std::vector<vk::DescriptorPoolSize> pool_sizes;
+  for (const auto& [type, ratio] : pool_ratios) {
+    pool_sizes.emplace_back(
+        type, std::max(1u, uint32_t(ratio * float(next_pool_sets))));
+  }
+
+  vk::DescriptorPoolCreateInfo pool_info;
+  pool_info.maxSets = next_pool_sets;
+  pool_info.setPoolSizes(pool_sizes);
+  next_pool_sets = std::min(next_pool_sets * 2, max_sets_per_pool);
+
+  return VulkanLayer::get_instance().device.createDescriptorPool(pool_info);
+}
+
+vk::DescriptorSet DescriptorAllocator::allocate(
+    vk::DescriptorSetLayout layout) {
+  auto& device = VulkanLayer::get_instance().device;
+
+  if (used_pools.empty()) {
+    used_pools.push_back(grab_pool());
+  }
+
+  vk::DescriptorSetAllocateInfo alloc_info;
+  alloc_info.descriptorPool = used_pools.back();
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &layout;
+
+  vk::DescriptorSet set;
+  auto result = device.allocateDescriptorSets(&alloc_info, &set);
+  if (result == vk::Result::eErrorOutOfPoolMemory ||
+      result == vk::Result::eErrorFragmentedPool) {
+    used_pools.push_back(grab_pool());
+    alloc_info.descriptorPool = used_pools.back();
+    result = device.allocateDescriptorSets(&alloc_info, &set);
+  }
+  VK_CHECK(result);
+
+  allocated_sets++;
+  return set;
+}
+
+void DescriptorAllocator::reset() {
+  auto& device = VulkanLayer::get_instance().device;
+  for (auto pool : used_pools) {
+    device.resetDescriptorPool(pool);
+    free_pools.push_back(pool);
+  }
+  used_pools.clear();
+  allocated_sets = 0;
+  reset_count++;
+}
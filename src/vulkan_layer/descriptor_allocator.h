@@ -0,0 +1,85 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan_layer.h"
+
+// Deduplicates descriptor set layouts. Layouts are keyed by their create
+// flags, bindings and binding flags (binding order does not matter) and live
+// as long as the device.
+class DescriptorLayoutCache {
+ public:
+  static DescriptorLayoutCache& get_instance() {
+    static DescriptorLayoutCache instance;
+    return instance;
+  }
+
+  vk::DescriptorSetLayout get(const DescriptorSetInfo& layout_info);
+
+  // Statistics for the current process.
+  size_t layout_count() const { return layouts.size(); }
+  uint64_t hits = 0;
+
+ private:
+  struct LayoutKey {
+    vk::DescriptorSetLayoutCreateFlags flags;
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    std::vector<vk::DescriptorBindingFlags> binding_flags;
+
+    bool operator==(const LayoutKey& other) const;
+  };
+
+  struct LayoutKeyHash {
+    size_t operator()(const LayoutKey& key) const;
+  };
+
+  std::unordered_map<LayoutKey, vk::DescriptorSetLayout, LayoutKeyHash>
+      layouts;
+
+  DescriptorLayoutCache() {}
+};
+
+// Allocates descriptor sets from a growing list of pools. Every pool has
+// room for twice the sets of the one before, up to max_sets_per_pool.
+//
+// get_instance() holds sets that live as long as their owner. Transient sets
+// belong in an allocator of their own, reset() once the GPU is done with
+// them, which recycles all pools at once.
+class DescriptorAllocator {
+ public:
+  static DescriptorAllocator& get_instance() {
+    static DescriptorAllocator instance;
+    return instance;
+  }
+
+  static constexpr uint32_t initial_sets_per_pool = 64;
+  static constexpr uint32_t max_sets_per_pool = 4096;
+
+  DescriptorAllocator() {}
+  DescriptorAllocator(const DescriptorAllocator&) = delete;
+  DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+  DescriptorAllocator(DescriptorAllocator&&) = default;
+  DescriptorAllocator& operator=(DescriptorAllocator&&) = default;
+
+  vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+
+  // Invalidates every set allocated so far. The GPU must be done with them.
+  void reset();
+
+  // Statistics since creation, allocated_sets since the last reset().
+  size_t pool_count() const { return used_pools.size() + free_pools.size(); }
+  uint64_t allocated_sets = 0;
+  uint64_t reset_count = 0;
+
+ private:
+  // Descriptors per set of every type a pool provides.
+  static const std::vector<std::pair<vk::DescriptorType, float>> pool_ratios;
+
+  // Pools handed out since the last reset, the last one is allocated from.
+  std::vector<vk::DescriptorPool> used_pools;
+  std::vector<vk::DescriptorPool> free_pools;
+  uint32_t next_pool_sets = initial_sets_per_pool;
+
+  vk::DescriptorPool grab_pool();
+};
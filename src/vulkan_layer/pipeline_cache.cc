@@ -0,0 +1,327 @@
+#include "pipeline_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "../core/hash.h"
+#include "../core/thread_pool.h"
+
+static constexpr char pipeline_cache_magic[4] = {'V', 'K', 'P', 'C'};
+
+// Precedes the driver's data on disk. The driver checks its own header as
+// well, but some drivers do not survive corrupted data, so it is hashed.
+struct PipelineCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t data_size;
+  uint64_t data_hash;
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint32_t driver_version;
+  uint8_t uuid[VK_UUID_SIZE];
+};
+
+static PipelineCacheHeader device_header() {
+  auto properties = VulkanLayer::get_instance().physical_device.getProperties();
+  PipelineCacheHeader header{};
+  std::memcpy(header.magic, pipeline_cache_magic, 4);
+  header.version = PipelineCache::version;
+  header.vendor_id = properties.vendorID;
+  header.device_id = properties.deviceID;
+  header.driver_version = properties.driverVersion;
+  std::memcpy(header.uuid, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+  return header;
+}
+
+template <typename T>
+static void append(std::string& key, const T& value) {
+  key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void append(std::string& key, const std::string& value) {
+  append(key, value.size());
+  key.append(value);
+}
+
+template <typename T>
+static void append(std::string& key, const std::vector<T>& values) {
+  append(key, values.size());
+  for (const auto& value : values) {
+    append(key, value);
+  }
+}
+
+uint64_t GraphicsPipelineDesc::hash() const {
+  std::string key;
+  append(key, vertex_shader);
+  append(key, fragment_shader);
+  append(key, static_cast<VkPipelineLayout>(layout));
+  append(key, bindings);
+  append(key, attributes);
+  append(key, topology);
+  append(key, polygon_mode);
+  append(key, static_cast<VkCullModeFlags>(cull_mode));
+  append(key, front_face);
+  append(key, depth_test);
+  append(key, depth_write);
+  append(key, depth_compare);
+  append(key, color_formats);
+  append(key, depth_format);
+  return hash_bytes(key.data(), key.size());
+}
+
+uint64_t ComputePipelineDesc::hash() const {
+  std::string key;
+  append(key, shader);
+  append(key, static_cast<VkPipelineLayout>(layout));
+  // Keeps it apart from a graphics pipeline with the same bytes.
+  append(key, vk::PipelineBindPoint::eCompute);
+  return hash_bytes(key.data(), key.size());
+}
+
+void PipelineCache::load(const std::string& cache_path) {
+  path = cache_path;
+  auto expected = device_header();
+
+  std::vector<char> data;
+  std::ifstream in(path, std::ios::binary);
+  PipelineCacheHeader header{};
+  if (in.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+      std::memcmp(header.magic, expected.magic, 4) == 0 &&
+      header.version == expected.version &&
+      header.vendor_id == expected.vendor_id &&
+      header.device_id == expected.device_id &&
+      header.driver_version == expected.driver_version &&
+      std::memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) == 0) {
+    // A damaged size must not decide how much gets allocated.
+    auto data_start = in.tellg();
+    in.seekg(0, std::ios::end);
+    auto remaining = in.tellg() - data_start;
+    in.seekg(data_start);
+    if (remaining >= 0 && header.data_size <= uint64_t(remaining)) {
+      data.resize(header.data_size);
+      if (!in.read(data.data(), data.size()) ||
+          hash_bytes(data.data(), data.size()) != header.data_hash) {
+        data.clear();
+      }
+    }
+  }
+
+  vk::PipelineCacheCreateInfo cache_ci;
+  cache_ci.initialDataSize = data.size();
+  cache_ci.pInitialData = data.data();
+  cache = VulkanLayer::get_instance().device.createPipelineCache(cache_ci);
+  loaded_from_disk = !data.empty();
+}
+
+bool PipelineCache::save() {
+  if (!cache) {
+    return false;
+  }
+  auto data = VulkanLayer::get_instance().device.getPipelineCacheData(cache);
+  auto header = device_header();
+  header.data_size = data.size();
+  header.data_hash = hash_bytes(data.data(), data.size());
+
+  // Written next to the final path and renamed, so a crash never leaves a
+  // truncated cache behind.
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!out.good()) {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+vk::ShaderModule PipelineCache::shader_module(const std::string& shader_path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& module = modules[shader_path];
+  if (!module) {
+    module = VulkanLayer::get_instance().read_shader(shader_path);
+  }
+  return module;
+}
+
+void PipelineCache::release_shader_modules() {
+  std::vector<std::shared_future<vk::Pipeline>> in_flight;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [key, pipeline] : pipelines) {
+      in_flight.push_back(pipeline);
+    }
+  }
+  for (auto& pipeline : in_flight) {
+    pipeline.wait();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto& [shader_path, module] : modules) {
+    VulkanLayer::get_instance().device.destroyShaderModule(module);
+  }
+  modules.clear();
+}
+
+template <typename Compile>
+std::shared_future<vk::Pipeline> PipelineCache::find_or_compile(
+    uint64_t key, Compile&& compile, bool async) {
+  auto promise = std::make_shared<std::promise<vk::Pipeline>>();
+  std::shared_future<vk::Pipeline> pipeline;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = pipelines.find(key);
+    if (found != pipelines.end()) {
+      hits++;
+      return found->second;
+    }
+    pipeline = promise->get_future().share();
+    pipelines.emplace(key, pipeline);
+  }
+
+  auto task = [promise, compile]() {
+    try {
+      promise->set_value(compile());
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  };
+  if (async) {
+    ThreadPool::get_instance().submit(task);
+  } else {
+    task();
+  }
+  return pipeline;
+}
+
+void PipelineCache::prefetch(const GraphicsPipelineDesc& desc) {
+  find_or_compile(
+      desc.hash(), [this, desc] { return compile(desc); }, true);
+}
+
+void PipelineCache::prefetch(const ComputePipelineDesc& desc) {
+  find_or_compile(
+      desc.hash(), [this, desc] { return compile(desc); }, true);
+}
+
+vk::Pipeline PipelineCache::get(const GraphicsPipelineDesc& desc) {
+  return find_or_compile(
+             desc.hash(), [this, &desc] { return compile(desc); }, false)
+      .get();
+}
+
+vk::Pipeline PipelineCache::get(const ComputePipelineDesc& desc) {
+  return find_or_compile(
+             desc.hash(), [this, &desc] { return compile(desc); }, false)
+      .get();
+}
+
+vk::Pipeline PipelineCache::compile(const GraphicsPipelineDesc& desc) {
+  vk::PipelineShaderStageCreateInfo vertex_stage;
+  vertex_stage.stage = vk::ShaderStageFlagBits::eVertex;
+  vertex_stage.module = shader_module(desc.vertex_shader);
+  vertex_stage.pName = "main";
+
+  vk::PipelineShaderStageCreateInfo fragment_stage;
+  fragment_stage.stage = vk::ShaderStageFlagBits::eFragment;
+  fragment_stage.module = shader_module(desc.fragment_shader);
+  fragment_stage.pName = "main";
+
+  std::vector<vk::PipelineShaderStageCreateInfo> shader_stages{vertex_stage,
+                                                               fragment_stage};
+
+  std::vector<vk::DynamicState> dynamic_states{vk::DynamicState::eViewport,
+                                               vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dynamic_state_info({}, dynamic_states);
+
+  vk::PipelineViewportStateCreateInfo viewport_state;
+  viewport_state.viewportCount = 1;
+  viewport_state.scissorCount = 1;
+
+  vk::PipelineVertexInputStateCreateInfo vertex_state;
+  vertex_state.setVertexBindingDescriptions(desc.bindings);
+  vertex_state.setVertexAttributeDescriptions(desc.attributes);
+
+  vk::PipelineInputAssemblyStateCreateInfo input_assembly_state;
+  input_assembly_state.setTopology(desc.topology);
+
+  vk::PipelineRasterizationStateCreateInfo rasterizer_info;
+  rasterizer_info.lineWidth = 1.0f;
+  rasterizer_info.depthClampEnable = false;
+  rasterizer_info.rasterizerDiscardEnable = false;
+  rasterizer_info.polygonMode = desc.polygon_mode;
+  rasterizer_info.cullMode = desc.cull_mode;
+  rasterizer_info.frontFace = desc.front_face;
+  rasterizer_info.depthBiasEnable = false;
+
+  vk::PipelineMultisampleStateCreateInfo multisampling;
+  multisampling.sampleShadingEnable = false;
+  multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+  vk::PipelineColorBlendAttachmentState color_attachment_state;
+  color_attachment_state.colorWriteMask =
+      vk::ColorComponentFlagBits::eA | vk::ColorComponentFlagBits::eR |
+      vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB;
+  color_attachment_state.blendEnable = false;
+  std::vector<vk::PipelineColorBlendAttachmentState> color_attachment_states(
+      desc.color_formats.size(), color_attachment_state);
+
+  vk::PipelineColorBlendStateCreateInfo color_blend;
+  color_blend.logicOpEnable = false;
+  color_blend.setAttachments(color_attachment_states);
+
+  vk::PipelineRenderingCreateInfo rendering_info;
+  rendering_info.setColorAttachmentFormats(desc.color_formats);
+  rendering_info.depthAttachmentFormat = desc.depth_format;
+
+  vk::PipelineDepthStencilStateCreateInfo depth_stencial_state;
+  depth_stencial_state.depthTestEnable = desc.depth_test;
+  depth_stencial_state.depthWriteEnable = desc.depth_write;
+  depth_stencial_state.stencilTestEnable = false;
+  depth_stencial_state.maxDepthBounds = 1.f;
+  depth_stencial_state.minDepthBounds = 0.f;
+  depth_stencial_state.depthCompareOp = desc.depth_compare;
+
+  vk::GraphicsPipelineCreateInfo pipeline_create_info;
+  pipeline_create_info.setStages(shader_stages);
+  pipeline_create_info.layout = desc.layout;
+  pipeline_create_info.pDynamicState = &dynamic_state_info;
+  pipeline_create_info.pViewportState = &viewport_state;
+  pipeline_create_info.pVertexInputState = &vertex_state;
+  pipeline_create_info.pInputAssemblyState = &input_assembly_state;
+  pipeline_create_info.pRasterizationState = &rasterizer_info;
+  pipeline_create_info.pMultisampleState = &multisampling;
+  pipeline_create_info.pColorBlendState = &color_blend;
+  pipeline_create_info.pNext = &rendering_info;
+  pipeline_create_info.pDepthStencilState = &depth_stencial_state;
+
+  // The cache is internally synchronized, compiles may run concurrently.
+  auto pipeline_result =
+      VulkanLayer::get_instance().device.createGraphicsPipeline(
+          cache, pipeline_create_info);
+  VK_CHECK(pipeline_result.result);
+  compiled_count++;
+  return pipeline_result.value;
+}
+
+vk::Pipeline PipelineCache::compile(const ComputePipelineDesc& desc) {
+  vk::ComputePipelineCreateInfo pipeline_ci;
+  pipeline_ci.stage.stage = vk::ShaderStageFlagBits::eCompute;
+  pipeline_ci.stage.module = shader_module(desc.shader);
+  pipeline_ci.stage.pName = "main";
+  pipeline_ci.layout = desc.layout;
+
+  auto pipeline_result =
+      VulkanLayer::get_instance().device.createComputePipeline(cache,
+                                                               pipeline_ci);
+  VK_CHECK(pipeline_result.result);
+  compiled_count++;
+  return pipeline_result.value;
+}
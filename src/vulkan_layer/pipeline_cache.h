@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan_layer.h"
+
+// State of a graphics pipeline that differs between the pipelines of the
+// engine. Viewport and scissor are always dynamic, there is no blending and
+// one color attachment per entry of color_formats. Two descriptions with the
+// same hash() share a pipeline.
+struct GraphicsPipelineDesc {
+  std::string vertex_shader;
+  std::string fragment_shader;
+  vk::PipelineLayout layout;
+
+  std::vector<vk::VertexInputBindingDescription> bindings;
+  std::vector<vk::VertexInputAttributeDescription> attributes;
+  vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+
+  vk::PolygonMode polygon_mode = vk::PolygonMode::eFill;
+  vk::CullModeFlags cull_mode = vk::CullModeFlagBits::eNone;
+  vk::FrontFace front_face = vk::FrontFace::eClockwise;
+
+  bool depth_test = true;
+  bool depth_write = true;
+  vk::CompareOp depth_compare = vk::CompareOp::eLess;
+
+  std::vector<vk::Format> color_formats;
+  vk::Format depth_format = vk::Format::eD32Sfloat;
+
+  uint64_t hash() const;
+};
+
+struct ComputePipelineDesc {
+  std::string shader;
+  vk::PipelineLayout layout;
+
+  uint64_t hash() const;
+};
+
+// Owns every pipeline of the engine, keyed by the hash of its description,
+// and the vk::PipelineCache they are compiled through. The driver's cache
+// data is kept on disk between runs together with the device it was written
+// for, so pipelines compiled before are only looked up.
+//
+// prefetch() compiles on the ThreadPool ahead of use, get() waits for that
+// or compiles on the calling thread if nobody asked before.
+class PipelineCache {
+ public:
+  static PipelineCache& get_instance() {
+    static PipelineCache instance;
+    return instance;
+  }
+
+  // Bump whenever the header below changes.
+  static constexpr uint32_t version = 1;
+
+  // Creates the cache from path if the file was written for this device and
+  // driver, empty otherwise. Has to be called before the first pipeline.
+  void load(const std::string& path);
+
+  // Writes the data of all pipelines compiled so far to the path given to
+  // load(). Returns false if that failed.
+  bool save();
+
+  void prefetch(const GraphicsPipelineDesc& desc);
+  void prefetch(const ComputePipelineDesc& desc);
+
+  vk::Pipeline get(const GraphicsPipelineDesc& desc);
+  vk::Pipeline get(const ComputePipelineDesc& desc);
+
+  // Each file is read and turned into a module once.
+  vk::ShaderModule shader_module(const std::string& path);
+
+  // Modules are only needed for compiling. Waits for prefetches in flight
+  // and destroys all modules, later compiles read them again.
+  void release_shader_modules();
+
+  // Statistics for the current process.
+  bool loaded_from_disk = false;
+  std::atomic<uint64_t> compiled_count{0};
+  uint64_t hits = 0;
+
+ private:
+  std::string path;
+  vk::PipelineCache cache;
+
+  std::mutex mutex;
+  std::unordered_map<uint64_t, std::shared_future<vk::Pipeline>> pipelines;
+  std::unordered_map<std::string, vk::ShaderModule> modules;
+
+  PipelineCache() {}
+
+  vk::Pipeline compile(const GraphicsPipelineDesc& desc);
+  vk::Pipeline compile(const ComputePipelineDesc& desc);
+
+  // Returns the pipeline of key, compiling it with compile() on the calling
+  // thread or, if async, on the ThreadPool if it is not known yet.
+  template <typename Compile>
+  std::shared_future<vk::Pipeline> find_or_compile(uint64_t key,
+                                                   Compile&& compile,
+                                                   bool async);
+};
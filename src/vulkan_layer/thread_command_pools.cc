@@ -0,0 +1,31 @@
+#include "thread_command_pools.h"
+
+#include "../core/thread_pool.h"
+
+ThreadCommandPools::ThreadCommandPools(uint32_t family) {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+  // thread_index() of the main thread is thread_count().
+  threads.resize(ThreadPool::get_instance().thread_count() + 1);
+  for (auto& thread : threads) {
+    thread.pool = vulkan_layer.create_command_pool(
+        family, vk::CommandPoolCreateFlagBits::eTransient);
+  }
+}
+
+vk::CommandBuffer ThreadCommandPools::allocate_secondary() {
+  auto& thread = threads[ThreadPool::get_instance().thread_index()];
+  if (thread.used == thread.secondaries.size()) {
+    thread.secondaries.push_back(
+        VulkanLayer::get_instance().create_command_buffer(
+            thread.pool, vk::CommandBufferLevel::eSecondary));
+  }
+  return thread.secondaries[thread.used++];
+}
+
+void ThreadCommandPools::reset() {
+  auto& device = VulkanLayer::get_instance().device;
+  for (auto& thread : threads) {
+    device.resetCommandPool(thread.pool);
+    thread.used = 0;
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "vulkan_layer.h"
+
+// One command pool per ThreadPool worker plus one for the main thread, owned
+// by a frame in flight. Command pools must not be used from two threads at
+// once, so tasks of the ThreadPool allocate secondary command buffers from
+// the pool of the thread they run on and can record in parallel.
+//
+// Buffers are kept across reset(), which recycles all of them once the
+// frame's fence signaled.
+class ThreadCommandPools {
+ public:
+  ThreadCommandPools() {}
+  explicit ThreadCommandPools(uint32_t family);
+
+  ThreadCommandPools(const ThreadCommandPools&) = delete;
+  ThreadCommandPools& operator=(const ThreadCommandPools&) = delete;
+  ThreadCommandPools(ThreadCommandPools&&) = default;
+  ThreadCommandPools& operator=(ThreadCommandPools&&) = default;
+
+  // A secondary command buffer in the initial state from the calling
+  // thread's pool.
+  vk::CommandBuffer allocate_secondary();
+
+  // Invalidates every buffer allocated so far. The GPU must be done with
+  // them.
+  void reset();
+
+ private:
+  struct ThreadPools {
+    vk::CommandPool pool;
+    std::vector<vk::CommandBuffer> secondaries;
+    // Secondaries handed out since the last reset.
+    size_t used = 0;
+  };
+
+  std::vector<ThreadPools> threads;
+};
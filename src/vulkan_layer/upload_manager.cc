@@ -0,0 +1,348 @@
+#include "upload_manager.h"
+
+#include <cstring>
+
+static constexpr vk::DeviceSize staging_alignment = 16;
+
+static vk::DeviceSize align_staging(vk::DeviceSize size) {
+  return (size + staging_alignment - 1) & ~(staging_alignment - 1);
+}
+
+UploadManager::UploadManager() {
+  auto& vulkan_layer = VulkanLayer::get_instance();
+
+  staging_buffer = vulkan_layer.create_buffer(
+      staging_size, vk::BufferUsageFlagBits::eTransferSrc,
+      VMA_MEMORY_USAGE_CPU_ONLY);
+  void* ptr;
+  staging_buffer.map(ptr);
+  staging_ptr = static_cast<char*>(ptr);
+
+  timeline = vulkan_layer.create_timeline_semaphore();
+
+  ownership_transfer =
+      vulkan_layer.transfer_queue_family != vulkan_layer.graphics_queue_family;
+}
+
+Buffer UploadManager::create_static_buffer(const void* data,
+                                           vk::DeviceSize size,
+                                           vk::BufferUsageFlags usage) {
+  auto buffer = VulkanLayer::get_instance().create_buffer(
+      size, usage | vk::BufferUsageFlagBits::eTransferDst,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  upload_buffer(buffer, 0, data, size);
+  return buffer;
+}
+
+void UploadManager::upload_buffer(const Buffer& dst, vk::DeviceSize dst_offset,
+                                  const void* data, vk::DeviceSize size) {
+  auto [src, src_offset] = stage(data, size);
+  auto& cmd = begin_batch();
+
+  vk::BufferCopy region(src_offset, dst_offset, size);
+  cmd.copyBuffer(src, dst.buffer, region);
+
+  vk::BufferMemoryBarrier release;
+  release.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  release.buffer = dst.buffer;
+  release.offset = dst_offset;
+  release.size = size;
+  if (ownership_transfer) {
+    release.srcQueueFamilyIndex =
+        VulkanLayer::get_instance().transfer_queue_family;
+    release.dstQueueFamilyIndex =
+        VulkanLayer::get_instance().graphics_queue_family;
+  } else {
+    release.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+  }
+  buffer_releases.push_back(release);
+
+  bytes_uploaded += size;
+}
+
+void UploadManager::upload_image(
+    const Image& dst, const void* data, vk::DeviceSize size,
+    const std::vector<vk::BufferImageCopy>& regions, uint32_t mip_levels) {
+  auto [src, src_offset] = stage(data, size);
+  auto& cmd = begin_batch();
+
+  vk::ImageSubresourceRange range;
+  range.aspectMask = vk::ImageAspectFlagBits::eColor;
+  range.baseMipLevel = 0;
+  range.levelCount = mip_levels;
+  range.baseArrayLayer = 0;
+  range.layerCount = 1;
+
+  vk::ImageMemoryBarrier to_transfer;
+  to_transfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+  to_transfer.oldLayout = vk::ImageLayout::eUndefined;
+  to_transfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+  to_transfer.image = dst.image;
+  to_transfer.subresourceRange = range;
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                      vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+                      to_transfer);
+
+  auto staged_regions = regions;
+  for (auto& region : staged_regions) {
+    region.bufferOffset += src_offset;
+  }
+  cmd.copyBufferToImage(src, dst.image, vk::ImageLayout::eTransferDstOptimal,
+                        staged_regions);
+
+  vk::ImageMemoryBarrier release;
+  release.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  release.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+  release.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  release.image = dst.image;
+  release.subresourceRange = range;
+  if (ownership_transfer) {
+    release.srcQueueFamilyIndex =
+        VulkanLayer::get_instance().transfer_queue_family;
+    release.dstQueueFamilyIndex =
+        VulkanLayer::get_instance().graphics_queue_family;
+  } else {
+    release.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+  }
+  image_releases.push_back(release);
+
+  bytes_uploaded += size;
+}
+
+uint64_t UploadManager::flush() {
+  retire_completed();
+  if (!transfer_cmd) {
+    return last_timeline_value;
+  }
+
+  auto& vulkan_layer = VulkanLayer::get_instance();
+
+  // On a shared family these barriers already make the data visible to
+  // everything submitted later, otherwise they release ownership.
+  transfer_cmd.pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer,
+      ownership_transfer ? vk::PipelineStageFlagBits::eBottomOfPipe
+                         : vk::PipelineStageFlagBits::eAllCommands,
+      {}, {}, buffer_releases, image_releases);
+  transfer_cmd.end();
+  staging_buffer.flush();
+
+  Submission submission;
+  submission.staging_begin = batch_begin;
+  submission.staging_end = head;
+  submission.uses_ring = !batch_empty;
+  submission.transfer_cmd = transfer_cmd;
+  submission.dedicated_staging = std::move(dedicated_staging);
+  submission.timeline_value = ++last_timeline_value;
+
+  vk::TimelineSemaphoreSubmitInfo transfer_timeline_info;
+  transfer_timeline_info.signalSemaphoreValueCount = 1;
+  transfer_timeline_info.pSignalSemaphoreValues = &submission.timeline_value;
+
+  vk::SubmitInfo transfer_submit;
+  transfer_submit.pNext = &transfer_timeline_info;
+  transfer_submit.commandBufferCount = 1;
+  transfer_submit.pCommandBuffers = &transfer_cmd;
+  transfer_submit.signalSemaphoreCount = 1;
+  transfer_submit.pSignalSemaphores = &timeline;
+  vulkan_layer.transfer_queue.submit(transfer_submit);
+
+  if (ownership_transfer) {
+    vk::CommandBuffer acquire_cmd;
+    if (free_acquire_cmds.empty()) {
+      acquire_cmd = vulkan_layer.create_command_buffer(
+          vulkan_layer.graphics_command_pool);
+    } else {
+      acquire_cmd = free_acquire_cmds.back();
+      free_acquire_cmds.pop_back();
+      acquire_cmd.reset();
+    }
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    acquire_cmd.begin(begin_info);
+
+    // Acquire barriers have to match the releases, apart from the access
+    // masks that only apply on their own side.
+    for (auto& barrier : buffer_releases) {
+      barrier.srcAccessMask = {};
+      barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+    }
+    for (auto& barrier : image_releases) {
+      barrier.srcAccessMask = {};
+      barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    }
+    acquire_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                vk::PipelineStageFlagBits::eAllCommands, {},
+                                {}, buffer_releases, image_releases);
+    acquire_cmd.end();
+
+    uint64_t wait_value = submission.timeline_value;
+    submission.timeline_value = ++last_timeline_value;
+    submission.acquire_cmd = acquire_cmd;
+
+    vk::TimelineSemaphoreSubmitInfo acquire_timeline_info;
+    acquire_timeline_info.waitSemaphoreValueCount = 1;
+    acquire_timeline_info.pWaitSemaphoreValues = &wait_value;
+    acquire_timeline_info.signalSemaphoreValueCount = 1;
+    acquire_timeline_info.pSignalSemaphoreValues = &submission.timeline_value;
+
+    vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eAllCommands;
+    vk::SubmitInfo acquire_submit;
+    acquire_submit.pNext = &acquire_timeline_info;
+    acquire_submit.waitSemaphoreCount = 1;
+    acquire_submit.pWaitSemaphores = &timeline;
+    acquire_submit.pWaitDstStageMask = &wait_stage;
+    acquire_submit.commandBufferCount = 1;
+    acquire_submit.pCommandBuffers = &acquire_cmd;
+    acquire_submit.signalSemaphoreCount = 1;
+    acquire_submit.pSignalSemaphores = &timeline;
+    vulkan_layer.graphics_queue.submit(acquire_submit);
+  }
+
+  submissions_in_flight.push_back(std::move(submission));
+  submission_count++;
+
+  transfer_cmd = nullptr;
+  buffer_releases.clear();
+  image_releases.clear();
+  dedicated_staging.clear();
+  batch_begin = head;
+  batch_empty = true;
+
+  return last_timeline_value;
+}
+
+bool UploadManager::is_complete(uint64_t timeline_value) {
+  return VulkanLayer::get_instance().device.getSemaphoreCounterValue(
+             timeline) >= timeline_value;
+}
+
+void UploadManager::wait(uint64_t timeline_value) {
+  if (timeline_value > last_timeline_value) {
+    flush();
+  }
+
+  vk::SemaphoreWaitInfo wait_info;
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores = &timeline;
+  wait_info.pValues = &timeline_value;
+  VK_CHECK(VulkanLayer::get_instance().device.waitSemaphores(wait_info,
+                                                             UINT64_MAX));
+}
+
+std::pair<vk::Buffer, vk::DeviceSize> UploadManager::stage(
+    const void* data, vk::DeviceSize size) {
+  vk::DeviceSize aligned_size = align_staging(size);
+
+  if (aligned_size > staging_size) {
+    auto buffer = VulkanLayer::get_instance().create_buffer(
+        size, vk::BufferUsageFlagBits::eTransferSrc,
+        VMA_MEMORY_USAGE_CPU_ONLY);
+    void* ptr;
+    buffer.map(ptr);
+    std::memcpy(ptr, data, size);
+    buffer.flush();
+    buffer.unmap();
+    // Goes away together with the batch it is used in.
+    dedicated_staging.push_back(buffer);
+    return {buffer.buffer, 0};
+  }
+
+  vk::DeviceSize offset;
+  while (!try_allocate(aligned_size, offset)) {
+    if (!submissions_in_flight.empty()) {
+      retire_oldest();
+    } else {
+      // The pending batch fills the whole ring on its own.
+      flush();
+    }
+  }
+  batch_empty = false;
+
+  std::memcpy(staging_ptr + offset, data, size);
+  return {staging_buffer.buffer, offset};
+}
+
+bool UploadManager::try_allocate(vk::DeviceSize size, vk::DeviceSize& offset) {
+  // Oldest byte that may still be read by the GPU.
+  bool in_use = !batch_empty;
+  vk::DeviceSize tail = batch_begin;
+  for (const auto& submission : submissions_in_flight) {
+    if (submission.uses_ring) {
+      in_use = true;
+      tail = submission.staging_begin;
+      break;
+    }
+  }
+
+  if (!in_use) {
+    head = 0;
+    batch_begin = 0;
+    tail = 0;
+  }
+
+  // With head == tail a ring in use is completely full.
+  bool wrapped = in_use && head <= tail;
+  if (!wrapped) {
+    if (head + size <= staging_size) {
+      offset = head;
+      head += size;
+      return true;
+    }
+    if (size <= tail) {
+      offset = 0;
+      head = size;
+      return true;
+    }
+    return false;
+  }
+
+  if (head + size <= tail) {
+    offset = head;
+    head += size;
+    return true;
+  }
+  return false;
+}
+
+vk::CommandBuffer& UploadManager::begin_batch() {
+  if (!transfer_cmd) {
+    if (free_transfer_cmds.empty()) {
+      transfer_cmd = VulkanLayer::get_instance().create_command_buffer(
+          VulkanLayer::get_instance().transfer_command_pool);
+    } else {
+      transfer_cmd = free_transfer_cmds.back();
+      free_transfer_cmds.pop_back();
+      transfer_cmd.reset();
+    }
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    transfer_cmd.begin(begin_info);
+  }
+  return transfer_cmd;
+}
+
+void UploadManager::retire_completed() {
+  uint64_t completed =
+      VulkanLayer::get_instance().device.getSemaphoreCounterValue(timeline);
+  while (!submissions_in_flight.empty() &&
+         submissions_in_flight.front().timeline_value <= completed) {
+    retire_oldest();
+  }
+}
+
+void UploadManager::retire_oldest() {
+  auto& submission = submissions_in_flight.front();
+  wait(submission.timeline_value);
+
+  free_transfer_cmds.push_back(submission.transfer_cmd);
+  if (submission.acquire_cmd) {
+    free_acquire_cmds.push_back(submission.acquire_cmd);
+  }
+  for (auto& buffer : submission.dedicated_staging) {
+    buffer.destroy();
+  }
+  submissions_in_flight.pop_front();
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "vulkan_layer.h"
+
+// Moves data from the host into device local memory. Uploads are staged in
+// a persistently mapped ring buffer, recorded into one batch and submitted
+// together by flush(). Completion is tracked with a timeline semaphore.
+//
+// If the device has a transfer only queue family the copies run there and
+// ownership of the destination is released to the graphics family.
+// Everything submitted to the graphics queue after flush() returned can use
+// the uploaded resources.
+class UploadManager {
+ public:
+  static UploadManager& get_instance() {
+    static UploadManager instance;
+    return instance;
+  }
+
+  static constexpr vk::DeviceSize staging_size = vk::DeviceSize(64) << 20;
+
+  // Creates a GPU only buffer and queues data for upload into it.
+  Buffer create_static_buffer(const void* data, vk::DeviceSize size,
+                              vk::BufferUsageFlags usage);
+
+  void upload_buffer(const Buffer& dst, vk::DeviceSize dst_offset,
+                     const void* data, vk::DeviceSize size);
+
+  // regions[i].bufferOffset is relative to data. Every mip level of the
+  // image ends up in eShaderReadOnlyOptimal.
+  void upload_image(const Image& dst, const void* data, vk::DeviceSize size,
+                    const std::vector<vk::BufferImageCopy>& regions,
+                    uint32_t mip_levels = 1);
+
+  // Submits all queued uploads. Returns the timeline value that signals
+  // their completion, or the last one if nothing was queued.
+  uint64_t flush();
+
+  bool is_complete(uint64_t timeline_value);
+
+  void wait(uint64_t timeline_value);
+
+  // Statistics for the current process.
+  vk::DeviceSize bytes_uploaded = 0;
+  uint64_t submission_count = 0;
+
+ private:
+  struct Submission {
+    vk::DeviceSize staging_begin;
+    vk::DeviceSize staging_end;
+    bool uses_ring;
+    uint64_t timeline_value;
+    vk::CommandBuffer transfer_cmd;
+    vk::CommandBuffer acquire_cmd;
+    std::vector<Buffer> dedicated_staging;
+  };
+
+  Buffer staging_buffer;
+  char* staging_ptr;
+
+  // Ring state. Bytes between the oldest submission using the ring and head
+  // are in use.
+  vk::DeviceSize head = 0;
+  vk::DeviceSize batch_begin = 0;
+  bool batch_empty = true;
+  std::deque<Submission> submissions_in_flight;
+
+  vk::Semaphore timeline;
+  uint64_t last_timeline_value = 0;
+
+  bool ownership_transfer;
+
+  // Current batch.
+  vk::CommandBuffer transfer_cmd;
+  std::vector<Buffer> dedicated_staging;
+  std::vector<vk::BufferMemoryBarrier> buffer_releases;
+  std::vector<vk::ImageMemoryBarrier> image_releases;
+
+  std::vector<vk::CommandBuffer> free_transfer_cmds;
+  std::vector<vk::CommandBuffer> free_acquire_cmds;
+
+  UploadManager();
+
+  // Copies data into the ring, or into a dedicated buffer if it does not fit
+  // at all, and returns the buffer and offset to copy from.
+  std::pair<vk::Buffer, vk::DeviceSize> stage(const void* data,
+                                              vk::DeviceSize size);
+
+  bool try_allocate(vk::DeviceSize size, vk::DeviceSize& offset);
+
+  vk::CommandBuffer& begin_batch();
+
+  void retire_completed();
+
+  void retire_oldest();
+};
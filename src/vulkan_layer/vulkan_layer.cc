@@ -1,13 +1,16 @@
 #include "vulkan_layer.h"
 
 #define VMA_IMPLEMENTATION
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
+#include "descriptor_allocator.h"
 #include "vk_mem_alloc.h"
 
 vk::ImageCreateInfo VulkanLayer::image2d_create_info(
-    vk::Format format, vk::ImageUsageFlags usageFlags, vk::Extent3D extent) {
+    vk::Format format, vk::ImageUsageFlags usageFlags, vk::Extent3D extent,
+    uint32_t mip_levels) {
   vk::ImageCreateInfo info;
 
   info.imageType = vk::ImageType::e2D;
@@ -15,7 +18,7 @@ vk::ImageCreateInfo VulkanLayer::image2d_create_info(
   info.format = format;
   info.extent = extent;
 
-  info.mipLevels = 1;
+  info.mipLevels = mip_levels;
   info.arrayLayers = 1;
   info.samples = vk::SampleCountFlagBits::e1;
   info.tiling = vk::ImageTiling::eOptimal;
@@ -28,19 +31,21 @@ ImageView VulkanLayer::create_2d_image_view(vk::Extent2D extend,
                                             vk::Format format,
                                             vk::ImageUsageFlags usage,
                                             vk::ImageAspectFlags aspect,
-                                            VmaMemoryUsage mem_usage) {
+                                            VmaMemoryUsage mem_usage,
+                                            uint32_t mip_levels) {
   VmaAllocationCreateInfo alloc_info = {};
   alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
   VkImage vk_image;
   VmaAllocation image_alloc_info;
   VkExtent3D image_extend = {extend.width, extend.height, 1};
-  VkImageCreateInfo ici_c = image2d_create_info(format, usage, image_extend);
+  VkImageCreateInfo ici_c =
+      image2d_create_info(format, usage, image_extend, mip_levels);
   vmaCreateImage(allocator, &ici_c, &alloc_info, &vk_image, &image_alloc_info,
                  nullptr);
 
   auto image = Image(vk::Image(vk_image), allocator, image_alloc_info);
-  auto ivci = image_view2d_create_info(image.image, format, aspect);
+  auto ivci = image_view2d_create_info(image.image, format, aspect, mip_levels);
 
   auto image_view = device.createImageView(ivci);
 
@@ -48,7 +53,8 @@ ImageView VulkanLayer::create_2d_image_view(vk::Extent2D extend,
 }
 
 vk::ImageViewCreateInfo VulkanLayer::image_view2d_create_info(
-    vk::Image& image, vk::Format format, vk::ImageAspectFlags aspect) {
+    vk::Image& image, vk::Format format, vk::ImageAspectFlags aspect,
+    uint32_t mip_levels) {
   vk::ImageViewCreateInfo ivi;
   ivi.setFormat(format);
   vk::ImageSubresourceRange sub_range;
@@ -56,19 +62,33 @@ vk::ImageViewCreateInfo VulkanLayer::image_view2d_create_info(
   sub_range.baseArrayLayer = 0;
   sub_range.baseMipLevel = 0;
   sub_range.layerCount = 1;
-  sub_range.levelCount = 1;
+  sub_range.levelCount = mip_levels;
   ivi.setSubresourceRange(sub_range);
   ivi.viewType = vk::ImageViewType::e2D;
   ivi.image = image;
   return ivi;
 }
 
+vk::DescriptorSetLayout VulkanLayer::create_descriptor_set_layout(
+    const DescriptorSetInfo& layout_info) {
+  return DescriptorLayoutCache::get_instance().get(layout_info);
+}
+
+DescriptorSet VulkanLayer::allocate_descriptor_set(
+    const DescriptorSetInfo& layout_info) {
+  auto layout = create_descriptor_set_layout(layout_info);
+  return DescriptorSet{
+      .info = layout_info,
+      .layout = layout,
+      .set = DescriptorAllocator::get_instance().allocate(layout)};
+}
+
 vk::CommandBuffer VulkanLayer::create_command_buffer(
-    vk::CommandPool& cmd_pool) {
+    vk::CommandPool& cmd_pool, vk::CommandBufferLevel level) {
   vk::CommandBufferAllocateInfo alloc_info;
   alloc_info.commandBufferCount = 1;
   alloc_info.commandPool = cmd_pool;
-  alloc_info.level = vk::CommandBufferLevel::ePrimary;
+  alloc_info.level = level;
   return device.allocateCommandBuffers(alloc_info)[0];
 }
 
@@ -96,18 +116,59 @@ vk::ShaderModule VulkanLayer::read_shader(const std::string& filename) {
   return device.createShaderModule(ci);
 }
 
-vk::PipelineShaderStageCreateInfo VulkanLayer::create_shader_stage(
-    const std::string& filename, const vk::ShaderStageFlagBits stage) {
-  vk::PipelineShaderStageCreateInfo shader_info;
-  shader_info.stage = stage;
-  shader_info.module = read_shader(filename);
-  shader_info.pName = "main";
-  return shader_info;
+bool supports_extension(const vk::PhysicalDevice& device,
+                        const char* extension_name) {
+  for (const auto& extension : device.enumerateDeviceExtensionProperties()) {
+    if (std::strcmp(extension.extensionName, extension_name) == 0) {
+      return true;
+    }
+  }
+  return false;
 }
 
-bool is_device_suitable(const vk::PhysicalDevice& device) {
+bool is_device_suitable(const vk::PhysicalDevice& device, bool headless) {
   auto deviceProperties = device.getProperties();
-  return deviceProperties.deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
+  if (deviceProperties.apiVersion < VK_API_VERSION_1_3) {
+    return false;
+  }
+
+  auto features = device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                      vk::PhysicalDeviceVulkan12Features,
+                                      vk::PhysicalDeviceVulkan13Features>();
+  const auto& features12 = features.get<vk::PhysicalDeviceVulkan12Features>();
+  if (!features.get<vk::PhysicalDeviceVulkan13Features>().dynamicRendering ||
+      !features12.timelineSemaphore) {
+    return false;
+  }
+
+  // Descriptor indexing as used by BindlessMaterials.
+  if (!features12.runtimeDescriptorArray ||
+      !features12.descriptorBindingPartiallyBound ||
+      !features12.descriptorBindingSampledImageUpdateAfterBind ||
+      !features12.descriptorBindingUpdateUnusedWhilePending ||
+      !features12.shaderSampledImageArrayNonUniformIndexing) {
+    return false;
+  }
+
+  return headless ||
+         supports_extension(device, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+}
+
+// Higher is better. Every suitable device gets a score so that machines
+// without a GPU still end up with e.g. lavapipe.
+int device_type_score(const vk::PhysicalDevice& device) {
+  switch (device.getProperties().deviceType) {
+    case vk::PhysicalDeviceType::eDiscreteGpu:
+      return 4;
+    case vk::PhysicalDeviceType::eIntegratedGpu:
+      return 3;
+    case vk::PhysicalDeviceType::eVirtualGpu:
+      return 2;
+    case vk::PhysicalDeviceType::eCpu:
+      return 1;
+    default:
+      return 0;
+  }
 }
 
 uint32_t get_queue_familiy_index(vk::PhysicalDevice& physical_device,
@@ -123,18 +184,44 @@ uint32_t get_queue_familiy_index(vk::PhysicalDevice& physical_device,
   return -1;
 }
 
+// Prefers a family that can do transfers only, those usually map to the
+// DMA engines and run copies next to graphics work. Falls back to the
+// graphics family.
+uint32_t get_transfer_queue_family_index(vk::PhysicalDevice& physical_device) {
+  int i = 0;
+  for (const auto& queueFamily : physical_device.getQueueFamilyProperties()) {
+    if ((queueFamily.queueFlags & vk::QueueFlagBits::eTransfer) &&
+        !(queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) &&
+        !(queueFamily.queueFlags & vk::QueueFlagBits::eCompute)) {
+      return i;
+    }
+
+    i++;
+  }
+  return get_queue_familiy_index(physical_device, vk::QueueFlagBits::eGraphics);
+}
+
 void VulkanLayer::setup_device() {
+  int best_score = -1;
   for (const auto& device : instance.enumeratePhysicalDevices()) {
-    if (is_device_suitable(device)) {
+    if (!is_device_suitable(device, headless)) {
+      continue;
+    }
+    int score = device_type_score(device);
+    if (score > best_score) {
       physical_device = device;
-      break;
+      best_score = score;
     }
   }
 
   if (!physical_device) {
-    throw std::runtime_error("failed to find a suitable GPU!");
+    throw std::runtime_error("failed to find a suitable Vulkan 1.3 device!");
   }
 
+  device_properties = physical_device.getProperties();
+  std::cout << "Using device: " << device_properties.deviceName.data()
+            << "\n";
+
   vk::DeviceCreateInfo dci;
   std::vector<vk::DeviceQueueCreateInfo> queue_infos(1);
 
@@ -143,17 +230,53 @@ void VulkanLayer::setup_device() {
   queue_infos[0].pQueuePriorities = &queue_priority;
   queue_infos[0].queueFamilyIndex =
       get_queue_familiy_index(physical_device, vk::QueueFlagBits::eGraphics);
+
+  uint32_t transfer_family = get_transfer_queue_family_index(physical_device);
+  if (transfer_family != queue_infos[0].queueFamilyIndex) {
+    queue_infos.push_back(queue_infos[0]);
+    queue_infos[1].queueFamilyIndex = transfer_family;
+  }
   dci.setQueueCreateInfos(queue_infos);
 
-  // Enable dynamic rendering
+  // Enable dynamic rendering, timeline semaphores and descriptor indexing
   vk::PhysicalDeviceVulkan13Features features13;
   features13.dynamicRendering = true;
-  dci.setPNext(&features13);
-
-  const char* device_extensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
-
-  dci.enabledExtensionCount = 1;
-  dci.ppEnabledExtensionNames = device_extensions;
+  vk::PhysicalDeviceVulkan12Features features12;
+  features12.timelineSemaphore = true;
+  features12.runtimeDescriptorArray = true;
+  features12.descriptorBindingPartiallyBound = true;
+  features12.descriptorBindingSampledImageUpdateAfterBind = true;
+  features12.descriptorBindingUpdateUnusedWhilePending = true;
+  features12.shaderSampledImageArrayNonUniformIndexing = true;
+  features12.pNext = &features13;
+  dci.setPNext(&features12);
+
+  // Block compressed textures and anisotropic filtering are used when
+  // available, Texture falls back to RGBA8 otherwise.
+  auto supported_features = physical_device.getFeatures();
+  device_features.samplerAnisotropy = supported_features.samplerAnisotropy;
+  device_features.textureCompressionBC =
+      supported_features.textureCompressionBC;
+
+  // Everything GpuCuller needs, the CPU culling path is used otherwise.
+  auto supported12 =
+      physical_device
+          .getFeatures2<vk::PhysicalDeviceFeatures2,
+                        vk::PhysicalDeviceVulkan12Features>()
+          .get<vk::PhysicalDeviceVulkan12Features>();
+  gpu_driven_rendering = supported12.drawIndirectCount &&
+                         supported_features.multiDrawIndirect &&
+                         supported_features.drawIndirectFirstInstance;
+  features12.drawIndirectCount = gpu_driven_rendering;
+  device_features.multiDrawIndirect = gpu_driven_rendering;
+  device_features.drawIndirectFirstInstance = gpu_driven_rendering;
+  dci.setPEnabledFeatures(&device_features);
+
+  std::vector<const char*> device_extensions;
+  if (!headless) {
+    device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+  dci.setPEnabledExtensionNames(device_extensions);
 
   device = physical_device.createDevice(dci);
 }
@@ -162,10 +285,14 @@ void VulkanLayer::setup_queues() {
   graphics_queue_family =
       get_queue_familiy_index(physical_device, vk::QueueFlagBits::eGraphics);
   graphics_queue = device.getQueue(graphics_queue_family, 0);
+
+  transfer_queue_family = get_transfer_queue_family_index(physical_device);
+  transfer_queue = device.getQueue(transfer_queue_family, 0);
 }
 
 void VulkanLayer::setup_cmd_pools() {
   graphics_command_pool = create_command_pool(graphics_queue_family);
+  transfer_command_pool = create_command_pool(transfer_queue_family);
 }
 
 bool VulkanLayer::init_vulkan() {
@@ -174,6 +301,7 @@ bool VulkanLayer::init_vulkan() {
                       .request_validation_layers()
                       .use_default_debug_messenger()
                       .require_api_version(1, 3, 0)
+                      .set_headless(headless)
                       .build();
   if (!inst_ret) {
     std::cerr << "Failed to create Vulkan instance. Error: "
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <vulkan/vulkan.hpp>
 
 #include "../../third_party/vkbootstrap/VkBootstrap.h"
@@ -16,6 +17,16 @@ class Buffer {
   void map(void*& ptr) { vmaMapMemory(allocator, alloc_info, &ptr); }
   void unmap() { vmaUnmapMemory(allocator, alloc_info); }
 
+  // Makes GPU writes visible to the host for non-coherent memory types.
+  void invalidate() {
+    vmaInvalidateAllocation(allocator, alloc_info, 0, VK_WHOLE_SIZE);
+  }
+
+  // Makes host writes visible to the GPU for non-coherent memory types.
+  void flush() { vmaFlushAllocation(allocator, alloc_info, 0, VK_WHOLE_SIZE); }
+
+  void destroy() { vmaDestroyBuffer(allocator, buffer, alloc_info); }
+
  private:
   VmaAllocator allocator;
   VmaAllocation alloc_info;
@@ -32,6 +43,8 @@ class Image {
   void map(void*& ptr) { vmaMapMemory(allocator, alloc_info, &ptr); }
   void unmap() { vmaUnmapMemory(allocator, alloc_info); }
 
+  void destroy() { vmaDestroyImage(allocator, image, alloc_info); }
+
  private:
   VmaAllocator allocator;
   VmaAllocation alloc_info;
@@ -49,11 +62,14 @@ class DescriptorSetInfo {
  public:
   vk::DescriptorSetLayoutCreateInfo info;
   std::vector<vk::DescriptorSetLayoutBinding> bindings;
+  // Empty, or the descriptor indexing flags of every binding.
+  std::vector<vk::DescriptorBindingFlags> binding_flags;
 
   DescriptorSetInfo() {}
   DescriptorSetInfo(vk::DescriptorSetLayoutCreateInfo info,
-                    std::vector<vk::DescriptorSetLayoutBinding> bindings)
-      : info{info}, bindings{bindings} {
+                    std::vector<vk::DescriptorSetLayoutBinding> bindings,
+                    std::vector<vk::DescriptorBindingFlags> binding_flags = {})
+      : info{info}, bindings{bindings}, binding_flags{binding_flags} {
     this->info.setBindings(this->bindings);
   }
 };
@@ -73,14 +89,35 @@ class VulkanLayer {
     return instance;
   }
 
+  // Has to be set before the first call to get_instance(). A headless layer
+  // does not enable any surface or swapchain extensions and accepts every
+  // Vulkan 1.3 device, including CPU implementations like lavapipe.
+  static inline bool headless = false;
+
+  // Number of frames the CPU may record ahead of the GPU. Per-frame resources
+  // like uniform buffer slices are sized by it.
+  static inline uint32_t frames_in_flight = 2;
+
   vk::Instance instance;
   vk::PhysicalDevice physical_device;
+  vk::PhysicalDeviceProperties device_properties;
+  // Optional core features that were enabled because the device has them.
+  vk::PhysicalDeviceFeatures device_features;
+  // drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance are
+  // enabled.
+  bool gpu_driven_rendering = false;
   vk::Device device;
 
   uint32_t graphics_queue_family;
   vk::Queue graphics_queue;
   vk::CommandPool graphics_command_pool;
 
+  // A transfer only family if the device has one, the graphics family
+  // otherwise.
+  uint32_t transfer_queue_family;
+  vk::Queue transfer_queue;
+  vk::CommandPool transfer_command_pool;
+
   void record_layout_transition(vk::CommandBuffer& cmd_buffer, vk::Image image,
                                 vk::ImageLayout old_layout,
                                 vk::ImageLayout new_layout,
@@ -110,14 +147,15 @@ class VulkanLayer {
                                img_mem_barriers);
   }
 
-  Buffer create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage) {
+  Buffer create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
+                       VmaMemoryUsage mem_usage = VMA_MEMORY_USAGE_CPU_TO_GPU) {
     vk::BufferCreateInfo bci;
     bci.usage = usage;
     bci.sharingMode = vk::SharingMode::eExclusive;
     bci.size = size;
 
     VmaAllocationCreateInfo aci = {};
-    aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    aci.usage = mem_usage;
 
     VkBuffer tmp_buffer;
     VmaAllocation alloc_info;
@@ -129,14 +167,26 @@ class VulkanLayer {
     return Buffer(buffer, allocator, alloc_info);
   }
 
+  // Rounds size up so that consecutive slices of a buffer can be bound as
+  // dynamic uniform buffers.
+  vk::DeviceSize pad_uniform_buffer_size(vk::DeviceSize size) {
+    auto alignment = device_properties.limits.minUniformBufferOffsetAlignment;
+    if (alignment > 0) {
+      size = (size + alignment - 1) & ~(alignment - 1);
+    }
+    return size;
+  }
+
   vk::ImageCreateInfo image2d_create_info(vk::Format format,
                                           vk::ImageUsageFlags usageFlags,
-                                          vk::Extent3D extent);
+                                          vk::Extent3D extent,
+                                          uint32_t mip_levels = 1);
 
   ImageView create_2d_image_view(vk::Extent2D extend, vk::Format format,
                                  vk::ImageUsageFlags usage,
                                  vk::ImageAspectFlags aspect,
-                                 VmaMemoryUsage mem_usage);
+                                 VmaMemoryUsage mem_usage,
+                                 uint32_t mip_levels = 1);
 
   ImageView create_image_view(Image& image, vk::Format format,
                               vk::ImageAspectFlags aspect) {
@@ -146,14 +196,28 @@ class VulkanLayer {
 
   vk::ImageViewCreateInfo image_view2d_create_info(vk::Image& image,
                                                    vk::Format format,
-                                                   vk::ImageAspectFlags aspect);
+                                                   vk::ImageAspectFlags aspect,
+                                                   uint32_t mip_levels = 1);
+
+  vk::CommandBuffer create_command_buffer(
+      vk::CommandPool& cmd_pool,
+      vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
 
-  vk::CommandBuffer create_command_buffer(vk::CommandPool& cmd_pool);
+  vk::CommandPool create_command_pool(
+      uint32_t family, vk::CommandPoolCreateFlags flags =
+                           vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
 
-  vk::Sampler create_sampler() {
+  // Trilinear filtering across mip_levels, anisotropic up to max_anisotropy
+  // if the device supports it.
+  vk::Sampler create_sampler(uint32_t mip_levels = 1,
+                             float max_anisotropy = 16.0f) {
     vk::SamplerCreateInfo ci;
-    ci.anisotropyEnable = false;
+    ci.anisotropyEnable = device_features.samplerAnisotropy;
+    ci.maxAnisotropy = std::min(
+        max_anisotropy, device_properties.limits.maxSamplerAnisotropy);
     ci.mipmapMode = vk::SamplerMipmapMode::eLinear;
+    ci.minLod = 0.0f;
+    ci.maxLod = float(mip_levels);
     ci.unnormalizedCoordinates = false;
 
     ci.addressModeU = vk::SamplerAddressMode::eRepeat;
@@ -161,19 +225,17 @@ class VulkanLayer {
     ci.addressModeW = vk::SamplerAddressMode::eRepeat;
 
     ci.compareEnable = false;
-    ci.magFilter = vk::Filter::eNearest;
-    ci.minFilter = vk::Filter::eNearest;
+    ci.magFilter = vk::Filter::eLinear;
+    ci.minFilter = vk::Filter::eLinear;
 
     return device.createSampler(ci);
   }
 
   std::vector<char> readFile(const std::string& filename);
 
+  // The caller owns the module, PipelineCache::shader_module() shares them.
   vk::ShaderModule read_shader(const std::string& filename);
 
-  vk::PipelineShaderStageCreateInfo create_shader_stage(
-      const std::string& filename, const vk::ShaderStageFlagBits stage);
-
   vk::Fence create_fence() {
     vk::FenceCreateInfo fci;
     fci.flags = vk::FenceCreateFlagBits::eSignaled;
@@ -185,53 +247,22 @@ class VulkanLayer {
     return device.createSemaphore(sci);
   }
 
-  vk::DescriptorSetLayout create_descriptor_set_layout(
-      const DescriptorSetInfo& layout_info) {
-    return device.createDescriptorSetLayout(layout_info.info);
+  vk::Semaphore create_timeline_semaphore(uint64_t initial_value = 0) {
+    vk::SemaphoreTypeCreateInfo type_info;
+    type_info.semaphoreType = vk::SemaphoreType::eTimeline;
+    type_info.initialValue = initial_value;
+    vk::SemaphoreCreateInfo sci;
+    sci.pNext = &type_info;
+    return device.createSemaphore(sci);
   }
 
-  DescriptorSet allocate_descriptor_set(const DescriptorSetInfo& layout_info) {
-    // Determine required descriptor pool sizes
-    std::vector<vk::DescriptorPoolSize> poolSizes;
-    for (const auto& layoutBinding : layout_info.bindings) {
-      bool found = false;
-      for (auto& poolSize : poolSizes) {
-        if (poolSize.type == layoutBinding.descriptorType) {
-          poolSize.descriptorCount += layoutBinding.descriptorCount;
-          found = true;
-          break;
-        }
-      }
-      if (!found) {
-        vk::DescriptorPoolSize poolSize;
-        poolSize.type = layoutBinding.descriptorType;
-        poolSize.descriptorCount = layoutBinding.descriptorCount;
-        poolSizes.push_back(poolSize);
-      }
-    }
-
-    // Create descriptor pool
-    vk::DescriptorPoolCreateInfo poolInfo;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = 1;
-
-    auto descriptor_pool = device.createDescriptorPool(poolInfo);
-
-    auto descriptor_set_layout = create_descriptor_set_layout(layout_info);
-
-    // Allocate descriptor set from descriptor pool
-    vk::DescriptorSetAllocateInfo allocInfo;
-    allocInfo.descriptorPool = descriptor_pool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = &descriptor_set_layout;
-
-    auto descriptorSet = device.allocateDescriptorSets(allocInfo)[0];
+  // Returns the cached layout for these bindings, see DescriptorLayoutCache.
+  vk::DescriptorSetLayout create_descriptor_set_layout(
+      const DescriptorSetInfo& layout_info);
 
-    return DescriptorSet{.info = layout_info,
-                         .layout = descriptor_set_layout,
-                         .set = descriptorSet};
-  }
+  // Allocates a set that lives as long as the device from the persistent
+  // DescriptorAllocator.
+  DescriptorSet allocate_descriptor_set(const DescriptorSetInfo& layout_info);
 
  private:
   VmaAllocator allocator;
@@ -245,8 +276,5 @@ class VulkanLayer {
   void setup_queues();
   void setup_cmd_pools();
   bool init_memory_allocator();
-  vk::CommandPool create_command_pool(
-      uint32_t family, vk::CommandPoolCreateFlags flags =
-                           vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
   ~VulkanLayer();
 };
\ No newline at end of file